@@ -0,0 +1,91 @@
+/*
+Element-wise array arithmetic for the ADDA, SUBA, ANDA, ORA and XORA opcodes.
+
+Each operation and width gets a vector loop over whole registers, picked once
+per call rather than per element, and a scalar loop for whatever is left. The
+AVX2 loops are compiled for that target on their own, so the rest of the VM
+still runs on any x86-64; which loops a call takes depends on what the CPU
+reports.
+*/
+
+#include <string.h>
+#include "array.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_SSE2 1
+#else
+#define HAVE_SSE2 0
+#endif
+
+#define SCALAR_LOOP(T, expr) \
+  for(; i + sizeof(T) <= bytes; i += sizeof(T)) { \
+    T a, b, r; \
+    memcpy(&a, x + i, sizeof(T)); \
+    memcpy(&b, y + i, sizeof(T)); \
+    r = (T)(expr); \
+    memcpy(out + i, &r, sizeof(T)); \
+  }
+
+#define SCALAR_WIDTHS(expr) \
+  if(width == 1) SCALAR_LOOP(uint8_t, expr) \
+  else if(width == 2) SCALAR_LOOP(uint16_t, expr) \
+  else SCALAR_LOOP(uint32_t, expr)
+
+// the elements from byte i on
+static void scalar(unsigned int op, unsigned int width, uint8_t* out, const uint8_t* x, const uint8_t* y, size_t i, size_t bytes) {
+  switch(op) {
+    case ARRAY_ADD: SCALAR_WIDTHS(a + b) break;
+    case ARRAY_SUB: SCALAR_WIDTHS(a - b) break;
+    case ARRAY_AND: SCALAR_WIDTHS(a & b) break;
+    case ARRAY_OR: SCALAR_WIDTHS(a | b) break;
+    case ARRAY_XOR: SCALAR_WIDTHS(a ^ b) break;
+  }
+}
+
+#if HAVE_SSE2
+// vop over whole vectors of type V from byte i on
+#define VECTOR_LOOP(V, load, store, vop) \
+  for(; i + sizeof(V) <= bytes; i += sizeof(V)) \
+    store((V*)(out + i), vop(load((const V*)(x + i)), load((const V*)(y + i))));
+
+#define VECTOR_OPS(V, load, store, add8, add16, add32, sub8, sub16, sub32, and, or, xor) \
+  size_t i = 0; \
+  switch(op * 4 + width) { \
+    case ARRAY_ADD * 4 + 1: VECTOR_LOOP(V, load, store, add8) break; \
+    case ARRAY_ADD * 4 + 2: VECTOR_LOOP(V, load, store, add16) break; \
+    case ARRAY_ADD * 4 + 4: VECTOR_LOOP(V, load, store, add32) break; \
+    case ARRAY_SUB * 4 + 1: VECTOR_LOOP(V, load, store, sub8) break; \
+    case ARRAY_SUB * 4 + 2: VECTOR_LOOP(V, load, store, sub16) break; \
+    case ARRAY_SUB * 4 + 4: VECTOR_LOOP(V, load, store, sub32) break; \
+    default: \
+      if(op == ARRAY_AND) \
+        VECTOR_LOOP(V, load, store, and) \
+      else if(op == ARRAY_OR) \
+        VECTOR_LOOP(V, load, store, or) \
+      else \
+        VECTOR_LOOP(V, load, store, xor) \
+  } \
+  return i; // how far the vectors got
+
+static size_t sse2(unsigned int op, unsigned int width, uint8_t* out, const uint8_t* x, const uint8_t* y, size_t bytes) {
+  VECTOR_OPS(__m128i, _mm_loadu_si128, _mm_storeu_si128,
+    _mm_add_epi8, _mm_add_epi16, _mm_add_epi32, _mm_sub_epi8, _mm_sub_epi16, _mm_sub_epi32,
+    _mm_and_si128, _mm_or_si128, _mm_xor_si128)
+}
+
+__attribute__((target("avx2")))
+static size_t avx2(unsigned int op, unsigned int width, uint8_t* out, const uint8_t* x, const uint8_t* y, size_t bytes) {
+  VECTOR_OPS(__m256i, _mm256_loadu_si256, _mm256_storeu_si256,
+    _mm256_add_epi8, _mm256_add_epi16, _mm256_add_epi32, _mm256_sub_epi8, _mm256_sub_epi16, _mm256_sub_epi32,
+    _mm256_and_si256, _mm256_or_si256, _mm256_xor_si256)
+}
+#endif
+
+void arrayOp(unsigned int op, unsigned int width, uint8_t* out, const uint8_t* x, const uint8_t* y, size_t count) {
+  size_t bytes = count * width, done = 0;
+#if HAVE_SSE2
+  done = __builtin_cpu_supports("avx2") ? avx2(op, width, out, x, y, bytes) : sse2(op, width, out, x, y, bytes);
+#endif
+  scalar(op, width, out, x, y, done, bytes);
+}
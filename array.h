@@ -0,0 +1,18 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// element-wise operations of the ADDA*/SUBA*/ANDA*/ORA*/XORA* opcodes, in
+// opcode order
+enum { ARRAY_ADD, ARRAY_SUB, ARRAY_AND, ARRAY_OR, ARRAY_XOR };
+
+// Sets out[i] = x[i] op y[i] for count elements of width 1, 2 or 4 bytes,
+// wrapping around like the scalar opcodes. Elements are in host byte order,
+// as the stacks keep them, and need not be aligned. out may be x itself, but
+// must not overlap x or y otherwise. Uses AVX2 where the CPU has it, SSE2 on
+// other x86-64 CPUs and plain C elsewhere.
+void arrayOp(unsigned int op, unsigned int width, uint8_t* out, const uint8_t* x, const uint8_t* y, size_t count);
+
+#endif
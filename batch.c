@@ -0,0 +1,104 @@
+/*
+Batch mode: one program, many inputs. Starting a vm process per input costs a
+program load, decode, verification and fusion every time, for programs that
+often run for microseconds. Here the Program is prepared once by the caller
+and every record reuses the same VM; between records only pc, the stack
+pointers and the flags are reset, or, with a snapshot of the program's setup
+to start from, put back the way the snapshot has them.
+
+Output is captured per record through VM.output, so each frame can say up
+front how long it is, and a program that prints a newline or a frame header
+of its own can't break the framing.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+
+typedef struct {
+  char* bytes;
+  size_t length;
+  size_t capacity;
+  int failed; // out of memory
+} Capture;
+
+static void capture(void* arg, const char* bytes, uint32_t length) {
+  Capture* c = arg;
+  if(c->length + length > c->capacity) {
+    size_t capacity = c->capacity ? c->capacity : OUT_BUFFER_SIZE;
+    while(capacity < c->length + length)
+      capacity *= 2;
+    char* grown = realloc(c->bytes, capacity);
+    if(grown == NULL) {
+      c->failed = 1;
+      return;
+    }
+    c->bytes = grown;
+    c->capacity = capacity;
+  }
+  memcpy(c->bytes + c->length, bytes, length);
+  c->length += length;
+}
+
+const char* errorName(RuntimeError error) {
+  switch(error) {
+    case NONE: return "ok";
+    case ERR_ARITHMETIC: return "arithmetic";
+    case ERR_STACK_OVERFLOW: return "stack-overflow";
+    case ERR_STACK_UNDERFLOW: return "stack-underflow";
+    case ERR_INSUFFICIENT_PERMISSIONS: return "insufficient-permissions";
+    case ERR_TARGET: return "target";
+    case ERR_END_OF_INPUT: return "end-of-input";
+    case ERR_MALFORMED_INPUT: return "malformed-input";
+    case ERR_CALL_OVERFLOW: return "call-overflow";
+    case ERR_CALL_UNDERFLOW: return "call-underflow";
+  }
+  return "unknown";
+}
+
+int runBatch(VM* vm, const Program* program, ExecMode mode, SleepMode sleep, const Snapshot* start, FILE* records, FILE* out) {
+  Capture output = {0};
+  Input input;
+  char* line = NULL;
+  size_t lineCapacity = 0;
+  ssize_t length;
+  int result = 0;
+
+  vmInit(vm, program);
+  vm->mode = mode;
+  vm->sleepMode = sleep;
+  vm->output = capture;
+  vm->outputArg = &output;
+  vm->input = &input;
+  for(unsigned long long record = 0; (length = getline(&line, &lineCapacity, records)) >= 0; record++) {
+    if(inputOpenBytes(&input, (const uint8_t*)line, length)) {
+      result = -1;
+      break;
+    }
+    if(start)
+      snapshotRestore(start, vm);
+    else
+      vmReset(vm);
+    output.length = 0;
+    vmRun(vm);
+    inputClose(&input);
+    if(output.failed) {
+      result = -1;
+      break;
+    }
+    fprintf(out, "%llu %s ", record, errorName(vm->last_error));
+    if(vm->last_error == NONE)
+      fputc('-', out);
+    else
+      fprintf(out, "%x", vm->pc);
+    fprintf(out, " %zu\n", output.length);
+    fwrite(output.bytes, 1, output.length, out);
+    fputc('\n', out);
+  }
+  if(ferror(records))
+    result = -1;
+  free(line);
+  free(output.bytes);
+  return result;
+}
@@ -0,0 +1,23 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include "vm.h"
+#include "snapshot.h"
+
+// Runs program once per line of records on vm, made by vmCreate(), which is
+// only reset in between, or put back to start if that isn't NULL, with that
+// line as the input of its GETN*s. Writes a frame per record to out:
+//
+//   <record> <status> <pc> <length>\n<length bytes of output>\n
+//
+// record counts from 0, status is "ok" or one of the names errorName() gives,
+// pc is the hex byte pc of the error ("-" for ok), and length is in bytes.
+// Returns 0, or -1 if reading records or memory ran out.
+// SLEEPs are in sleep's way (see SleepMode; not SLEEP_PARK).
+int runBatch(VM* vm, const Program* program, ExecMode mode, SleepMode sleep, const Snapshot* start, FILE* records, FILE* out);
+
+// Short name of a RuntimeError for the frames, such as "stack-underflow".
+const char* errorName(RuntimeError error);
+
+#endif
@@ -0,0 +1,680 @@
+/*
+Interpreter benchmarks. Each kernel is built in memory with emit.h and run to
+completion in every execution mode, with and without superinstructions and
+stack checks, and natively. The micro kernels each exercise one family of
+opcodes in a counted loop; the macro kernels are small whole programs.
+
+  bench [kernel...]
+
+Output is one line per kernel and mode, in whitespace-separated columns under
+a header line, for scripts to diff across changes to run():
+
+  kernel  mode  insns  ns_per_insn  insns_per_sec  peak_rss_kb
+
+Times are the best of REPEAT runs. Instruction counts are exact: every kernel
+first runs once in MODE_TRACED, untimed, to count the instructions it
+executes. Each kernel and mode is measured in a child process of its own, so
+peak RSS is that run's alone. Verified modes are left out for kernels
+programVerify() rejects, since they would just repeat the unverified ones.
+
+The output kernels print to /dev/null, and run once more in the stdio mode,
+which prints numbers and strings through printf() and fwrite() instead of the VM's
+own output buffer, for comparison. The sliced modes run the fused and JIT
+modes in vmRunFor() slices of SLICE instructions, resuming after each, to show
+what checking and switching slices costs.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "emit.h"
+#include "../vm.h"
+#include "../jit.h"
+
+#define REPEAT 5
+#define ITERATIONS 500000
+#define SLICE 1000 // instructions, in the sliced modes
+
+typedef struct {
+  const char* name;
+  void (*build)(Emitter* e);
+  int prints; // has a stdio row
+} Kernel;
+
+// ---- micro kernels ----
+
+// LET<op> A k; <op> A, eight times per iteration, accumulating on A
+static void chain(Emitter* e, InstructionSet let, InstructionSet arith) {
+  let32(e, B, ITERATIONS);
+  if(let == LET8)
+    let8(e, A, 1);
+  else if(let == LET16)
+    let16(e, A, 1);
+  else
+    let32(e, A, 1);
+  uint32_t loop = e->size;
+  for(int i = 0; i < 8; i++) {
+    if(let == LET8)
+      let8(e, A, 3 + i);
+    else if(let == LET16)
+      let16(e, A, 3 + i);
+    else
+      let32(e, A, 3 + i);
+    op(e, arith, A);
+  }
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, loop);
+  op(e, END, A);
+}
+
+static void add8(Emitter* e) { chain(e, LET8, ADD8); }
+static void add32(Emitter* e) { chain(e, LET32, ADD32); }
+static void sub16(Emitter* e) { chain(e, LET16, SUB16); }
+static void mul32(Emitter* e) { chain(e, LET32, MUL32); }
+static void div32(Emitter* e) { chain(e, LET32, DIV32); }
+static void shl8(Emitter* e) { chain(e, LET8, SL8); }
+static void shr16(Emitter* e) { chain(e, LET16, SR16); }
+static void sar32(Emitter* e) { chain(e, LET32, SSR32); }
+
+// CPY, MOV, SWP and DEL between stacks, in all three widths, leaving the
+// stacks as they found them
+static void moves(Emitter* e) {
+  let32(e, A, 1);
+  let32(e, B, 2);
+  let32(e, C, ITERATIONS);
+  uint32_t loop = e->size;
+  op2(e, CPY32, A, B);
+  op2(e, MOV32, B, A);
+  op2(e, SWP32, A, B);
+  op2(e, MOV16, A, D);
+  op2(e, MOV16, D, A);
+  op2(e, CPY8, A, D);
+  op2(e, SWP8, A, D);
+  op(e, DEL8, D);
+  op2(e, SWP32, A, B);
+  op(e, DEL32, A);
+  op(e, DEC32, C);
+  branch(e, BRNZ, C, loop);
+  op(e, END, A);
+}
+
+// a*x*x + b*x + c over a counter, with operands kept on two stacks
+static void poly32(Emitter* e) {
+  let32(e, B, ITERATIONS);
+  uint32_t loop = e->size;
+  op2(e, CPY32, B, A);
+  op2(e, CPY32, B, A);
+  op(e, MUL32, A);
+  let32(e, A, 7);
+  op(e, MUL32, A);
+  op2(e, CPY32, B, A);
+  let32(e, A, 5);
+  op(e, MUL32, A);
+  op(e, ADD32, A);
+  let32(e, A, 3);
+  op(e, ADD32, A);
+  op(e, DEL32, A);
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, loop);
+  op(e, END, A);
+}
+
+// every conditional branch, taken and not, over flags set by STZ and DEC
+static void branches(Emitter* e) {
+  static const InstructionSet forward[] = { BRNZ, BRZ, BRNN, BRN, BR };
+  let32(e, B, ITERATIONS);
+  uint32_t loop = e->size;
+  op(e, STZ, A);
+  for(size_t i = 0; i < sizeof(forward) / sizeof(forward[0]); i++) {
+    uint32_t over = branchForward(e, forward[i], A);
+    op(e, NOP, A); // skipped by the taken ones
+    patch(e, over);
+  }
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, loop);
+  op(e, END, A);
+}
+
+// counts down with an explicit EQU against zero, the way compilers emit loops
+static void equloop(Emitter* e) {
+  let32(e, B, ITERATIONS);
+  uint32_t loop = e->size;
+  let32(e, B, 1);
+  op(e, SUB32, B);
+  op2(e, CPY32, B, A);
+  let32(e, A, 0);
+  op(e, EQU32, A);
+  branch(e, BRNZ, A, loop);
+  op(e, END, A);
+}
+
+static const uint8_t block[64] = {
+  3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5, 8, 9, 7, 9, 3, 2, 3, 8, 4, 6, 2, 6, 4, 3, 3, 8, 3, 2, 7, 9, 5,
+  0, 2, 8, 8, 4, 1, 9, 7, 1, 6, 9, 3, 9, 9, 3, 7, 5, 1, 0, 5, 8, 2, 0, 9, 7, 4, 9, 4, 4, 5, 9, 2,
+};
+
+// LETA a 64-byte payload onto B and DELA it again
+static void letaLoop(Emitter* e) {
+  let32(e, C, ITERATIONS);
+  uint32_t loop = e->size;
+  leta(e, A, B, block, sizeof(block));
+  let16(e, B, sizeof(block));
+  op(e, DELA, B);
+  op(e, DEC32, C);
+  branch(e, BRNZ, C, loop);
+  op(e, END, A);
+}
+
+// CPYA 64 bytes from A to B and DELA them again
+static void cpyaLoop(Emitter* e) {
+  leta(e, A, A, block, sizeof(block));
+  let32(e, C, ITERATIONS);
+  uint32_t loop = e->size;
+  let16(e, A, sizeof(block));
+  op2(e, CPYA, A, B);
+  let16(e, B, sizeof(block));
+  op(e, DELA, B);
+  op(e, DEC32, C);
+  branch(e, BRNZ, C, loop);
+  op(e, END, A);
+}
+
+// folds a 256-byte block on A into a running 256-byte result on B with one
+// array opcode per iteration: B = B op copy of A
+static void arrays(Emitter* e, InstructionSet arith, unsigned int width) {
+  for(int i = 0; i < 4; i++)
+    leta(e, A, A, block, sizeof(block));
+  for(int i = 0; i < 4; i++)
+    leta(e, B, B, block, sizeof(block));
+  let32(e, C, ITERATIONS);
+  uint32_t loop = e->size;
+  let16(e, A, 4 * sizeof(block));
+  op2(e, CPYA, A, B);
+  let16(e, B, 4 * sizeof(block) / width);
+  op(e, arith, B);
+  op(e, DEC32, C);
+  branch(e, BRNZ, C, loop);
+  op(e, END, A);
+}
+
+static void adda8(Emitter* e) { arrays(e, ADDA8, 1); }
+static void xora32(Emitter* e) { arrays(e, XORA32, 4); }
+
+// DMPN32 the loop counter and a newline after it
+static void dmpn(Emitter* e) {
+  let32(e, D, ITERATIONS);
+  uint32_t loop = e->size;
+  op2(e, CPY32, D, A);
+  op(e, DMPN32, A);
+  dmpsstr(e, "\n");
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, loop);
+  op(e, END, A);
+}
+
+// DMPSSTR a line of text
+static void dmpsstrLoop(Emitter* e) {
+  let32(e, D, ITERATIONS);
+  uint32_t loop = e->size;
+  dmpsstr(e, "the quick brown fox jumps over the lazy dog\n");
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, loop);
+  op(e, END, A);
+}
+
+// ---- macro kernels ----
+
+#define FIB_STEPS 46 // fib(47) is the last that fits in 32 bits
+#define FIB_RUNS (ITERATIONS / 25)
+#define PRIMES_BELOW 20000
+#define NESTED 100 // iterations of each of the three loops
+#define CHECKSUM_RUNS (ITERATIONS / 10)
+#define FIB_N 20 // recursive fib(20): 21891 calls
+#define FIB_CALL_RUNS 20
+#define ACK_M 3 // ack(3, 4): 10307 calls, 127 deep at most
+#define ACK_N 4
+#define ACK_RUNS 40
+#define FRAMES (ITERATIONS / 10)
+
+// iterative Fibonacci, FIB_RUNS times over: a on A, b on C, counters on B and D
+static void fib(Emitter* e) {
+  let32(e, D, FIB_RUNS);
+  uint32_t run = e->size;
+  let32(e, A, 0);
+  let32(e, C, 1);
+  let32(e, B, FIB_STEPS);
+  uint32_t step = e->size;
+  op2(e, CPY32, C, A); // A: a b
+  op2(e, ADD32, A, C); // C: b a+b
+  op2(e, MOV32, C, A); // A: a+b, C: b
+  op2(e, SWP32, A, C); // A: b, C: a+b
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, step);
+  op(e, DEL32, B);
+  op(e, DEL32, A);
+  op(e, DEL32, C);
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, run);
+  op(e, END, A);
+}
+
+// counts the primes below PRIMES_BELOW by trial division; CLAW has no indexed
+// memory to sieve in. n on A, the divisor on B, the count on D
+static void primes(Emitter* e) {
+  let32(e, A, 2);
+  let32(e, D, 0);
+  uint32_t candidate = e->size;
+  let32(e, B, 2);
+  uint32_t divisor = e->size;
+  op2(e, CPY32, A, C);
+  op2(e, CPY32, B, C);
+  op2(e, CPY32, B, C);
+  op(e, MUL32, C);
+  op(e, SUB32, C); // n - d*d, negative once every divisor up to sqrt(n) failed
+  op(e, DEL32, C);
+  uint32_t prime = branchForward(e, BRN, C);
+  op2(e, CPY32, A, C);
+  op2(e, CPY32, B, C);
+  op(e, MOD32, C);
+  op(e, DEL32, C);
+  uint32_t composite = branchForward(e, BRZ, C);
+  op(e, INC32, B);
+  branch(e, BR, B, divisor);
+  patch(e, prime);
+  op(e, INC32, D);
+  patch(e, composite);
+  op(e, DEL32, B);
+  op(e, INC32, A);
+  op2(e, CPY32, A, C);
+  let32(e, C, PRIMES_BELOW);
+  op(e, SUB32, C);
+  op(e, DEL32, C);
+  branch(e, BRNZ, C, candidate);
+  op(e, END, A);
+}
+
+// three nested counted loops summing the innermost counter into A
+static void nested(Emitter* e) {
+  let32(e, A, 0);
+  let32(e, D, NESTED);
+  uint32_t outer = e->size;
+  let32(e, C, NESTED);
+  uint32_t middle = e->size;
+  let32(e, B, NESTED);
+  uint32_t inner = e->size;
+  op2(e, CPY32, B, A);
+  op(e, ADD32, A);
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, inner);
+  op(e, DEL32, B);
+  op(e, DEC32, C);
+  branch(e, BRNZ, C, middle);
+  op(e, DEL32, C);
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, outer);
+  op(e, END, A);
+}
+
+// 32-bit FNV-1a over the words of a 64-byte block, CHECKSUM_RUNS times over:
+// the hash on A, the block on B, counters on C and D
+static void checksum(Emitter* e) {
+  let32(e, A, 2166136261u);
+  let32(e, D, CHECKSUM_RUNS);
+  uint32_t run = e->size;
+  leta(e, A, B, block, sizeof(block));
+  let32(e, C, sizeof(block) / 4);
+  uint32_t word = e->size;
+  op2(e, MOV32, B, A);
+  op(e, XOR32, A);
+  let32(e, A, 16777619);
+  op(e, MUL32, A);
+  op(e, DEC32, C);
+  branch(e, BRNZ, C, word);
+  op(e, DEL32, C);
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, run);
+  op(e, END, A);
+}
+
+// A call to the function at byte pc fn: either CALL, or the sequence
+// compilers emit without it, which keeps the return address on D. PPTR pushes
+// the byte pc right after itself, 16 bytes short of where the JMP ends.
+static void call(Emitter* e, int emulated, uint32_t fn) {
+  if(!emulated) {
+    branch(e, CALL, A, fn);
+    return;
+  }
+  op(e, PPTR, D);
+  let32(e, D, 16);
+  op(e, ADD32, D);
+  let32(e, B, fn);
+  op(e, JMP, B);
+}
+
+static void ret(Emitter* e, int emulated) {
+  op(e, emulated ? JMP : RET, D);
+}
+
+// recursive Fibonacci, FIB_CALL_RUNS times over: n and the result on A, n
+// saved across the first call on C, fib(n - 1) across the second on B, and
+// the run counter under that on B
+static void fibRecursive(Emitter* e, int emulated) {
+  uint32_t main = branchForward(e, BR, A);
+  uint32_t fn = e->size;
+  op2(e, CPY32, A, B);
+  let32(e, B, 2);
+  op(e, SUB32, B);
+  op(e, DEL32, B);
+  uint32_t base = branchForward(e, BRN, B);
+  op2(e, CPY32, A, C);
+  op(e, DEC32, A);
+  call(e, emulated, fn);
+  op2(e, MOV32, A, B);
+  op2(e, MOV32, C, A);
+  op(e, DEC32, A);
+  op(e, DEC32, A);
+  call(e, emulated, fn);
+  op2(e, MOV32, B, A);
+  op(e, ADD32, A);
+  ret(e, emulated);
+  patch(e, base);
+  ret(e, emulated);
+  patch(e, main);
+  let32(e, B, FIB_CALL_RUNS);
+  uint32_t run = e->size;
+  let32(e, A, FIB_N);
+  call(e, emulated, fn);
+  op(e, DEL32, A);
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, run);
+  op(e, END, A);
+}
+
+static void fibCall(Emitter* e) { fibRecursive(e, 0); }
+static void fibJmp(Emitter* e) { fibRecursive(e, 1); }
+
+// Ackermann's function, ACK_RUNS times over: m and n on A, replaced by the
+// result; n on C while m is tested, m saved across the inner call on B, and
+// the run counter under that on B
+static void ackermann(Emitter* e, int emulated) {
+  uint32_t main = branchForward(e, BR, A);
+  uint32_t fn = e->size;
+  op2(e, MOV32, A, C);
+  op2(e, CPY32, A, B);
+  let32(e, B, 0);
+  op(e, EQU32, B);
+  uint32_t m0 = branchForward(e, BRZ, B);
+  op2(e, CPY32, C, B);
+  let32(e, B, 0);
+  op(e, EQU32, B);
+  uint32_t n0 = branchForward(e, BRZ, B);
+  // ack(m - 1, ack(m, n - 1))
+  op2(e, CPY32, A, B);
+  op(e, DEC32, C);
+  op2(e, MOV32, C, A);
+  call(e, emulated, fn);
+  op2(e, MOV32, A, C);
+  op2(e, MOV32, B, A);
+  op(e, DEC32, A);
+  op2(e, MOV32, C, A);
+  call(e, emulated, fn);
+  ret(e, emulated);
+  // n + 1
+  patch(e, m0);
+  op(e, DEL32, A);
+  op2(e, MOV32, C, A);
+  op(e, INC32, A);
+  ret(e, emulated);
+  // ack(m - 1, 1)
+  patch(e, n0);
+  op(e, DEL32, C);
+  op(e, DEC32, A);
+  let32(e, A, 1);
+  call(e, emulated, fn);
+  ret(e, emulated);
+  patch(e, main);
+  let32(e, B, ACK_RUNS);
+  uint32_t run = e->size;
+  let32(e, A, ACK_M);
+  let32(e, A, ACK_N);
+  call(e, emulated, fn);
+  op(e, DEL32, A);
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, run);
+  op(e, END, A);
+}
+
+static void ackCall(Emitter* e) { ackermann(e, 0); }
+static void ackJmp(Emitter* e) { ackermann(e, 1); }
+
+// LET16 each of n operands onto A, then the graphics opcode
+static void shape(Emitter* e, InstructionSet code, const int16_t* operands, int n) {
+  for(int i = 0; i < n; i++)
+    let16(e, A, operands[i]);
+  op(e, code, A);
+}
+
+// FRAMES frames of a small dashboard: a panel, a gauge and a needle drawn
+// over it, a filled marker, XORed in, then SWBUFF
+static void frames(Emitter* e) {
+  static const int16_t panel[] = { 2, 2, 124, 60 }, frame[] = { 0, 0, 128, 64 };
+  static const int16_t gauge[] = { 40, 34, 24 }, needle[] = { 40, 34, 58, 20 };
+  static const int16_t marker[] = { 96, 32, 20, 12 }, tick[] = { 70, 12, 50 };
+  let32(e, C, FRAMES);
+  uint32_t loop = e->size;
+  op(e, CLR, A);
+  shape(e, LRECT, frame, 4);
+  shape(e, RECT, panel, 4);
+  let8(e, A, 0);
+  op(e, COLOR, A);
+  shape(e, LCIRCL, gauge, 3);
+  shape(e, LINE, needle, 4);
+  shape(e, HLINE, tick, 3);
+  let8(e, A, 1);
+  op(e, COLOR, A);
+  let8(e, A, GMODE_XOR);
+  op(e, GMODE, A);
+  shape(e, ELIPS, marker, 4);
+  let8(e, A, GMODE_SET);
+  op(e, GMODE, A);
+  op(e, SWBUFF, A);
+  op(e, DEC32, C);
+  branch(e, BRNZ, C, loop);
+  op(e, END, A);
+}
+
+static const Kernel kernels[] = {
+  { "moves", moves },
+  { "add8", add8 },
+  { "add32", add32 },
+  { "sub16", sub16 },
+  { "mul32", mul32 },
+  { "div32", div32 },
+  { "shl8", shl8 },
+  { "shr16", shr16 },
+  { "sar32", sar32 },
+  { "poly32", poly32 },
+  { "branches", branches },
+  { "equloop", equloop },
+  { "leta", letaLoop },
+  { "cpya", cpyaLoop },
+  { "adda8", adda8 },
+  { "xora32", xora32 },
+  { "dmpn", dmpn, 1 },
+  { "dmpsstr", dmpsstrLoop, 1 },
+  { "fib", fib },
+  { "primes", primes },
+  { "nested", nested },
+  { "checksum", checksum },
+  { "fibcall", fibCall },
+  { "fibjmp", fibJmp },
+  { "ackcall", ackCall },
+  { "ackjmp", ackJmp },
+  { "frames", frames },
+};
+
+static const struct {
+  const char* name;
+  ExecMode mode;
+  int fuse;
+  int verify;
+  int stdio; // print through stdio, only for kernels that print
+  uint64_t slice; // run in vmRunFor() slices of this many instructions
+} modes[] = {
+  { "plain", MODE_PLAIN, 0, 0 },
+  { "tos-cache", MODE_TOS_CACHE, 0, 0 },
+  { "fused", MODE_PLAIN, 1, 0 },
+  { "tos-fused", MODE_TOS_CACHE, 1, 0 },
+  { "verified", MODE_PLAIN, 0, 1 },
+  { "ver-fused", MODE_PLAIN, 1, 1 },
+  { "jit", MODE_JIT, 0, 0 },
+  { "stdio", MODE_PLAIN, 0, 0, 1 },
+  { "sliced", MODE_PLAIN, 1, 0, 0, SLICE },
+  { "jit-sliced", MODE_JIT, 0, 0, 0, SLICE },
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void countInsn(void* arg, uint32_t pc, unsigned int op) {
+  (void)pc;
+  if(op < OP_RESYNC) // internal handlers stand for no instruction of their own
+    ++*(uint64_t*)arg;
+}
+
+static VM vm;
+
+// where the kernels print to
+static int devNull(void) {
+  static int fd = -1;
+  if(fd < 0)
+    fd = open("/dev/null", O_WRONLY);
+  return fd;
+}
+
+// Instructions the unfused program executes, or 0 if it faults.
+static uint64_t countInsns(const Kernel* k, const Emitter* e) {
+  Program program;
+  if(programLoad(&program, e->bytes, e->size)) {
+    fputs("Memory error\n", stderr);
+    return 0;
+  }
+  uint64_t insns = 0;
+  vmInit(&vm, &program);
+  vm.mode = MODE_TRACED;
+  vm.trace = countInsn;
+  vm.traceArg = &insns;
+  vm.outFd = devNull();
+  vmRun(&vm);
+  if(vm.last_error != NONE) {
+    fprintf(stderr, "%s: runtime error %d at %x\n", k->name, vm.last_error, vm.pc);
+    insns = 0;
+  }
+  programFree(&program);
+  return insns;
+}
+
+// Times one kernel in one mode and prints its line. Runs in a child process.
+static int measure(const Kernel* k, const Emitter* e, size_t m, uint64_t insns) {
+  Program program;
+  if(programLoad(&program, e->bytes, e->size)) {
+    fputs("Memory error\n", stderr);
+    return 2;
+  }
+  if((modes[m].verify && programVerify(&program)) || (modes[m].stdio && !k->prints)) {
+    programFree(&program);
+    return 0;
+  }
+  if(modes[m].fuse)
+    programFuse(&program);
+  if(modes[m].mode == MODE_JIT)
+    jitCompile(&program);
+  // stdio prints to stdout, so point that at /dev/null while the kernel runs
+  int results = dup(STDOUT_FILENO);
+  if(results < 0 || devNull() < 0 || dup2(devNull(), STDOUT_FILENO) < 0) {
+    perror("/dev/null");
+    return 2;
+  }
+  double best = 0;
+  for(int r = 0; r < REPEAT; r++) {
+    vmInit(&vm, &program);
+    vm.mode = modes[m].mode;
+    vm.outFd = modes[m].stdio ? -1 : devNull();
+    double start = now();
+    if(modes[m].slice) {
+      while(vmRunFor(&vm, modes[m].slice) == RUN_YIELD)
+        ;
+    } else {
+      vmRun(&vm);
+    }
+    fflush(stdout);
+    double t = now() - start;
+    if(vm.last_error != NONE) {
+      fprintf(stderr, "%s: runtime error %d at %x\n", k->name, vm.last_error, vm.pc);
+      return 1;
+    }
+    if(r == 0 || t < best)
+      best = t;
+  }
+  dup2(results, STDOUT_FILENO);
+  close(results);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("%-9s %-10s %10llu %11.2f %13.0f %11ld\n", k->name, modes[m].name,
+         (unsigned long long)insns, best * 1e9 / insns, insns / best, usage.ru_maxrss);
+  programFree(&program);
+  return 0;
+}
+
+static int selected(const char* name, int argc, char* argv[]) {
+  if(argc < 2)
+    return 1;
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], name))
+      return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  if(vmCreate(&vm, NULL)) {
+    perror("vmCreate");
+    return 2;
+  }
+  printf("%-9s %-10s %10s %11s %13s %11s\n", "kernel", "mode", "insns", "ns_per_insn", "insns_per_sec", "peak_rss_kb");
+  for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    if(!selected(kernels[k].name, argc, argv))
+      continue;
+    Emitter e = {0};
+    kernels[k].build(&e);
+    uint64_t insns = countInsns(&kernels[k], &e);
+    if(insns == 0)
+      return 1;
+    for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+      fflush(stdout);
+      pid_t child = fork();
+      if(child < 0) {
+        perror("fork");
+        return 2;
+      }
+      if(child == 0) {
+        int status = measure(&kernels[k], &e, m, insns);
+        fflush(stdout);
+        _exit(status);
+      }
+      int status;
+      if(waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+        return 1;
+    }
+    free(e.bytes);
+  }
+  return 0;
+}
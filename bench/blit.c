@@ -0,0 +1,221 @@
+/*
+Sprite throughput: how many BITM and SPRT blits a second the VM draws, at
+byte-aligned and arbitrary x offsets, mirrored, and at a few sizes, against
+drawing the same image a POINT at a time; and how many glyphs a second PRINT
+draws, counting each glyph as a blit.
+
+  blit [kernel...]
+
+Output is one line per kernel, in whitespace-separated columns:
+
+  kernel  blits  ns_per_blit  blits_per_sec
+
+Each blit includes the three LETs that push its operands, as a program would,
+and in the mirrored kernel the MIRROR before it. The text kernels push each
+line with LETA first. Times are the best of REPEAT
+runs, each of which starts from an empty sprite cache and so decodes every
+variant it draws once.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "emit.h"
+#include "../vm.h"
+
+#define REPEAT 5
+#define ROUNDS 5000 // of each kernel's unrolled blits
+
+typedef struct {
+  const char* name;
+  // emits the kernel's images, then ROUNDS rounds of its blits; returns the
+  // number of blits a round
+  int (*build)(Emitter* e);
+} Kernel;
+
+// an ellipse filling width by height pixels, emitted behind a branch over it,
+// with a SPRT mask of its disc when masked; returns its address
+static uint32_t ball(Emitter* e, int width, int height, int masked) {
+  uint32_t after = branchForward(e, BR, A);
+  uint32_t addr = e->size;
+  emit8(e, width);
+  emit8(e, height);
+  for(int plane = 0; plane <= masked; plane++) {
+    for(int y = 0; y < height; y++) {
+      for(int b = 0; b < (width + 7) / 8; b++) {
+        uint8_t byte = 0;
+        for(int x = b * 8; x < b * 8 + 8 && x < width; x++) {
+          int dx = 2 * x + 1 - width, dy = (2 * y + 1 - height) * width / height;
+          int inside = dx * dx + dy * dy <= width * width;
+          // the image is striped so that it is not its own mask
+          if(inside && (plane || (x + y) % 3))
+            byte |= 1 << (x % 8);
+        }
+        emit8(e, byte);
+      }
+    }
+  }
+  patch(e, after);
+  return addr;
+}
+
+static void blit(Emitter* e, InstructionSet code, uint32_t image, int16_t x, int16_t y) {
+  let16(e, A, x);
+  let16(e, A, y);
+  let32(e, A, image);
+  op(e, code, A);
+}
+
+// ROUNDS rounds of count blits of image with code, at x offsets stepping by
+// step so that they cover every alignment when step is odd
+static int blits(Emitter* e, InstructionSet code, uint32_t image, int count, int step, int mirror) {
+  let32(e, D, ROUNDS);
+  uint32_t top = e->size;
+  for(int i = 0; i < count; i++) {
+    if(mirror) {
+      let8(e, A, i % 4);
+      op(e, MIRROR, A);
+    }
+    blit(e, code, image, i * step % 112, i * 7 % 48);
+  }
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, top);
+  op(e, END, A);
+  return count;
+}
+
+static int bitm8(Emitter* e) { return blits(e, BITM, ball(e, 8, 8, 0), 16, 8, 0); }
+static int bitm8Shifted(Emitter* e) { return blits(e, BITM, ball(e, 8, 8, 0), 16, 9, 0); }
+static int sprt16(Emitter* e) { return blits(e, SPRT, ball(e, 16, 16, 1), 16, 9, 0); }
+static int mirrored(Emitter* e) { return blits(e, SPRT, ball(e, 16, 16, 1), 16, 9, 1); }
+static int sprt64(Emitter* e) { return blits(e, SPRT, ball(e, 64, 32, 1), 16, 9, 0); }
+
+// the 16x16 BITM image drawn pixel by pixel instead, for comparison
+static int points(Emitter* e) {
+  let32(e, D, ROUNDS);
+  uint32_t top = e->size;
+  for(int y = 0; y < 16; y++) {
+    for(int x = 0; x < 16; x++) {
+      int dx = 2 * x - 15, dy = 2 * y - 15;
+      if(dx * dx + dy * dy > 256 || !((x + y) % 3))
+        continue;
+      let16(e, A, 41 + x);
+      let16(e, A, 20 + y);
+      op(e, POINT, A);
+    }
+  }
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, top);
+  op(e, END, A);
+  return 1;
+}
+
+// lines of text the width of the screen, each pushed and PRINTed
+static int lines(Emitter* e, int font, const char* const* text, int count) {
+  let8(e, A, font);
+  op(e, FONT, A);
+  let32(e, D, ROUNDS);
+  uint32_t top = e->size;
+  int glyphs = 0;
+  for(int i = 0; i < count; i++) {
+    uint16_t n = strlen(text[i]);
+    leta(e, A, A, text[i], n);
+    let16(e, A, i % 2 * 3);
+    let16(e, A, i * 8 % 64);
+    let8(e, A, n);
+    op(e, PRINT, A);
+    glyphs += n;
+  }
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, top);
+  op(e, END, A);
+  return glyphs;
+}
+
+static const char* const dashboard[] = {
+  "CPU  42% MEM 1.2G/4G",
+  "NET rx 120k tx 3.4k",
+  "TEMP 51C  FAN 2200",
+  "UPTIME 12d 03:41:07",
+};
+
+static const char* const rules[] = {
+  "====================",
+  "--------------------",
+  "                  ok",
+};
+
+static const char* const large[] = { "12:41", "OK" };
+
+static int text(Emitter* e) { return lines(e, FONT_SMALL, dashboard, 4); }
+static int runs(Emitter* e) { return lines(e, FONT_SMALL, rules, 3); }
+static int largeText(Emitter* e) { return lines(e, FONT_LARGE, large, 2); }
+
+static const Kernel kernels[] = {
+  { "bitm8", bitm8 },
+  { "bitm8-shift", bitm8Shifted },
+  { "sprt16", sprt16 },
+  { "mirrored", mirrored },
+  { "sprt64x32", sprt64 },
+  { "points16", points },
+  { "print", text },
+  { "print-runs", runs },
+  { "print-large", largeText },
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int selected(const char* name, int argc, char* argv[]) {
+  if(argc < 2)
+    return 1;
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], name))
+      return 1;
+  }
+  return 0;
+}
+
+static VM vm;
+
+int main(int argc, char* argv[]) {
+  if(vmCreate(&vm, NULL)) {
+    perror("vmCreate");
+    return 2;
+  }
+  printf("kernel         blits ns_per_blit blits_per_sec\n");
+  for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if(!selected(kernels[i].name, argc, argv))
+      continue;
+    Emitter e = {0};
+    uint64_t count = (uint64_t)kernels[i].build(&e) * ROUNDS;
+    Program program;
+    if(programLoad(&program, e.bytes, e.size)) {
+      fputs("Memory error\n", stderr);
+      return 2;
+    }
+    double best = 0;
+    for(int r = 0; r < REPEAT; r++) {
+      vmInit(&vm, &program);
+      double start = now();
+      vmRun(&vm);
+      double t = now() - start;
+      if(vm.last_error != NONE) {
+        fprintf(stderr, "%s: runtime error %d at %x\n", kernels[i].name, vm.last_error, vm.pc);
+        return 1;
+      }
+      if(r == 0 || t < best)
+        best = t;
+    }
+    printf("%-11s %8llu %11.1f %13.0f\n", kernels[i].name, (unsigned long long)count, best * 1e9 / count, count / best);
+    programFree(&program);
+    free(e.bytes);
+  }
+  vmDestroy(&vm);
+  return 0;
+}
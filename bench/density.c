@@ -0,0 +1,104 @@
+/*
+VM density: how many concurrent instances fit in a fixed amount of RAM, for a
+range of stack sizes. Each configuration creates INSTANCES VMs, all alive at
+once, and runs a small program on each that leaves DEPTH bytes on stack A,
+the way a server would keep many mostly idle programs parked between
+requests. Memory is the growth in resident set size over the run, so it
+counts what the stacks and VMs actually touch rather than what they reserve.
+
+  density
+
+Output is one line per stack size, in whitespace-separated columns:
+
+  stack_bytes  instances  bytes_per_instance  instances_per_gib
+
+Each configuration runs in a child process of its own.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "emit.h"
+#include "../vm.h"
+
+#define INSTANCES 20000
+#define DEPTH 32 // bytes each instance leaves on its stack
+
+static const uint32_t stackBytes[] = { 64, 256, 1024, 4096, 65536, 1u << 20 };
+
+// resident set size in bytes
+static long rss(void) {
+  long pages = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if(f == NULL || fscanf(f, "%*d %ld", &pages) != 1)
+    pages = -1;
+  if(f)
+    fclose(f);
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+static int measure(const Program* program, uint32_t size) {
+  uint32_t sizes[NUM_STACKS] = { size, size, size, size };
+  long before = rss();
+  VM* vms = calloc(INSTANCES, sizeof(VM));
+  if(vms == NULL) {
+    fputs("Memory error\n", stderr);
+    return 2;
+  }
+  for(int i = 0; i < INSTANCES; i++) {
+    if(vmCreate(&vms[i], sizes)) {
+      perror("vmCreate");
+      return 2;
+    }
+    vmInit(&vms[i], program);
+    vmRun(&vms[i]);
+    if(vms[i].last_error != NONE) {
+      fprintf(stderr, "runtime error %d at %x\n", vms[i].last_error, vms[i].pc);
+      return 1;
+    }
+  }
+  long used = rss() - before;
+  if(before < 0 || used <= 0) {
+    fputs("Can't read /proc/self/statm\n", stderr);
+    return 1;
+  }
+  double perInstance = (double)used / INSTANCES;
+  printf("%11u %10d %18.0f %17.0f\n", size, INSTANCES, perInstance, (1u << 30) / perInstance);
+  return 0;
+}
+
+int main(void) {
+  Emitter e = {0};
+  for(int i = 0; i < DEPTH / 4; i++)
+    let32(&e, A, i);
+  op(&e, END, A);
+  Program program;
+  if(programLoad(&program, e.bytes, e.size)) {
+    fputs("Memory error\n", stderr);
+    return 2;
+  }
+  programVerify(&program);
+
+  printf("%11s %10s %18s %17s\n", "stack_bytes", "instances", "bytes_per_instance", "instances_per_gib");
+  for(size_t c = 0; c < sizeof(stackBytes) / sizeof(stackBytes[0]); c++) {
+    fflush(stdout);
+    pid_t child = fork();
+    if(child < 0) {
+      perror("fork");
+      return 2;
+    }
+    if(child == 0) {
+      int status = measure(&program, stackBytes[c]);
+      fflush(stdout);
+      _exit(status);
+    }
+    int status;
+    if(waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+      return 1;
+  }
+  programFree(&program);
+  free(e.bytes);
+  return 0;
+}
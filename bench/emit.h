@@ -0,0 +1,103 @@
+/*
+Tiny CLAW bytecode emitter, so the benchmarks can build their programs in
+memory instead of shipping binaries.
+*/
+
+#ifndef EMIT_H
+#define EMIT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../bytecode.h"
+
+enum { A = 0, B, C, D };
+
+typedef struct {
+  uint8_t* bytes;
+  uint32_t size;
+  uint32_t capacity;
+  uint32_t count; // instructions emitted so far
+} Emitter;
+
+static inline void emitBytes(Emitter* e, const void* p, uint32_t n) {
+  if(e->size + n > e->capacity) {
+    e->capacity = (e->size + n) * 2;
+    e->bytes = realloc(e->bytes, e->capacity);
+    if(e->bytes == NULL)
+      abort();
+  }
+  memcpy(&e->bytes[e->size], p, n);
+  e->size += n;
+}
+
+static inline void emit8(Emitter* e, uint8_t v) {
+  emitBytes(e, &v, 1);
+}
+
+static inline void emit16(Emitter* e, uint16_t v) {
+  uint8_t b[2] = { v, v >> 8 };
+  emitBytes(e, b, 2);
+}
+
+static inline void emit32(Emitter* e, uint32_t v) {
+  uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+  emitBytes(e, b, 4);
+}
+
+static inline void op2(Emitter* e, InstructionSet op, unsigned int source, unsigned int destination) {
+  emit16(e, op << 4 | source << 2 | destination);
+  e->count++;
+}
+
+static inline void op(Emitter* e, InstructionSet code, unsigned int stack) {
+  op2(e, code, stack, stack);
+}
+
+static inline void let8(Emitter* e, unsigned int stack, uint8_t v) {
+  op(e, LET8, stack);
+  emit8(e, v);
+}
+
+static inline void let16(Emitter* e, unsigned int stack, uint16_t v) {
+  op(e, LET16, stack);
+  emit16(e, v);
+}
+
+static inline void let32(Emitter* e, unsigned int stack, uint32_t v) {
+  op(e, LET32, stack);
+  emit32(e, v);
+}
+
+// conditional or unconditional branch back to a byte pc emitted earlier
+static inline void branch(Emitter* e, InstructionSet code, unsigned int stack, uint32_t to) {
+  op(e, code, stack);
+  emit16(e, (uint16_t)(int16_t)(to - (e->size + 2)));
+}
+
+// forward branch; patch() it once the target is known
+static inline uint32_t branchForward(Emitter* e, InstructionSet code, unsigned int stack) {
+  op(e, code, stack);
+  emit16(e, 0);
+  return e->size;
+}
+
+static inline void patch(Emitter* e, uint32_t after) {
+  uint16_t offset = (uint16_t)(int16_t)(e->size - after);
+  e->bytes[after - 2] = offset;
+  e->bytes[after - 1] = offset >> 8;
+}
+
+// LET16 source n; LETA source destination, followed by the n payload bytes
+static inline void leta(Emitter* e, unsigned int source, unsigned int destination, const void* payload, uint16_t n) {
+  let16(e, source, n);
+  op2(e, LETA, source, destination);
+  emitBytes(e, payload, n);
+}
+
+static inline void dmpsstr(Emitter* e, const char* s) {
+  op(e, DMPSSTR, A);
+  emitBytes(e, s, strlen(s) + 1);
+}
+
+#endif
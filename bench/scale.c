@@ -0,0 +1,126 @@
+/*
+Pool scaling: how many programs a second runJobs() gets through on 1, 2, 4
+and so on up to every online CPU, and how long each program takes, with and
+without slices. The programs are counted loops, most short and one in LONG_EVERY
+many times longer, so that workers that draw the long ones run dry of their
+own work and have to steal.
+
+  scale [threads...]
+
+Output is one line per thread count and slice, in whitespace-separated
+columns:
+
+  threads  slice  programs  seconds  programs_per_sec  p50_us  p99_us  max_us
+
+Latencies run from when a worker starts a program to when it ends, so they
+include the time it spends waiting for turns behind the worker's other
+programs, but not the time before a worker gets to it. Times are those of the
+fastest of REPEAT runs.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "emit.h"
+#include "../runner.h"
+
+#define REPEAT 3
+#define PROGRAMS 4000
+#define LONG_EVERY 20
+#define SHORT_LOOPS 2000 // iterations of a short program's loop
+#define LONG_LOOPS 200000
+#define SLICE 1000
+
+static const uint64_t slices[] = { 0, SLICE };
+
+static void loop(Emitter* e, uint32_t count) {
+  let32(e, D, count);
+  uint32_t top = e->size;
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, top);
+  op(e, END, A);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int byValue(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static Job jobs[PROGRAMS];
+static uint64_t latencies[PROGRAMS];
+
+// runs every program on threads workers REPEAT times, and prints the fastest
+static int measure(const Program* shortLoop, const Program* longLoop, unsigned int threads, uint64_t slice) {
+  double best = 0;
+  for(int r = 0; r < REPEAT; r++) {
+    for(size_t i = 0; i < PROGRAMS; i++)
+      jobs[i] = (Job){ .program = i % LONG_EVERY ? shortLoop : longLoop, .mode = MODE_PLAIN };
+    double start = now();
+    if(runJobs(jobs, PROGRAMS, threads, NULL, 0, slice)) {
+      fputs("Memory error\n", stderr);
+      return -1;
+    }
+    double t = now() - start;
+    for(size_t i = 0; i < PROGRAMS; i++) {
+      if(jobs[i].error != NONE) {
+        fprintf(stderr, "runtime error %d at %x\n", jobs[i].error, jobs[i].pc);
+        return -1;
+      }
+    }
+    if(r == 0 || t < best) {
+      best = t;
+      for(size_t i = 0; i < PROGRAMS; i++)
+        latencies[i] = jobs[i].ended - jobs[i].started;
+    }
+  }
+  qsort(latencies, PROGRAMS, sizeof(latencies[0]), byValue);
+  printf("%7u %6llu %9d %8.3f %16.0f %7.0f %7.0f %7.0f\n", threads, (unsigned long long)slice, PROGRAMS, best,
+         PROGRAMS / best, latencies[PROGRAMS / 2] / 1e3, latencies[PROGRAMS * 99 / 100] / 1e3,
+         latencies[PROGRAMS - 1] / 1e3);
+  return 0;
+}
+
+static int load(Program* program, uint32_t count) {
+  Emitter e = {0};
+  loop(&e, count);
+  int failed = programLoad(program, e.bytes, e.size);
+  free(e.bytes);
+  return failed;
+}
+
+int main(int argc, char* argv[]) {
+  Program shortLoop, longLoop;
+  if(load(&shortLoop, SHORT_LOOPS) || load(&longLoop, LONG_LOOPS)) {
+    fputs("Memory error\n", stderr);
+    return 2;
+  }
+  unsigned int counts[64];
+  int n = 0;
+  if(argc > 1) {
+    for(int i = 1; i < argc && n < 64; i++)
+      counts[n++] = strtoul(argv[i], NULL, 10);
+  } else {
+    unsigned int cpus = onlineCpus();
+    for(unsigned int t = 1; t < cpus && n < 63; t *= 2)
+      counts[n++] = t;
+    counts[n++] = cpus;
+  }
+  printf("threads  slice  programs  seconds  programs_per_sec  p50_us  p99_us  max_us\n");
+  for(int i = 0; i < n; i++) {
+    for(size_t s = 0; s < sizeof(slices) / sizeof(slices[0]); s++) {
+      if(measure(&shortLoop, &longLoop, counts[i], slices[s]))
+        return 1;
+    }
+  }
+  programFree(&shortLoop);
+  programFree(&longLoop);
+  return 0;
+}
@@ -0,0 +1,268 @@
+/*
+Frame output for UI-style programs: how many bytes each --frame-format spends
+per frame, and how long a frame takes to draw and write out, in the formats
+that send whole frames and in those that send only what changed.
+
+  ui [kernel...]
+
+Output is one line per kernel and format, in whitespace-separated columns:
+
+  kernel  format  frames  bytes_per_frame  ns_per_frame  frames_per_sec
+
+The "none" format only counts the frames, for the drawing alone. Frames
+are written to a memory stream that is rewound after every frame, so the
+times are the VM's and the encoders', not the disk's. Times are the best of
+REPEAT runs.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "emit.h"
+#include "../vm.h"
+
+#define REPEAT 5
+#define ROUNDS 2000 // of each kernel's unrolled frames
+
+typedef struct {
+  const char* name;
+  void (*build)(Emitter* e);
+} Kernel;
+
+// LET16 each of n operands onto A, then the graphics opcode
+static void shape(Emitter* e, InstructionSet code, const int16_t* operands, int n) {
+  for(int i = 0; i < n; i++)
+    let16(e, A, operands[i]);
+  op(e, code, A);
+}
+
+static void setting(Emitter* e, InstructionSet code, uint8_t value) {
+  let8(e, A, value);
+  op(e, code, A);
+}
+
+// setup(), if any, then ROUNDS rounds of the frames body() draws, counted
+// down on D
+static void loop(Emitter* e, void (*setup)(Emitter* e), void (*body)(Emitter* e)) {
+  if(setup)
+    setup(e);
+  let32(e, D, ROUNDS);
+  uint32_t top = e->size;
+  body(e);
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, top);
+  op(e, END, A);
+}
+
+#define ITEMS 6 // menu entries
+
+static void item(Emitter* e, InstructionSet code, int i) {
+  const int16_t box[] = { 8, 2 + 10 * i, 80, 9 };
+  shape(e, code, box, 4);
+}
+
+// a menu drawn once, then a highlight moved down it one entry per frame by
+// XORing it off the old entry and onto the new one
+static void menuSetup(Emitter* e) {
+  for(int i = 0; i < ITEMS; i++)
+    item(e, LRECT, i);
+  setting(e, GMODE, GMODE_XOR);
+  item(e, RECT, ITEMS - 1);
+  op(e, SWBUFF, A);
+}
+
+static void menuMoves(Emitter* e) {
+  for(int i = 0; i < ITEMS; i++) {
+    item(e, RECT, (i + ITEMS - 1) % ITEMS);
+    item(e, RECT, i);
+    op(e, SWBUFF, A);
+  }
+}
+
+static void menu(Emitter* e) { loop(e, menuSetup, menuMoves); }
+
+// the same menu, cleared and redrawn from scratch every frame
+static void menuRedraws(Emitter* e) {
+  for(int i = 0; i < ITEMS; i++) {
+    op(e, CLR, A);
+    for(int j = 0; j < ITEMS; j++)
+      item(e, LRECT, j);
+    item(e, RECT, i);
+    op(e, SWBUFF, A);
+  }
+}
+
+static void redraw(Emitter* e) { loop(e, NULL, menuRedraws); }
+
+// a progress bar filling up a pixel a frame, the whole bar redrawn each time
+static void progressFills(Emitter* e) {
+  static const int16_t frame[] = { 2, 26, 124, 12 };
+  op(e, CLR, A);
+  shape(e, LRECT, frame, 4);
+  for(int16_t width = 1; width <= 120; width++) {
+    const int16_t bar[] = { 4, 28, width, 8 };
+    shape(e, RECT, bar, 4);
+    op(e, SWBUFF, A);
+  }
+}
+
+static void progress(Emitter* e) { loop(e, NULL, progressFills); }
+
+// the worst case: every pixel changes every frame
+static void xorMode(Emitter* e) {
+  setting(e, GMODE, GMODE_XOR);
+}
+
+static void inverts(Emitter* e) {
+  op(e, FILL, A);
+  op(e, SWBUFF, A);
+}
+
+static void invert(Emitter* e) { loop(e, xorMode, inverts); }
+
+// a screen of text, cleared and printed again every frame with one figure on
+// it changed, the way a status page is redrawn
+static void say(Emitter* e, const char* text, int16_t x, int16_t y) {
+  uint16_t n = strlen(text);
+  leta(e, A, A, text, n);
+  let16(e, A, x);
+  let16(e, A, y);
+  let8(e, A, n);
+  op(e, PRINT, A);
+}
+
+static void statusPages(Emitter* e) {
+  static const char* const load[] = { "LOAD 0.41", "LOAD 0.57", "LOAD 0.38", "LOAD 1.02" };
+  for(int i = 0; i < 4; i++) {
+    op(e, CLR, A);
+    say(e, "---------------------", 1, 0);
+    say(e, load[i], 2, 8);
+    for(int j = 2; j < 8; j++)
+      say(e, "STATUS   OK  12:41:07", 2, 8 * j);
+    op(e, SWBUFF, A);
+  }
+}
+
+static void status(Emitter* e) { loop(e, NULL, statusPages); }
+
+static const Kernel kernels[] = {
+  { "menu", menu },
+  { "redraw", redraw },
+  { "progress", progress },
+  { "invert", invert },
+  { "text", status },
+};
+
+enum { NONE_FORMAT = -1, PPM, RAW, RECTS, XOR };
+static const struct {
+  const char* name;
+  int format;
+} formats[] = {
+  { "none", NONE_FORMAT },
+  { "ppm", PPM },
+  { "raw", RAW },
+  { "rects", RECTS },
+  { "xor", XOR },
+};
+
+typedef struct {
+  FILE* f;
+  int format;
+  uint64_t frames, bytes;
+  uint8_t last[SCREEN_BYTES];
+} Sink;
+
+static void frame(void* arg, const Screen* screen) {
+  Sink* sink = arg;
+  int full = sink->frames++ == 0;
+  switch(sink->format) {
+    case PPM: screenWritePpm(screen->front, sink->f); break;
+    case RAW: screenWriteRaw(screen->front, sink->f); break;
+    case RECTS: screenWriteRects(screen, full, sink->f); break;
+    case XOR: screenWriteXor(screen, sink->last, full, sink->f); break;
+  }
+  if(sink->format != NONE_FORMAT) {
+    sink->bytes += ftell(sink->f);
+    rewind(sink->f);
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static VM vm;
+
+static int measure(const Kernel* k, const Program* program, size_t f) {
+  char* buffer = NULL;
+  size_t size = 0;
+  Sink sink = { open_memstream(&buffer, &size), formats[f].format };
+  if(sink.f == NULL) {
+    perror("open_memstream");
+    return 2;
+  }
+  double best = 0;
+  for(int r = 0; r < REPEAT; r++) {
+    vmInit(&vm, program);
+    vm.frame = frame;
+    vm.frameArg = &sink;
+    sink.frames = sink.bytes = 0;
+    memset(sink.last, 0, sizeof(sink.last));
+    double start = now();
+    vmRun(&vm);
+    double t = now() - start;
+    if(vm.last_error != NONE) {
+      fprintf(stderr, "%s: runtime error %d at %x\n", k->name, vm.last_error, vm.pc);
+      return 1;
+    }
+    if(r == 0 || t < best)
+      best = t;
+  }
+  fclose(sink.f);
+  free(buffer);
+  printf("%-9s %-6s %8llu %15.1f %12.1f %14.0f\n", k->name, formats[f].name, (unsigned long long)sink.frames,
+         (double)sink.bytes / sink.frames, best * 1e9 / sink.frames, sink.frames / best);
+  return 0;
+}
+
+static int selected(const char* name, int argc, char* argv[]) {
+  if(argc < 2)
+    return 1;
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], name))
+      return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  if(vmCreate(&vm, NULL)) {
+    perror("vmCreate");
+    return 2;
+  }
+  printf("kernel    format   frames bytes_per_frame ns_per_frame frames_per_sec\n");
+  for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if(!selected(kernels[i].name, argc, argv))
+      continue;
+    Emitter e = {0};
+    kernels[i].build(&e);
+    Program program;
+    if(programLoad(&program, e.bytes, e.size)) {
+      fputs("Memory error\n", stderr);
+      return 2;
+    }
+    for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+      int status = measure(&kernels[i], &program, f);
+      if(status)
+        return status;
+    }
+    programFree(&program);
+    free(e.bytes);
+  }
+  vmDestroy(&vm);
+  return 0;
+}
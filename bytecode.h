@@ -97,6 +97,21 @@ typedef enum {
   DEC8 = 0x6b,
   DEC16 = 0x6c,
   DEC32 = 0x6d,
+  ADDA8 = 0x70,
+  ADDA16 = 0x71,
+  ADDA32 = 0x72,
+  SUBA8 = 0x73,
+  SUBA16 = 0x74,
+  SUBA32 = 0x75,
+  ANDA8 = 0x76,
+  ANDA16 = 0x77,
+  ANDA32 = 0x78,
+  ORA8 = 0x79,
+  ORA16 = 0x7a,
+  ORA32 = 0x7b,
+  XORA8 = 0x7c,
+  XORA16 = 0x7d,
+  XORA32 = 0x7e,
   C8T16 = 0xf0,
   C8T32 = 0xf1,
   C16T8 = 0xf2,
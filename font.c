@@ -0,0 +1,256 @@
+/*
+FONT and PRINT. The font is kept the way such fonts are usually written down,
+a column of 7 bits for each of a glyph's 5 columns; the first time a program
+picks a font, every glyph of it is rasterized once into a packed atlas of rows
+in the screen's bit order. PRINT then lays a whole line of text out in a row
+buffer, a few byte ORs per glyph row straight from the atlas, and masks each
+of the line's rows into the screen at once. Spaces only move the pen, and a
+run of the same glyph is laid out once per whole byte it repeats in and then
+copied along, so a row of dashes or a bar of blocks is mostly byte copies.
+*/
+
+#include <pthread.h>
+#include <string.h>
+#include "font.h"
+
+#define FIRST ' '
+#define GLYPHS ('~' - FIRST + 1)
+#define COLUMNS 5 // of a 5x7 glyph, and then a blank one before the next
+#define MAX_HEIGHT 16
+#define MARGIN 4 // bytes either side of the screen's in a line buffer
+#define LINE_BYTES (SCREEN_STRIDE + 2 * MARGIN)
+
+static const uint8_t glyphs[GLYPHS * COLUMNS] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, // space
+  0x00, 0x00, 0x5F, 0x00, 0x00, // !
+  0x00, 0x07, 0x00, 0x07, 0x00, // "
+  0x14, 0x7F, 0x14, 0x7F, 0x14, // #
+  0x24, 0x2A, 0x7F, 0x2A, 0x12, // $
+  0x23, 0x13, 0x08, 0x64, 0x62, // %
+  0x36, 0x49, 0x55, 0x22, 0x50, // &
+  0x00, 0x05, 0x03, 0x00, 0x00, // '
+  0x00, 0x1C, 0x22, 0x41, 0x00, // (
+  0x00, 0x41, 0x22, 0x1C, 0x00, // )
+  0x14, 0x08, 0x3E, 0x08, 0x14, // *
+  0x08, 0x08, 0x3E, 0x08, 0x08, // +
+  0x00, 0x50, 0x30, 0x00, 0x00, // ,
+  0x08, 0x08, 0x08, 0x08, 0x08, // -
+  0x00, 0x60, 0x60, 0x00, 0x00, // .
+  0x20, 0x10, 0x08, 0x04, 0x02, // /
+  0x3E, 0x51, 0x49, 0x45, 0x3E, // 0
+  0x00, 0x42, 0x7F, 0x40, 0x00, // 1
+  0x42, 0x61, 0x51, 0x49, 0x46, // 2
+  0x21, 0x41, 0x45, 0x4B, 0x31, // 3
+  0x18, 0x14, 0x12, 0x7F, 0x10, // 4
+  0x27, 0x45, 0x45, 0x45, 0x39, // 5
+  0x3C, 0x4A, 0x49, 0x49, 0x30, // 6
+  0x01, 0x71, 0x09, 0x05, 0x03, // 7
+  0x36, 0x49, 0x49, 0x49, 0x36, // 8
+  0x06, 0x49, 0x49, 0x29, 0x1E, // 9
+  0x00, 0x36, 0x36, 0x00, 0x00, // :
+  0x00, 0x56, 0x36, 0x00, 0x00, // ;
+  0x08, 0x14, 0x22, 0x41, 0x00, // <
+  0x14, 0x14, 0x14, 0x14, 0x14, // =
+  0x00, 0x41, 0x22, 0x14, 0x08, // >
+  0x02, 0x01, 0x51, 0x09, 0x06, // ?
+  0x32, 0x49, 0x79, 0x41, 0x3E, // @
+  0x7E, 0x11, 0x11, 0x11, 0x7E, // A
+  0x7F, 0x49, 0x49, 0x49, 0x36, // B
+  0x3E, 0x41, 0x41, 0x41, 0x22, // C
+  0x7F, 0x41, 0x41, 0x22, 0x1C, // D
+  0x7F, 0x49, 0x49, 0x49, 0x41, // E
+  0x7F, 0x09, 0x09, 0x09, 0x01, // F
+  0x3E, 0x41, 0x49, 0x49, 0x7A, // G
+  0x7F, 0x08, 0x08, 0x08, 0x7F, // H
+  0x00, 0x41, 0x7F, 0x41, 0x00, // I
+  0x20, 0x40, 0x41, 0x3F, 0x01, // J
+  0x7F, 0x08, 0x14, 0x22, 0x41, // K
+  0x7F, 0x40, 0x40, 0x40, 0x40, // L
+  0x7F, 0x02, 0x0C, 0x02, 0x7F, // M
+  0x7F, 0x04, 0x08, 0x10, 0x7F, // N
+  0x3E, 0x41, 0x41, 0x41, 0x3E, // O
+  0x7F, 0x09, 0x09, 0x09, 0x06, // P
+  0x3E, 0x41, 0x51, 0x21, 0x5E, // Q
+  0x7F, 0x09, 0x19, 0x29, 0x46, // R
+  0x46, 0x49, 0x49, 0x49, 0x31, // S
+  0x01, 0x01, 0x7F, 0x01, 0x01, // T
+  0x3F, 0x40, 0x40, 0x40, 0x3F, // U
+  0x1F, 0x20, 0x40, 0x20, 0x1F, // V
+  0x3F, 0x40, 0x38, 0x40, 0x3F, // W
+  0x63, 0x14, 0x08, 0x14, 0x63, // X
+  0x07, 0x08, 0x70, 0x08, 0x07, // Y
+  0x61, 0x51, 0x49, 0x45, 0x43, // Z
+  0x00, 0x7F, 0x41, 0x41, 0x00, // [
+  0x02, 0x04, 0x08, 0x10, 0x20, // backslash
+  0x00, 0x41, 0x41, 0x7F, 0x00, // ]
+  0x04, 0x02, 0x01, 0x02, 0x04, // ^
+  0x40, 0x40, 0x40, 0x40, 0x40, // _
+  0x00, 0x01, 0x02, 0x04, 0x00, // `
+  0x20, 0x54, 0x54, 0x54, 0x78, // a
+  0x7F, 0x48, 0x44, 0x44, 0x38, // b
+  0x38, 0x44, 0x44, 0x44, 0x20, // c
+  0x38, 0x44, 0x44, 0x48, 0x7F, // d
+  0x38, 0x54, 0x54, 0x54, 0x18, // e
+  0x08, 0x7E, 0x09, 0x01, 0x02, // f
+  0x0C, 0x52, 0x52, 0x52, 0x3E, // g
+  0x7F, 0x08, 0x04, 0x04, 0x78, // h
+  0x00, 0x44, 0x7D, 0x40, 0x00, // i
+  0x20, 0x40, 0x44, 0x3D, 0x00, // j
+  0x7F, 0x10, 0x28, 0x44, 0x00, // k
+  0x00, 0x41, 0x7F, 0x40, 0x00, // l
+  0x7C, 0x04, 0x18, 0x04, 0x78, // m
+  0x7C, 0x08, 0x04, 0x04, 0x78, // n
+  0x38, 0x44, 0x44, 0x44, 0x38, // o
+  0x7C, 0x14, 0x14, 0x14, 0x08, // p
+  0x08, 0x14, 0x14, 0x18, 0x7C, // q
+  0x7C, 0x08, 0x04, 0x04, 0x08, // r
+  0x48, 0x54, 0x54, 0x54, 0x20, // s
+  0x04, 0x3F, 0x44, 0x40, 0x20, // t
+  0x3C, 0x40, 0x40, 0x20, 0x7C, // u
+  0x1C, 0x20, 0x40, 0x20, 0x1C, // v
+  0x3C, 0x40, 0x30, 0x40, 0x3C, // w
+  0x44, 0x28, 0x10, 0x28, 0x44, // x
+  0x0C, 0x50, 0x50, 0x50, 0x3C, // y
+  0x44, 0x64, 0x54, 0x4C, 0x44, // z
+  0x00, 0x08, 0x36, 0x41, 0x00, // {
+  0x00, 0x00, 0x7F, 0x00, 0x00, // |
+  0x00, 0x41, 0x36, 0x08, 0x00, // }
+  0x08, 0x04, 0x08, 0x10, 0x08, // ~
+};
+
+typedef struct {
+  int scale; // pixels per font pixel
+  int advance; // cell width
+  int height; // cell height
+  int period; // glyphs after which a run lines up with whole bytes again...
+  int bytes; // ...and how many bytes that takes
+  pthread_once_t once;
+  // the atlas: height rows of each glyph, pixel x in bit x, filled in by once
+  uint16_t rows[GLYPHS * MAX_HEIGHT];
+} Font;
+
+static Font fonts[FONT_COUNT] = {
+  [FONT_SMALL] = { 1, 6, 8, 4, 3, PTHREAD_ONCE_INIT },
+  [FONT_LARGE] = { 2, 12, 16, 2, 3, PTHREAD_ONCE_INIT },
+};
+
+static void rasterize(Font* font) {
+  for(int g = 0; g < GLYPHS; g++) {
+    uint16_t* rows = &font->rows[g * font->height];
+    for(int y = 0; y < font->height; y++) {
+      uint16_t row = 0;
+      for(int x = 0; x < COLUMNS * font->scale; x++)
+        row |= (glyphs[g * COLUMNS + x / font->scale] >> (y / font->scale) & 1) << x;
+      rows[y] = row;
+    }
+  }
+}
+
+static void rasterizeSmall(void) { rasterize(&fonts[FONT_SMALL]); }
+static void rasterizeLarge(void) { rasterize(&fonts[FONT_LARGE]); }
+
+// ORs glyph g's rows into line with its left edge at bit at
+static void lay(const Font* font, uint8_t (*line)[LINE_BYTES], int g, int at) {
+  const uint16_t* rows = &font->rows[g * font->height];
+  int b = at >> 3, shift = at & 7;
+  for(int y = 0; y < font->height; y++) {
+    uint32_t w = (uint32_t)rows[y] << shift;
+    line[y][b] |= w;
+    line[y][b + 1] |= w >> 8;
+    line[y][b + 2] |= w >> 16;
+  }
+}
+
+// Lays out count of glyph g from bit at on. Cells never overlap, so past its
+// first few glyphs a run's bytes repeat every font->bytes bytes: those are
+// copied, and only the glyphs at either end are laid out one by one.
+static void layRun(const Font* font, uint8_t (*line)[LINE_BYTES], int g, int at, int count) {
+  int first = font->period + 2; // enough to fill whole bytes for a period
+  if(count < first + 4) {
+    for(int k = 0; k < count; k++)
+      lay(font, line, g, at + k * font->advance);
+    return;
+  }
+  for(int k = 0; k < first; k++)
+    lay(font, line, g, at + k * font->advance);
+  int from = (at + 7) / 8 + font->bytes, end = (at + count * font->advance) / 8;
+  for(int y = 0; y < font->height; y++) {
+    for(int b = from; b < end; b++)
+      line[y][b] = line[y][b - font->bytes];
+  }
+  // the byte the run ends in may hold parts of its last two glyphs
+  lay(font, line, g, at + (count - 2) * font->advance);
+  lay(font, line, g, at + (count - 1) * font->advance);
+}
+
+static uint64_t le64(const uint8_t* p) {
+  uint64_t v = 0;
+  for(int i = 7; i >= 0; i--)
+    v = v << 8 | p[i];
+  return v;
+}
+
+static uint64_t reverse64(uint64_t v) {
+  v = (v >> 1 & 0x5555555555555555ull) | (v & 0x5555555555555555ull) << 1;
+  v = (v >> 2 & 0x3333333333333333ull) | (v & 0x3333333333333333ull) << 2;
+  v = (v >> 4 & 0x0f0f0f0f0f0f0f0full) | (v & 0x0f0f0f0f0f0f0f0full) << 4;
+  return __builtin_bswap64(v);
+}
+
+// draws text[0..n), one line with no newlines in it, at (x, y)
+static void printLine(Screen* s, const Font* font, const uint8_t* text, uint32_t n, int x, int y) {
+  uint8_t line[MAX_HEIGHT][LINE_BYTES];
+  memset(line, 0, sizeof(line[0]) * font->height);
+  int drawn = 0;
+  for(uint32_t i = 0; i < n && x < SCREEN_WIDTH;) {
+    uint32_t count = 1;
+    while(i + count < n && text[i + count] == text[i])
+      count++;
+    int g = text[i] - FIRST;
+    i += count;
+    if(g <= 0 || g >= GLYPHS) {
+      // spaces, and bytes with no glyph, only move the pen
+      x += count * font->advance;
+      continue;
+    }
+    // only the glyphs that show
+    int skip = x <= -font->advance ? -x / font->advance : 0;
+    int end = (SCREEN_WIDTH - x + font->advance - 1) / font->advance;
+    if(end > (int)count)
+      end = count;
+    if(skip < end) {
+      layRun(font, line, g, MARGIN * 8 + x + skip * font->advance, end - skip);
+      drawn = 1;
+    }
+    x += count * font->advance;
+  }
+  if(!drawn)
+    return;
+  uint64_t rows[MAX_HEIGHT][SCREEN_STRIDE / 8];
+  for(int r = 0; r < font->height; r++) {
+    int to = s->mirror & MIRROR_Y ? font->height - 1 - r : r;
+    uint64_t w0 = le64(&line[r][MARGIN]), w1 = le64(&line[r][MARGIN + 8]);
+    if(s->mirror & MIRROR_X) {
+      rows[to][0] = reverse64(w1);
+      rows[to][1] = reverse64(w0);
+    } else {
+      rows[to][0] = w0;
+      rows[to][1] = w1;
+    }
+  }
+  int top = s->mirror & MIRROR_Y ? SCREEN_HEIGHT - y - font->height : y;
+  screenBlit(s, 0, top, rows[0], rows[0], SCREEN_STRIDE / 8, font->height);
+}
+
+void fontPrint(Screen* s, const uint8_t* text, uint32_t n, int x, int y) {
+  Font* font = &fonts[s->font];
+  pthread_once(&font->once, s->font == FONT_SMALL ? rasterizeSmall : rasterizeLarge);
+  for(uint32_t start = 0; start <= n && y < SCREEN_HEIGHT; y += font->height) {
+    uint32_t end = start;
+    while(end < n && text[end] != '\n')
+      end++;
+    if(y > -font->height)
+      printLine(s, font, &text[start], end - start, x, y);
+    start = end + 1;
+  }
+}
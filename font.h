@@ -0,0 +1,17 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <stdint.h>
+#include "screen.h"
+
+// What FONT picks: the built-in 5x7 font in 6x8 cells, or the same drawn
+// twice the size, in 12x16 cells. Both cover printable ASCII.
+enum { FONT_SMALL, FONT_LARGE, FONT_COUNT };
+
+// PRINT: draws the n bytes of text in s->font with the top left corner of the
+// first cell at (x, y), in s's color, mode and mirror, like a BITM image of the
+// whole line. Each newline starts a new line below at x; other bytes outside
+// printable ASCII are drawn as spaces. Only the glyphs' own pixels are drawn.
+void fontPrint(Screen* s, const uint8_t* text, uint32_t n, int x, int y);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+Program images. The decoder in program.c bounds-checks every read against the
+image size, and run() only touches bytes the decoder has vetted (LETA payloads
+are checked against the size before they are copied), so the image needs no
+padding past its end; a mapping can end exactly where the file does.
+
+A mapped file that is truncated while a program runs from it makes the next
+read of a page past the new end fault with SIGBUS, as it does for any mmap.
+*/
+
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "image.h"
+
+#define MAX_IMAGE UINT32_MAX
+
+// reads a file of unknown size, for whatever can't be mapped
+static int readAll(Image* image, int fd) {
+  size_t capacity = 4096, size = 0;
+  uint8_t* bytes = malloc(capacity);
+  if(bytes == NULL)
+    return -1;
+  for(;;) {
+    if(size == capacity) {
+      uint8_t* b = capacity < MAX_IMAGE ? realloc(bytes, capacity * 2) : NULL;
+      if(b == NULL) {
+        free(bytes);
+        errno = capacity < MAX_IMAGE ? ENOMEM : EFBIG;
+        return -1;
+      }
+      bytes = b;
+      capacity *= 2;
+    }
+    ssize_t n = read(fd, bytes + size, capacity - size);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0) {
+      free(bytes);
+      return -1;
+    }
+    if(n == 0)
+      break;
+    size += n;
+  }
+  if(size > MAX_IMAGE) {
+    free(bytes);
+    errno = EFBIG;
+    return -1;
+  }
+  image->bytes = bytes;
+  image->size = size;
+  image->mapped = 0;
+  return 0;
+}
+
+int imageOpen(Image* image, const char* path) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return -1;
+  struct stat st;
+  int result;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* bytes = MAP_FAILED;
+    if((uint64_t)st.st_size > MAX_IMAGE)
+      errno = EFBIG;
+    else
+      bytes = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(bytes != MAP_FAILED) {
+      image->bytes = bytes;
+      image->size = st.st_size;
+      image->mapped = 1;
+      result = 0;
+    } else {
+      result = errno == EFBIG ? -1 : readAll(image, fd);
+    }
+  } else {
+    result = readAll(image, fd); // empty files too: mmap won't map 0 bytes
+  }
+  int saved = errno;
+  close(fd);
+  errno = saved;
+  return result;
+}
+
+void imageClose(Image* image) {
+  if(image->mapped)
+    munmap((void*)image->bytes, image->size);
+  else
+    free((void*)image->bytes);
+  image->bytes = NULL;
+  image->size = 0;
+}
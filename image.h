@@ -0,0 +1,22 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A program file's bytes. Regular files are mapped read-only rather than
+// copied, so opening a large image costs nothing until its pages are touched,
+// and every process running the same file shares one copy in the page cache.
+// Anything that can't be mapped (a pipe, say) is read into memory instead.
+typedef struct {
+  const uint8_t* bytes;
+  size_t size;
+  int mapped; // else bytes is malloc'd
+} Image;
+
+// Returns 0, or -1 with errno set if path can't be opened or read, or is too
+// large for a Program (which addresses bytes with 32 bits).
+int imageOpen(Image* image, const char* path);
+void imageClose(Image* image);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+Numbers for GETN*. scanf() costs a locale-aware, format-driven parse per
+value; batch jobs feeding millions of numbers through stdin spent most of
+their time there. This reads stdin in large blocks, or maps it when it is a
+regular file, and parses the digits straight out of the buffer.
+*/
+
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "input.h"
+
+int inputOpen(Input* in, int fd) {
+  in->fd = fd;
+  in->buffer = NULL;
+  in->map = NULL;
+  in->mapSize = 0;
+  in->eof = 0;
+  struct stat st;
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 && st.st_size > offset) {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      in->map = map;
+      in->mapSize = st.st_size;
+      in->at = (const uint8_t*)map + offset;
+      in->end = (const uint8_t*)map + st.st_size;
+      in->eof = 1; // a file growing behind the mapping isn't followed
+    }
+  }
+  if(in->map == NULL) {
+    in->buffer = malloc(INPUT_BUFFER_SIZE);
+    if(in->buffer == NULL)
+      return -1;
+    in->at = in->end = in->buffer;
+  }
+  if(pthread_mutex_init(&in->lock, NULL)) {
+    if(in->map)
+      munmap(in->map, in->mapSize);
+    free(in->buffer);
+    return -1;
+  }
+  return 0;
+}
+
+int inputOpenBytes(Input* in, const uint8_t* bytes, size_t size) {
+  in->fd = -1;
+  in->buffer = NULL;
+  in->map = NULL;
+  in->mapSize = 0;
+  in->eof = 1;
+  in->at = bytes;
+  in->end = bytes + size;
+  return pthread_mutex_init(&in->lock, NULL) ? -1 : 0;
+}
+
+void inputClose(Input* in) {
+  if(in->map)
+    munmap(in->map, in->mapSize);
+  free(in->buffer);
+  in->map = NULL;
+  in->buffer = NULL;
+  in->at = in->end = NULL;
+  pthread_mutex_destroy(&in->lock);
+}
+
+// Reads the next block. Returns 0 at the end of input; read errors end it too.
+static int refill(Input* in) {
+  while(!in->eof) {
+    ssize_t n = read(in->fd, in->buffer, INPUT_BUFFER_SIZE);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0) {
+      in->eof = 1;
+      break;
+    }
+    in->at = in->buffer;
+    in->end = in->buffer + n;
+    return 1;
+  }
+  return 0;
+}
+
+// the next byte, without consuming it; -1 at the end of input
+static inline int peek(Input* in) {
+  if(in->at == in->end && !refill(in))
+    return -1;
+  return *in->at;
+}
+
+static inline int isSpace(int c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int parse(Input* in, uint32_t* n) {
+  int c;
+  while(isSpace(c = peek(in)))
+    in->at++;
+  if(c < 0)
+    return INPUT_END;
+  int negative = c == '-';
+  if(c == '+' || c == '-') {
+    in->at++;
+    c = peek(in);
+  }
+  if(c < '0' || c > '9')
+    return INPUT_MALFORMED;
+  uint64_t value = 0;
+  do {
+    value = value * 10 + (c - '0');
+    if(value > UINT32_MAX)
+      return INPUT_MALFORMED;
+    in->at++;
+    c = peek(in);
+  } while(c >= '0' && c <= '9');
+  if(c >= 0 && !isSpace(c))
+    return INPUT_MALFORMED;
+  *n = negative ? -(uint32_t)value : (uint32_t)value;
+  return INPUT_OK;
+}
+
+int inputNumber(Input* in, uint32_t* n) {
+  pthread_mutex_lock(&in->lock);
+  int result = parse(in, n);
+  pthread_mutex_unlock(&in->lock);
+  return result;
+}
+
+static Input stdinInput;
+static int stdinOpened;
+static pthread_once_t stdinOnce = PTHREAD_ONCE_INIT;
+
+static void openStdin(void) {
+  stdinOpened = inputOpen(&stdinInput, STDIN_FILENO) == 0;
+}
+
+Input* inputStdin(void) {
+  pthread_once(&stdinOnce, openStdin);
+  return stdinOpened ? &stdinInput : NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define INPUT_BUFFER_SIZE 65536
+
+// Where GETN* takes its numbers from: a file descriptor, mapped if it is a
+// regular file and read a buffer at a time otherwise. Any number of VMs may
+// share one; each number goes to exactly one of them.
+typedef struct {
+  int fd;
+  const uint8_t* at; // next byte to parse
+  const uint8_t* end; // end of what has been read or mapped
+  uint8_t* buffer; // INPUT_BUFFER_SIZE bytes for read(), NULL if mapped or given
+  void* map;
+  size_t mapSize;
+  int eof; // read() has nothing more
+  pthread_mutex_t lock;
+} Input;
+
+// what inputNumber() found
+enum { INPUT_OK, INPUT_END, INPUT_MALFORMED };
+
+// Reads fd from its current offset on. Returns 0, or -1 if out of memory.
+int inputOpen(Input* in, int fd);
+// Reads just the size bytes at bytes, which must outlive in.
+int inputOpenBytes(Input* in, const uint8_t* bytes, size_t size);
+void inputClose(Input* in);
+
+// Parses the next whitespace-separated unsigned decimal number into *n. Like
+// scanf()'s %u it takes a leading + or - (and negates modulo 2^32), but a
+// number must end at whitespace or the end of input and fit in 32 bits, or it
+// is INPUT_MALFORMED. INPUT_END if only whitespace is left.
+int inputNumber(Input* in, uint32_t* n);
+
+// The process's stdin, opened on first use. NULL if that ran out of memory.
+Input* inputStdin(void);
+
+#endif
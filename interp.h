@@ -0,0 +1,1217 @@
+/*
+Body of the interpreter loop. vm.c includes this once per execution mode,
+with RUN naming the function to define and TOS_CACHE selecting how the
+handlers reach the stacks:
+
+  0  every push and pop goes through the stack helpers, straight to memory
+  1  the top element of one stack is kept in a local (see Tos in vm.c)
+     and only written back when something else needs that memory
+
+CHECKED 0 leaves out every stack bounds check and the error poll after each
+handler, for programs programVerify() has shown can't fault on a stack.
+
+TRACED calls vm->trace before each instruction. JITTED makes RUN return
+RUN_NATIVE as soon as it gets to a record that native code starts at (other
+than the one it started at), for runJit() to carry on natively; otherwise RUN
+returns RUN_ENDED when the program ends or faults, RUN_BREAK at a breakpoint,
+RUN_SLEEP at a SLEEP that parks, or RUN_YIELD once vm->budget runs out.
+
+The budget is only counted where control goes backwards, since that is the
+only way a run can go on for longer than its program is long: each taken
+branch back to a record charges the records from there to the branch, and
+each jump or RET back to a byte pc half the bytes in between, plus one.
+*/
+
+#if !CHECKED
+#define PUSH8(s, v) rawPush(vm, s, 1, (uint8_t)(v))
+#define PUSH16(s, v) rawPush(vm, s, 2, (uint16_t)(v))
+#define PUSH32(s, v) rawPush(vm, s, 4, (uint32_t)(v))
+#define POP8(s) ((uint8_t)rawPop(vm, s, 1))
+#define POP16(s) ((uint16_t)rawPop(vm, s, 2))
+#define POP32(s) rawPop(vm, s, 4)
+#define PEEK8(s) ((uint8_t)rawPeek(vm, s, 1))
+#define PEEK16(s) ((uint16_t)rawPeek(vm, s, 2))
+#define PEEK32(s) rawPeek(vm, s, 4)
+#define POKE8(s, v) stackPoke8bit(vm, s, v)
+#define POKE16(s, v) stackPoke16bit(vm, s, v)
+#define POKE32(s, v) stackPoke32bit(vm, s, v)
+#define SPILL() (void)0
+#define HAS_ROOM(s, n) 1
+#elif TOS_CACHE
+#define PUSH8(s, v) tosPush(vm, &tos, s, 1, (uint8_t)(v))
+#define PUSH16(s, v) tosPush(vm, &tos, s, 2, (uint16_t)(v))
+#define PUSH32(s, v) tosPush(vm, &tos, s, 4, (uint32_t)(v))
+#define POP8(s) ((uint8_t)tosPop(vm, &tos, s, 1))
+#define POP16(s) ((uint16_t)tosPop(vm, &tos, s, 2))
+#define POP32(s) tosPop(vm, &tos, s, 4)
+#define PEEK8(s) ((uint8_t)tosPeek(vm, &tos, s, 1))
+#define PEEK16(s) ((uint16_t)tosPeek(vm, &tos, s, 2))
+#define PEEK32(s) tosPeek(vm, &tos, s, 4)
+#define POKE8(s, v) tosPoke(vm, &tos, s, 1, (uint8_t)(v))
+#define POKE16(s, v) tosPoke(vm, &tos, s, 2, (uint16_t)(v))
+#define POKE32(s, v) tosPoke(vm, &tos, s, 4, (uint32_t)(v))
+#define SPILL() tosSpill(vm, &tos)
+#define HAS_ROOM(s, n) ((tos.stack == (int)(s) ? tos.sp : vm->sp[s]) + (n) < vm->stackSize[s])
+#else
+#define PUSH8(s, v) stackPush8bit(vm, s, v)
+#define PUSH16(s, v) stackPush16bit(vm, s, v)
+#define PUSH32(s, v) stackPush32bit(vm, s, v)
+#define POP8(s) stackPop8bit(vm, s)
+#define POP16(s) stackPop16bit(vm, s)
+#define POP32(s) stackPop32bit(vm, s)
+#define PEEK8(s) stackPeek8bit(vm, s)
+#define PEEK16(s) stackPeek16bit(vm, s)
+#define PEEK32(s) stackPeek32bit(vm, s)
+#define POKE8(s, v) stackPoke8bit(vm, s, v)
+#define POKE16(s, v) stackPoke16bit(vm, s, v)
+#define POKE32(s, v) stackPoke32bit(vm, s, v)
+#define SPILL() (void)0
+#define HAS_ROOM(s, n) (vm->sp[s] + (n) < vm->stackSize[s])
+#endif
+
+#if CHECKED
+#define FAULTED() (vm->last_error != NONE)
+#else
+#define FAULTED() 0
+#endif
+
+// the flags are only worked out when a conditional instruction asks for them
+#define SET_FLAGS(v) (flags = (int32_t)(v))
+#define FLAG_ZERO() isZero(flags)
+#define FLAG_NEGATIVE() isNegative(flags)
+
+#if JITTED
+#define YIELD() (native && ip != resumed && (uintptr_t)ip - (uintptr_t)prog->code < prog->length * sizeof(Insn) && \
+                 native[ip - prog->code])
+#else
+#define YIELD() 0
+#endif
+
+static int RUN(VM* vm) {
+  const Program* prog = vm->program;
+  const Insn* ip;
+  Insn scratch[3]; // decoded on the fly for jumps to byte pcs no record starts at
+  uint32_t scratchPc = 0;
+  int64_t flags = vm->flags; // in a register; only stored back on the way out
+  int64_t budget = vm->budget; // likewise
+#if TOS_CACHE
+  Tos tos = { .stack = -1 };
+#endif
+#if JITTED
+  const uint32_t* native = prog->jit ? prog->jit->entry : NULL;
+  const Insn* resumed = vm->pc < prog->size && prog->index[vm->pc] ? &prog->code[prog->index[vm->pc] - 1] : NULL;
+#endif
+
+#ifdef CLAW_THREADED_DISPATCH
+  static void* const dispatchTable[NUM_OPS] = {
+    [0 ... NUM_OPS - 1] = &&op_default,
+#define X(op) [op] = &&op_##op,
+    DISPATCH_TABLE(X)
+#undef X
+#define X(name, first, second) [OP_##name] = &&op_OP_##name,
+    FUSED_OPS(X)
+#undef X
+  };
+#define CASE(op) op_##op:
+#define DEFAULT op_default:
+#else
+#define CASE(op) case op:
+#define DEFAULT default:
+#endif
+// every handler ends in one of these
+#define NEXT { if(FAULTED()) goto fault; ip++; DISPATCH(); }
+#define JUMP(to) { ip = (to); DISPATCH(); }
+#define GOTO_PC(to) { vm->pc = (to); goto lookup; }
+// branches and jumps that may go backwards, charging the budget if they do
+#define BRANCH(offset) { \
+    int32_t offset_ = (offset); \
+    ip += offset_; \
+    if(offset_ <= 0 && (budget -= 1 - offset_) <= 0) { \
+      vm->pc = RESUME_PC(); \
+      goto spent; \
+    } \
+    DISPATCH(); \
+  }
+#define BRANCH_PC(to) { \
+    uint32_t to_ = (to), from_ = IP_PC(); \
+    if(to_ <= from_ && (budget -= (from_ - to_) / 2 + 1) <= 0) { \
+      vm->pc = to_; \
+      goto spent; \
+    } \
+    GOTO_PC(to_); \
+  }
+
+  GOTO_PC(vm->pc);
+#ifdef CLAW_THREADED_DISPATCH
+  {
+#else
+dispatch:
+  if(YIELD())
+    goto yield;
+  TRACE();
+  switch(ip->op) {
+#endif
+      CASE(LET8)
+        PUSH8(ip->destination, ip->imm);
+        NEXT;
+      CASE(LET16)
+        PUSH16(ip->destination, ip->imm);
+        NEXT;
+      CASE(LET32)
+        PUSH32(ip->destination, ip->imm);
+        NEXT;
+      CASE(LETA)
+      {
+        SPILL();
+        uint16_t len = POP16(ip->source);
+        if(FAULTED())
+          goto fault;
+        uint32_t end = ip->imm + len;
+        if(end > prog->size)
+          GOTO_PC(end);
+        if(vm->sp[ip->destination] + len >= vm->stackSize[ip->destination]) {
+          vm->last_error = ERR_STACK_OVERFLOW;
+          goto fault;
+        }
+        memcpy(&vm->stacks[ip->destination][vm->sp[ip->destination]], &prog->bytes[ip->imm], len);
+        vm->sp[ip->destination] += len;
+        if(len == ip->aux)
+          NEXT;
+        GOTO_PC(end);
+      }
+      CASE(CPY8)
+        PUSH8(ip->destination, PEEK8(ip->source));
+        NEXT;
+      CASE(CPY16)
+        PUSH16(ip->destination, PEEK16(ip->source));
+        NEXT;
+      CASE(CPY32)
+        PUSH32(ip->destination, PEEK32(ip->source));
+        NEXT;
+      CASE(CPYA)
+      {
+        SPILL();
+        uint16_t len = POP16(ip->source);
+        if(FAULTED())
+          goto fault;
+        if(vm->sp[ip->source] < len) {
+          vm->last_error = ERR_STACK_UNDERFLOW;
+          goto fault;
+        }
+        if(vm->sp[ip->destination] + len >= vm->stackSize[ip->destination]) {
+          vm->last_error = ERR_STACK_OVERFLOW;
+          goto fault;
+        }
+        // on one stack the copy lands right above what it copies
+        memcpy(&vm->stacks[ip->destination][vm->sp[ip->destination]], &vm->stacks[ip->source][vm->sp[ip->source] - len], len);
+        vm->sp[ip->destination] += len;
+        NEXT;
+      }
+      CASE(MOV8)
+        PUSH8(ip->destination, POP8(ip->source));
+        NEXT;
+      CASE(MOV16)
+        PUSH16(ip->destination, POP16(ip->source));
+        NEXT;
+      CASE(MOV32)
+        PUSH32(ip->destination, POP32(ip->source));
+        NEXT;
+      CASE(MOVA)
+      {
+        // nothing is popped until both stacks are checked, so a fault
+        // leaves them as they were
+        SPILL();
+        uint16_t len = PEEK16(ip->source);
+        if(FAULTED())
+          goto fault;
+        uint32_t below = vm->sp[ip->source] - 2; // under the length
+        if(below < len) {
+          vm->last_error = ERR_STACK_UNDERFLOW;
+          goto fault;
+        }
+        uint32_t top = ip->destination == ip->source ? below - len : vm->sp[ip->destination];
+        if(top + len >= vm->stackSize[ip->destination]) {
+          vm->last_error = ERR_STACK_OVERFLOW;
+          goto fault;
+        }
+        vm->sp[ip->source] = below - len;
+        // a move onto the same stack puts the bytes back where they were
+        memmove(&vm->stacks[ip->destination][vm->sp[ip->destination]], &vm->stacks[ip->source][vm->sp[ip->source]], len);
+        vm->sp[ip->destination] += len;
+        NEXT;
+      }
+      CASE(SWP8)
+      {
+        uint8_t a = POP8(ip->source);
+        PUSH8(ip->source, POP8(ip->destination));
+        PUSH8(ip->destination, a);
+        NEXT;
+      }
+      CASE(SWP16)
+      {
+        uint16_t a = POP16(ip->source);
+        PUSH16(ip->source, POP16(ip->destination));
+        PUSH16(ip->destination, a);
+        NEXT;
+      }
+      CASE(SWP32)
+      {
+        uint32_t a = POP32(ip->source);
+        PUSH32(ip->source, POP32(ip->destination));
+        PUSH32(ip->destination, a);
+        NEXT;
+      }
+      CASE(DEL8)
+        (void)POP8(ip->source);
+        NEXT;
+      CASE(DEL16)
+        (void)POP16(ip->source);
+        NEXT;
+      CASE(DEL32)
+        (void)POP32(ip->source);
+        NEXT;
+      CASE(DELA)
+      {
+        SPILL();
+        uint16_t len = POP16(ip->source);
+        if(FAULTED())
+          goto fault;
+        if(vm->sp[ip->source] < len) {
+          vm->last_error = ERR_STACK_UNDERFLOW;
+          goto fault;
+        }
+        vm->sp[ip->source] -= len;
+        NEXT;
+      }
+      CASE(MMCP)
+      {
+        // like CPYA, but from depth bytes down rather than from the top
+        SPILL();
+        uint16_t len = POP16(ip->source);
+        uint16_t depth = POP16(ip->source);
+        if(FAULTED())
+          goto fault;
+        if(vm->sp[ip->source] < depth || depth < len) {
+          vm->last_error = ERR_STACK_UNDERFLOW;
+          goto fault;
+        }
+        if(vm->sp[ip->destination] + len >= vm->stackSize[ip->destination]) {
+          vm->last_error = ERR_STACK_OVERFLOW;
+          goto fault;
+        }
+        memcpy(&vm->stacks[ip->destination][vm->sp[ip->destination]], &vm->stacks[ip->source][vm->sp[ip->source] - depth], len);
+        vm->sp[ip->destination] += len;
+        NEXT;
+      }
+      CASE(DELALL)
+        SPILL();
+        for(int i = 0; i < NUM_STACKS; i++)
+          vm->sp[0] = 0;
+        NEXT;
+
+      // math
+      CASE(ADD8)
+      {
+        uint8_t r = POP8(ip->source) + POP8(ip->source);
+        PUSH8(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(ADD16)
+      {
+        uint16_t r = POP16(ip->source) + POP16(ip->source);
+        PUSH16(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(ADD32)
+      {
+        uint32_t r = POP32(ip->source) + POP32(ip->source);
+        PUSH32(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(SUB8)
+      {
+        uint8_t op1 = POP8(ip->source);
+        uint8_t r = POP8(ip->source) - op1;
+        PUSH8(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(SUB16)
+      {
+        uint16_t op1 = POP16(ip->source);
+        uint16_t r = POP16(ip->source) - op1;
+        PUSH16(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(SUB32)
+      {
+        uint32_t op1 = POP32(ip->source);
+        uint32_t r = POP32(ip->source) - op1;
+        PUSH32(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(MUL8)
+      {
+        uint8_t r = POP8(ip->source) * POP8(ip->source);
+        PUSH8(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(MUL16)
+      {
+        uint16_t r = POP16(ip->source) * POP16(ip->source);
+        PUSH16(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(MUL32)
+      {
+        uint32_t r = POP32(ip->source) * POP32(ip->source);
+        PUSH32(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(DIV8)
+      {
+        uint8_t op1 = POP8(ip->source);
+        uint8_t r = POP8(ip->source) / op1;
+        PUSH8(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(DIV16)
+      {
+        uint16_t op1 = POP16(ip->source);
+        uint16_t r = POP16(ip->source) / op1;
+        PUSH16(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(DIV32)
+      {
+        uint32_t op1 = POP32(ip->source);
+        uint32_t r = POP32(ip->source) / op1;
+        PUSH32(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(MOD8)
+      {
+        uint8_t op1 = POP8(ip->source);
+        uint8_t r = POP8(ip->source) % op1;
+        PUSH8(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(MOD16)
+      {
+        uint16_t op1 = POP16(ip->source);
+        uint16_t r = POP16(ip->source) % op1;
+        PUSH16(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+      CASE(MOD32)
+      {
+        uint32_t op1 = POP32(ip->source);
+        uint32_t r = POP32(ip->source) % op1;
+        PUSH32(ip->destination, r);
+        SET_FLAGS(r);
+        NEXT;
+      }
+
+      // bitwise shifts
+      CASE(SR8)
+      {
+        uint8_t places = POP8(ip->source);
+        uint8_t value = POP8(ip->source) >> places;
+        PUSH8(ip->destination, value);
+        SET_FLAGS(value);
+        NEXT;
+      }
+      CASE(SR16)
+      {
+        uint16_t places = POP16(ip->source);
+        uint16_t value = POP16(ip->source) >> places;
+        PUSH16(ip->destination, value);
+        SET_FLAGS(value);
+        NEXT;
+      }
+      CASE(SR32)
+      {
+        uint32_t places = POP32(ip->source);
+        uint32_t value = POP32(ip->source) >> places;
+        PUSH32(ip->destination, value);
+        SET_FLAGS(value);
+        NEXT;
+      }
+      CASE(SSR8)
+      {
+        uint8_t places = POP8(ip->source);
+        int8_t value = (int8_t)POP8(ip->source) >> places;
+        PUSH8(ip->destination, value);
+        SET_FLAGS(value);
+        NEXT;
+      }
+      CASE(SSR16)
+      {
+        uint16_t places = POP16(ip->source);
+        int16_t value = (int16_t)POP16(ip->source) >> places;
+        PUSH16(ip->destination, value);
+        SET_FLAGS(value);
+        NEXT;
+      }
+      CASE(SSR32)
+      {
+        uint32_t places = POP32(ip->source);
+        int32_t value = (int32_t)POP32(ip->source) >> places;
+        PUSH32(ip->destination, value);
+        SET_FLAGS(value);
+        NEXT;
+      }
+      CASE(SL8)
+      {
+        uint8_t places = POP8(ip->source);
+        int8_t value = (int8_t)POP8(ip->source) << places;
+        PUSH8(ip->destination, value);
+        SET_FLAGS(value);
+        NEXT;
+      }
+      CASE(SL16)
+      {
+        uint16_t places = POP16(ip->source);
+        int16_t value = (int16_t)POP16(ip->source) << places;
+        PUSH16(ip->destination, value);
+        SET_FLAGS(value);
+        NEXT;
+      }
+      CASE(SL32)
+      {
+        uint32_t places = POP32(ip->source);
+        int32_t value = (int32_t)POP32(ip->source) << places;
+        PUSH32(ip->destination, value);
+        SET_FLAGS(value);
+        NEXT;
+      }
+
+      // other bitwise operations with two operands
+      CASE(AND8)
+      {
+        uint8_t v = POP8(ip->source) & POP8(ip->source);
+        PUSH8(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(AND16)
+      {
+        uint16_t v = POP16(ip->source) & POP16(ip->source);
+        PUSH16(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(AND32)
+      {
+        uint32_t v = POP32(ip->source) & POP32(ip->source);
+        PUSH32(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(OR8)
+      {
+        uint8_t v = POP8(ip->source) | POP8(ip->source);
+        PUSH8(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(OR16)
+      {
+        uint16_t v = POP16(ip->source) | POP16(ip->source);
+        PUSH16(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(OR32)
+      {
+        uint32_t v = POP32(ip->source) | POP32(ip->source);
+        PUSH32(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NOR8)
+      {
+        uint8_t v = ~(POP8(ip->source) | POP8(ip->source));
+        PUSH8(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NOR16)
+      {
+        uint16_t v = ~(POP16(ip->source) | POP16(ip->source));
+        PUSH16(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NOR32)
+      {
+        uint32_t v = ~(POP32(ip->source) | POP32(ip->source));
+        PUSH32(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NAND8)
+      {
+        uint8_t v = ~(POP8(ip->source) & POP8(ip->source));
+        PUSH8(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NAND16)
+      {
+        uint16_t v = ~(POP16(ip->source) & POP16(ip->source));
+        PUSH16(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NAND32)
+      {
+        uint32_t v = ~(POP32(ip->source) & POP32(ip->source));
+        PUSH32(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(XOR8)
+      {
+        uint8_t v = POP8(ip->source) ^ POP8(ip->source);
+        PUSH8(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(XOR16)
+      {
+        uint16_t v = POP16(ip->source) ^ POP16(ip->source);
+        PUSH16(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(XOR32)
+      {
+        uint32_t v = POP32(ip->source) ^ POP32(ip->source);
+        PUSH32(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+
+      // element-wise over two arrays: pops an element count, then the two
+      // arrays it counts, and pushes the result; the flags are left alone.
+      // Like MOVA, it checks both stacks before popping anything.
+      CASE(ADDA8) CASE(ADDA16) CASE(ADDA32) CASE(SUBA8) CASE(SUBA16) CASE(SUBA32)
+      CASE(ANDA8) CASE(ANDA16) CASE(ANDA32) CASE(ORA8) CASE(ORA16) CASE(ORA32)
+      CASE(XORA8) CASE(XORA16) CASE(XORA32)
+      {
+        SPILL();
+        unsigned int width = 1u << (ip->op - ADDA8) % 3;
+        uint32_t bytes = PEEK16(ip->source) * width;
+        if(FAULTED())
+          goto fault;
+        uint32_t below = vm->sp[ip->source] - 2; // under the count
+        if(below < 2 * bytes) {
+          vm->last_error = ERR_STACK_UNDERFLOW;
+          goto fault;
+        }
+        uint32_t top = ip->destination == ip->source ? below - 2 * bytes : vm->sp[ip->destination];
+        if(top + bytes >= vm->stackSize[ip->destination]) {
+          vm->last_error = ERR_STACK_OVERFLOW;
+          goto fault;
+        }
+        vm->sp[ip->source] = below - 2 * bytes;
+        // the lower array is the first operand; on one stack the result
+        // overwrites it in place
+        const uint8_t* x = &vm->stacks[ip->source][vm->sp[ip->source]];
+        arrayOp((ip->op - ADDA8) / 3, width, &vm->stacks[ip->destination][vm->sp[ip->destination]], x, x + bytes, bytes / width);
+        vm->sp[ip->destination] += bytes;
+        NEXT;
+      }
+
+      // bitwise operations with one operand
+      CASE(NOT8)
+      {
+        uint8_t v = ~ POP8(ip->source);
+        PUSH8(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NOT16)
+      {
+        uint16_t v = ~ POP16(ip->source);
+        PUSH16(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NOT32)
+      {
+        uint32_t v = ~ POP32(ip->source);
+        PUSH32(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NEG8)
+      {
+        int8_t v = -(int8_t)POP8(ip->source);
+        PUSH8(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NEG16)
+      {
+        int16_t v = -(int16_t)POP16(ip->source);
+        PUSH16(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(NEG32)
+      {
+        int32_t v = -(int32_t)POP32(ip->source);
+        PUSH32(ip->destination, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      // increment / decrement
+      CASE(INC8)
+      {
+        uint8_t v = PEEK8(ip->source) + 1;
+        if(FAULTED())
+          goto fault;
+        POKE8(ip->source, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(INC16)
+      {
+        uint16_t v = PEEK16(ip->source) + 1;
+        if(FAULTED())
+          goto fault;
+        POKE16(ip->source, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(INC32)
+      {
+        uint32_t v = PEEK32(ip->source) + 1;
+        if(FAULTED())
+          goto fault;
+        POKE32(ip->source, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(DEC8)
+      {
+        uint8_t v = PEEK8(ip->source) - 1;
+        if(FAULTED())
+          goto fault;
+        POKE8(ip->source, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(DEC16)
+      {
+        uint16_t v = PEEK16(ip->source) - 1;
+        if(FAULTED())
+          goto fault;
+        POKE16(ip->source, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      CASE(DEC32)
+      {
+        uint32_t v = PEEK32(ip->source) - 1;
+        if(FAULTED())
+          goto fault;
+        POKE32(ip->source, v);
+        SET_FLAGS(v);
+        NEXT;
+      }
+      // equality tests and manual flag manipulation
+      CASE(EQU8)
+      {
+        uint8_t op1 = POP8(ip->source);
+        SET_FLAGS(POP8(ip->source) - op1);
+        NEXT;
+      }
+      CASE(EQU16)
+      {
+        uint16_t op1 = POP16(ip->source);
+        SET_FLAGS(POP16(ip->source) - op1);
+        NEXT;
+      }
+      CASE(EQU32)
+      {
+        uint8_t op1 = POP32(ip->source);
+        SET_FLAGS(POP32(ip->source) - op1);
+        NEXT;
+      }
+      CASE(STZ)
+        flags = flagsOf(1, FLAG_NEGATIVE());
+        NEXT;
+      CASE(STN)
+        flags = flagsOf(FLAG_ZERO(), 1);
+        NEXT;
+      CASE(CLZ)
+        flags = flagsOf(0, FLAG_NEGATIVE());
+        NEXT;
+      CASE(CLN)
+        flags = flagsOf(FLAG_ZERO(), 0);
+        NEXT;
+      CASE(TGZ)
+        flags = flagsOf(!FLAG_ZERO(), FLAG_NEGATIVE());
+        NEXT;
+      CASE(TGN)
+        flags = flagsOf(FLAG_ZERO(), !FLAG_NEGATIVE());
+        NEXT;
+
+
+      // flow control
+      CASE(JMP)
+      {
+        uint32_t loc = POP32(ip->source);
+        if(FAULTED())
+          goto fault;
+        BRANCH_PC(loc);
+      }
+      CASE(JMPZ)
+      {
+        uint32_t loc = POP32(ip->source);
+        if(FAULTED())
+          goto fault;
+        if(FLAG_ZERO())
+          BRANCH_PC(loc);
+        NEXT;
+      }
+      CASE(JMPNZ)
+      {
+        uint32_t loc = POP32(ip->source);
+        if(FAULTED())
+          goto fault;
+        if(!FLAG_ZERO())
+          BRANCH_PC(loc);
+        NEXT;
+      }
+      CASE(JMPN)
+      {
+        uint32_t loc = POP32(ip->source);
+        if(FAULTED())
+          goto fault;
+        if(FLAG_NEGATIVE())
+          BRANCH_PC(loc);
+        NEXT;
+      }
+      CASE(JMPNN)
+      {
+        uint32_t loc = POP32(ip->source);
+        if(FAULTED())
+          goto fault;
+        if(!FLAG_NEGATIVE())
+          BRANCH_PC(loc);
+        NEXT;
+      }
+      CASE(BR)
+        BRANCH(ip->target);
+      CASE(BRZ)
+        if(FLAG_ZERO())
+          BRANCH(ip->target);
+        NEXT;
+      CASE(BRNZ)
+        if(!FLAG_ZERO())
+          BRANCH(ip->target);
+        NEXT;
+      CASE(BRN)
+        if(FLAG_NEGATIVE())
+          BRANCH(ip->target);
+        NEXT;
+      CASE(BRNN)
+        if(!FLAG_NEGATIVE())
+          BRANCH(ip->target);
+        NEXT;
+      CASE(PPTR)
+        PUSH32(ip->destination, ip->imm);
+        NEXT;
+      CASE(ENDZ)
+        if(FLAG_ZERO())
+          goto done;
+        NEXT;
+      CASE(ENDN)
+        if(FLAG_NEGATIVE())
+          goto done;
+        NEXT;
+      CASE(CALL)
+        if(vm->callDepth == CALL_DEPTH) {
+          vm->last_error = ERR_CALL_OVERFLOW;
+          goto fault;
+        }
+        vm->calls[vm->callDepth++] = ip->imm;
+        BRANCH(ip->target);
+      CASE(RET)
+        if(!vm->callDepth) {
+          vm->last_error = ERR_CALL_UNDERFLOW;
+          goto fault;
+        }
+        BRANCH_PC(vm->calls[--vm->callDepth]);
+      CASE(END)
+        goto done;
+      CASE(SLEEP)
+      {
+        uint32_t ms = POP32(ip->source);
+        if(FAULTED())
+          goto fault;
+        if(vm->sleepMode == SLEEP_PARK) {
+          ip++;
+          vm->pc = RESUME_PC();
+          vm->sleep = ms;
+          SPILL();
+          vm->flags = flags;
+          vm->budget = budget;
+          return RUN_SLEEP;
+        }
+        if(vm->sleepMode == SLEEP_WAIT)
+          sleepFor(vm, ms);
+        NEXT;
+      }
+
+      // debug instructions
+      CASE(DMPSSTR)
+        outBytes(vm, &prog->bytes[ip->imm], ip->aux);
+        NEXT;
+      CASE(DMPN8)
+        outNumber(vm, POP8(ip->source));
+        NEXT;
+      CASE(DMPN16)
+        outNumber(vm, POP16(ip->source));
+        NEXT;
+      CASE(DMPN32)
+        outNumber(vm, POP32(ip->source));
+        NEXT;
+      CASE(GETN8)
+      {
+        uint32_t n;
+        if(!getNumber(vm, &n))
+          goto fault;
+        PUSH8(ip->destination, n);
+        NEXT;
+      }
+      CASE(GETN16)
+      {
+        uint32_t n;
+        if(!getNumber(vm, &n))
+          goto fault;
+        PUSH16(ip->destination, n);
+        NEXT;
+      }
+      CASE(GETN32)
+      {
+        uint32_t n;
+        if(!getNumber(vm, &n))
+          goto fault;
+        PUSH32(ip->destination, n);
+        NEXT;
+      }
+
+      // graphics, on vm->screen. Coordinates, sizes and radii are signed
+      // 16-bit values on the source stack, pushed in the order they are named
+      // (x, then y, ...), so they come off it last first. Flags are untouched.
+#define COORD() ((int16_t)POP16(ip->source))
+      CASE(CLR)
+        screenClear(&vm->screen);
+        NEXT;
+      CASE(FILL)
+        screenFill(&vm->screen);
+        NEXT;
+      CASE(COLOR)
+        vm->screen.color = POP8(ip->source);
+        NEXT;
+      CASE(GMODE)
+        vm->screen.mode = POP8(ip->source) & 1;
+        NEXT;
+      CASE(MIRROR)
+        vm->screen.mirror = POP8(ip->source) & (MIRROR_X | MIRROR_Y);
+        NEXT;
+      CASE(FONT)
+        vm->screen.font = POP8(ip->source) % FONT_COUNT;
+        NEXT;
+      CASE(POINT)
+      {
+        int y = COORD(), x = COORD();
+        if(FAULTED())
+          goto fault;
+        screenPoint(&vm->screen, x, y);
+        NEXT;
+      }
+      CASE(GETPIX)
+      {
+        int y = COORD(), x = COORD();
+        if(FAULTED())
+          goto fault;
+        PUSH8(ip->destination, screenPixel(&vm->screen, x, y));
+        NEXT;
+      }
+      CASE(HLINE) CASE(VLINE)
+      {
+        int length = COORD(), y = COORD(), x = COORD();
+        if(FAULTED())
+          goto fault;
+        if(ip->op == HLINE)
+          screenHLine(&vm->screen, x, y, length);
+        else
+          screenVLine(&vm->screen, x, y, length);
+        NEXT;
+      }
+      CASE(LINE)
+      {
+        int y1 = COORD(), x1 = COORD(), y0 = COORD(), x0 = COORD();
+        if(FAULTED())
+          goto fault;
+        screenLine(&vm->screen, x0, y0, x1, y1, 1);
+        NEXT;
+      }
+      CASE(RECT) CASE(LRECT)
+      {
+        int height = COORD(), width = COORD(), y = COORD(), x = COORD();
+        if(FAULTED())
+          goto fault;
+        screenRect(&vm->screen, x, y, width, height, ip->op == RECT);
+        NEXT;
+      }
+      CASE(CIRCL) CASE(LCIRCL)
+      {
+        int r = COORD(), y = COORD(), x = COORD();
+        if(FAULTED())
+          goto fault;
+        screenEllipse(&vm->screen, x, y, r, r, ip->op == CIRCL);
+        NEXT;
+      }
+      CASE(ELIPS) CASE(LELIPS)
+      {
+        int ry = COORD(), rx = COORD(), y = COORD(), x = COORD();
+        if(FAULTED())
+          goto fault;
+        screenEllipse(&vm->screen, x, y, rx, ry, ip->op == ELIPS);
+        NEXT;
+      }
+      CASE(POLY)
+      {
+        // an 8-bit count on top of that many x, y points
+        SPILL();
+        uint32_t bytes = POP8(ip->source) * 4u;
+        if(FAULTED())
+          goto fault;
+        if(vm->sp[ip->source] < bytes) {
+          vm->last_error = ERR_STACK_UNDERFLOW;
+          goto fault;
+        }
+        vm->sp[ip->source] -= bytes;
+        screenPolygon(&vm->screen, &vm->stacks[ip->source][vm->sp[ip->source]], bytes / 4);
+        NEXT;
+      }
+      CASE(PRINT)
+      {
+        // an 8-bit length on top of y, x and that many bytes of text
+        SPILL();
+        uint32_t n = POP8(ip->source);
+        int y = COORD(), x = COORD();
+        if(FAULTED())
+          goto fault;
+        if(vm->sp[ip->source] < n) {
+          vm->last_error = ERR_STACK_UNDERFLOW;
+          goto fault;
+        }
+        vm->sp[ip->source] -= n;
+        fontPrint(&vm->screen, &vm->stacks[ip->source][vm->sp[ip->source]], n, x, y);
+        NEXT;
+      }
+      CASE(SPRT) CASE(BITM)
+      {
+        // the image's byte address on top of where its top left corner goes
+        uint32_t addr = POP32(ip->source);
+        int y = COORD(), x = COORD();
+        if(FAULTED())
+          goto fault;
+        if(spriteDraw(&vm->sprites, &vm->screen, prog->bytes, prog->size, addr, ip->op == SPRT, x, y)) {
+          // reported like a jump out of the program, at the image's address
+          vm->last_error = ERR_TARGET;
+          vm->pc = addr;
+          goto done;
+        }
+        NEXT;
+      }
+      CASE(SWBUFF)
+        screenSwap(&vm->screen);
+        if(vm->frame)
+          vm->frame(vm->frameArg, &vm->screen);
+        NEXT;
+#undef COORD
+
+      // superinstructions built by programFuse(). Each behaves exactly like the
+      // pair it replaces, down to which of the two an error is reported at.
+      // LET<bits> S k; <op><bits> S D: k never touches the stack
+#define FUSED_LET(name, bits, expr) \
+      CASE(OP_##name) \
+      { \
+        if(!HAS_ROOM(ip->source, bits / 8)) { \
+          vm->last_error = ERR_STACK_OVERFLOW; \
+          goto fault; \
+        } \
+        uint##bits##_t b = ip->imm; \
+        uint##bits##_t a = POP##bits(ip->source); \
+        uint##bits##_t r = expr; \
+        PUSH##bits(ip->destination, r); \
+        SET_FLAGS(r); \
+        if(FAULTED()) { \
+          ip++; \
+          goto fault; \
+        } \
+        ip += 2; \
+        DISPATCH(); \
+      }
+      FUSED_LET(LET_ADD8, 8, a + b) FUSED_LET(LET_ADD16, 16, a + b) FUSED_LET(LET_ADD32, 32, a + b)
+      FUSED_LET(LET_SUB8, 8, a - b) FUSED_LET(LET_SUB16, 16, a - b) FUSED_LET(LET_SUB32, 32, a - b)
+      FUSED_LET(LET_MUL8, 8, a * b) FUSED_LET(LET_MUL16, 16, a * b) FUSED_LET(LET_MUL32, 32, a * b)
+      FUSED_LET(LET_AND8, 8, a & b) FUSED_LET(LET_AND16, 16, a & b) FUSED_LET(LET_AND32, 32, a & b)
+      FUSED_LET(LET_OR8, 8, a | b) FUSED_LET(LET_OR16, 16, a | b) FUSED_LET(LET_OR32, 32, a | b)
+      FUSED_LET(LET_XOR8, 8, a ^ b) FUSED_LET(LET_XOR16, 16, a ^ b) FUSED_LET(LET_XOR32, 32, a ^ b)
+#undef FUSED_LET
+
+      // EQU<bits> S; BR(N)Z
+#define FUSED_EQU(name, bits, type, cond) \
+      CASE(OP_##name) \
+      { \
+        type op1 = POP##bits(ip->source); \
+        SET_FLAGS(POP##bits(ip->source) - op1); \
+        if(FAULTED()) \
+          goto fault; \
+        if(cond) \
+          BRANCH(ip->target); \
+        ip += 2; \
+        DISPATCH(); \
+      }
+      FUSED_EQU(EQU8_BRZ, 8, uint8_t, FLAG_ZERO()) FUSED_EQU(EQU16_BRZ, 16, uint16_t, FLAG_ZERO())
+      FUSED_EQU(EQU32_BRZ, 32, uint8_t, FLAG_ZERO())
+      FUSED_EQU(EQU8_BRNZ, 8, uint8_t, !FLAG_ZERO()) FUSED_EQU(EQU16_BRNZ, 16, uint16_t, !FLAG_ZERO())
+      FUSED_EQU(EQU32_BRNZ, 32, uint8_t, !FLAG_ZERO())
+#undef FUSED_EQU
+
+      // INC<bits> S or DEC<bits> S; conditional branch
+#define FUSED_STEP(name, bits, delta, cond) \
+      CASE(OP_##name) \
+      { \
+        uint##bits##_t v = PEEK##bits(ip->source) delta; \
+        if(FAULTED()) \
+          goto fault; \
+        POKE##bits(ip->source, v); \
+        SET_FLAGS(v); \
+        if(cond) \
+          BRANCH(ip->target); \
+        ip += 2; \
+        DISPATCH(); \
+      }
+      FUSED_STEP(INC8_BRZ, 8, + 1, FLAG_ZERO()) FUSED_STEP(INC16_BRZ, 16, + 1, FLAG_ZERO())
+      FUSED_STEP(INC32_BRZ, 32, + 1, FLAG_ZERO())
+      FUSED_STEP(INC8_BRNZ, 8, + 1, !FLAG_ZERO()) FUSED_STEP(INC16_BRNZ, 16, + 1, !FLAG_ZERO())
+      FUSED_STEP(INC32_BRNZ, 32, + 1, !FLAG_ZERO())
+      FUSED_STEP(INC8_BRN, 8, + 1, FLAG_NEGATIVE()) FUSED_STEP(INC16_BRN, 16, + 1, FLAG_NEGATIVE())
+      FUSED_STEP(INC32_BRN, 32, + 1, FLAG_NEGATIVE())
+      FUSED_STEP(INC8_BRNN, 8, + 1, !FLAG_NEGATIVE()) FUSED_STEP(INC16_BRNN, 16, + 1, !FLAG_NEGATIVE())
+      FUSED_STEP(INC32_BRNN, 32, + 1, !FLAG_NEGATIVE())
+      FUSED_STEP(DEC8_BRZ, 8, - 1, FLAG_ZERO()) FUSED_STEP(DEC16_BRZ, 16, - 1, FLAG_ZERO())
+      FUSED_STEP(DEC32_BRZ, 32, - 1, FLAG_ZERO())
+      FUSED_STEP(DEC8_BRNZ, 8, - 1, !FLAG_ZERO()) FUSED_STEP(DEC16_BRNZ, 16, - 1, !FLAG_ZERO())
+      FUSED_STEP(DEC32_BRNZ, 32, - 1, !FLAG_ZERO())
+      FUSED_STEP(DEC8_BRN, 8, - 1, FLAG_NEGATIVE()) FUSED_STEP(DEC16_BRN, 16, - 1, FLAG_NEGATIVE())
+      FUSED_STEP(DEC32_BRN, 32, - 1, FLAG_NEGATIVE())
+      FUSED_STEP(DEC8_BRNN, 8, - 1, !FLAG_NEGATIVE()) FUSED_STEP(DEC16_BRNN, 16, - 1, !FLAG_NEGATIVE())
+      FUSED_STEP(DEC32_BRNN, 32, - 1, !FLAG_NEGATIVE())
+#undef FUSED_STEP
+
+      CASE(OP_RESYNC)
+        if(ip->aux) // a taken branch decoded on the fly
+          BRANCH_PC(ip->imm);
+        GOTO_PC(ip->imm);
+      CASE(OP_BREAK)
+        vm->pc = IP_PC();
+        SPILL();
+        vm->flags = flags;
+        vm->budget = budget;
+        return RUN_BREAK;
+      DEFAULT // nop
+        NEXT;
+  }
+#undef CASE
+#undef DEFAULT
+#undef NEXT
+#undef JUMP
+#undef GOTO_PC
+#undef BRANCH
+#undef BRANCH_PC
+
+fault:
+  vm->pc = IP_PC();
+  goto done;
+
+lookup:
+  if(vm->pc >= prog->size) {
+    vm->last_error = ERR_TARGET;
+    goto done;
+  }
+  if(prog->index[vm->pc]) {
+    ip = &prog->code[prog->index[vm->pc] - 1];
+    DISPATCH();
+  }
+  scratchPc = vm->pc;
+  uint32_t next = decodeInsn(prog->bytes, prog->size, vm->pc, &scratch[0]);
+  scratch[0].target = 2;
+  scratch[1] = (Insn){ .op = OP_RESYNC, .imm = next };
+  scratch[2] = (Insn){ .op = OP_RESYNC, .imm = scratch[0].aux, .aux = 1 };
+  ip = scratch;
+  DISPATCH();
+
+done:
+  SPILL();
+  vm->flags = flags;
+  vm->budget = budget;
+  return RUN_ENDED;
+
+spent:
+  SPILL();
+  vm->flags = flags;
+  vm->budget = budget;
+  return RUN_YIELD;
+
+yield:
+  vm->pc = IP_PC();
+  SPILL();
+  vm->flags = flags;
+  vm->budget = budget;
+  return RUN_NATIVE;
+}
+
+#undef PUSH8
+#undef PUSH16
+#undef PUSH32
+#undef POP8
+#undef POP16
+#undef POP32
+#undef PEEK8
+#undef PEEK16
+#undef PEEK32
+#undef POKE8
+#undef POKE16
+#undef POKE32
+#undef SPILL
+#undef HAS_ROOM
+#undef YIELD
+#undef FAULTED
+#undef SET_FLAGS
+#undef FLAG_ZERO
+#undef FLAG_NEGATIVE
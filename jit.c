@@ -0,0 +1,1096 @@
+/*
+Baseline x86-64 JIT for MODE_JIT. jitCompile() translates a loaded Program
+into native code once, up front, one basic block of records at a time. It
+covers the stack-move (LET, CPY, MOV, SWP, DEL, PPTR), arithmetic, bitwise
+and shift families, INC/DEC, EQU and BR/JMP/CALL/RET/END. Everything else
+ends the block and runs in the interpreter, which hands back to native code at
+the next block start (see runJit() in vm.c). RET looks the native code for the
+byte pc it returns to up in Program.index and Jit.entry itself, so calls
+between compiled blocks never leave native code. Branches and jumps back
+charge VM.budget as the interpreter does, and leave with JIT_YIELD once it
+runs out.
+
+Within a block, values pushed are kept in registers or as constants and only
+stored when something needs them in memory, so most of the push/pop traffic
+disappears, and operations on constants are folded. The block's stack
+pointers stay where they were on entry until the block ends.
+
+Blocks never raise errors. Every block starts by checking, for each stack it
+touches, that nothing in it can underflow or overflow. If something could, it
+exits before running anything and the interpreter runs the block instead,
+reporting whatever error it hits exactly as it would have without the JIT.
+
+The flags live in ebp as a value whose zero-ness and sign are the two flags,
+like VM.flags cut down to 32 bits. The one VM.flags value with both set, which
+only STZ and friends make, doesn't survive that, so native code isn't entered
+while both are set.
+
+Register use: rbx = VM*, ebp = flags, r12-r15 = the addresses of the stack tops,
+esi, edi, r8d-r11d = cached values, eax, ecx, edx = scratch.
+*/
+
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "bytecode.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// the address of the top of each stack, vm->stacks[s] + vm->sp[s]
+#define SP_REG(s) (R12 + (s))
+
+// ModRM encoding flags
+enum { W = 1, REG8 = 2, RM8 = 4, P66 = 8 };
+
+// condition codes
+enum { CC_B = 2, CC_AE = 3, CC_Z = 4, CC_NZ = 5, CC_S = 8, CC_NS = 9, CC_G = 15 };
+
+typedef struct {
+  uint8_t* bytes;
+  size_t size;
+  size_t capacity;
+  int failed;
+} Asm;
+
+static void put(Asm* a, const void* p, size_t n) {
+  if(a->size + n > a->capacity) {
+    size_t capacity = a->capacity ? a->capacity * 2 : 4096;
+    while(capacity < a->size + n)
+      capacity *= 2;
+    uint8_t* bytes = realloc(a->bytes, capacity);
+    if(bytes == NULL) {
+      a->failed = 1;
+      return;
+    }
+    a->bytes = bytes;
+    a->capacity = capacity;
+  }
+  memcpy(&a->bytes[a->size], p, n);
+  a->size += n;
+}
+
+static void byte(Asm* a, uint8_t b) {
+  put(a, &b, 1);
+}
+
+static void word(Asm* a, uint16_t w) {
+  uint8_t b[2] = { w, w >> 8 };
+  put(a, b, 2);
+}
+
+static void dword(Asm* a, uint32_t d) {
+  uint8_t b[4] = { d, d >> 8, d >> 16, d >> 24 };
+  put(a, b, 4);
+}
+
+static void patch32(Asm* a, size_t at, uint32_t d) {
+  if(a->failed)
+    return;
+  uint8_t b[4] = { d, d >> 8, d >> 16, d >> 24 };
+  memcpy(&a->bytes[at], b, 4);
+}
+
+// operand size prefix, REX, opcode; sil and dil need a REX even when it is empty
+static void prefix(Asm* a, int flags, unsigned int opcode, int reg, int index, int base, int byteReg) {
+  if(flags & P66)
+    byte(a, 0x66);
+  uint8_t rex = 0x40 | (flags & W ? 8 : 0) | (reg & 8) >> 1 | (index & 8) >> 2 | (base & 8) >> 3;
+  if(rex != 0x40 || byteReg)
+    byte(a, rex);
+  if(opcode > 0xff)
+    byte(a, opcode >> 8);
+  byte(a, opcode);
+}
+
+static int isByteReg(int r) {
+  return r >= RSP && r <= RDI;
+}
+
+// op reg, rm with both operands registers (reg may be an opcode extension)
+static void rr(Asm* a, int flags, unsigned int opcode, int reg, int rm) {
+  prefix(a, flags, opcode, reg, 0, rm, ((flags & REG8) && isByteReg(reg)) || ((flags & RM8) && isByteReg(rm)));
+  byte(a, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op reg, [base + disp32], or [rbx + disp32] (the VM) if base < 0
+static void rm(Asm* a, int flags, unsigned int opcode, int reg, int base, int32_t disp) {
+  if(base < 0)
+    base = RBX;
+  prefix(a, flags, opcode, reg, 0, base, (flags & REG8) && isByteReg(reg));
+  byte(a, 0x80 | (reg & 7) << 3 | (base & 7));
+  if((base & 7) == RSP)
+    byte(a, 0x24); // rsp and r12 only work as a base through a SIB byte
+  dword(a, disp);
+}
+
+static void movRR(Asm* a, int dst, int src) {
+  rr(a, 0, 0x89, src, dst);
+}
+
+static void movRI(Asm* a, int dst, uint32_t imm) {
+  if(dst & 8)
+    byte(a, 0x41);
+  byte(a, 0xb8 + (dst & 7));
+  dword(a, imm);
+}
+
+// alu opcodes for op rm, reg and their /ext for op rm, imm32
+enum { ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_XOR = 0x31, ALU_CMP = 0x39 };
+
+static void aluRR(Asm* a, unsigned int op, int dst, int src) {
+  rr(a, 0, op, src, dst);
+}
+
+static void aluRI(Asm* a, unsigned int op, int dst, uint32_t imm) {
+  rr(a, 0, 0x81, op >> 3, dst);
+  dword(a, imm);
+}
+
+static void zeroExtend(Asm* a, int r, uint32_t size) {
+  if(size == 1)
+    rr(a, RM8, 0x0fb6, r, r);
+  else if(size == 2)
+    rr(a, 0, 0x0fb7, r, r);
+}
+
+static void signExtend(Asm* a, int dst, int src, uint32_t size) {
+  if(size == 1)
+    rr(a, RM8, 0x0fbe, dst, src);
+  else if(size == 2)
+    rr(a, 0, 0x0fbf, dst, src);
+  else if(dst != src)
+    movRR(a, dst, src);
+}
+
+static size_t jcc(Asm* a, int cc) {
+  byte(a, 0x0f);
+  byte(a, 0x80 | cc);
+  dword(a, 0);
+  return a->size - 4;
+}
+
+static size_t jmp(Asm* a) {
+  byte(a, 0xe9);
+  dword(a, 0);
+  return a->size - 4;
+}
+
+// points the rel32 at `at` to the current position
+static void land(Asm* a, size_t at) {
+  patch32(a, at, a->size - (at + 4));
+}
+
+static void jmpTo(Asm* a, size_t to) {
+  size_t at = jmp(a);
+  patch32(a, at, to - (at + 4));
+}
+
+// where things live in a VM
+#define VM_PC offsetof(VM, pc)
+#define VM_SP(s) (offsetof(VM, sp) + (s) * sizeof(uint32_t))
+#define VM_FLAGS offsetof(VM, flags)
+#define VM_STACKS(s) (offsetof(VM, stacks) + (s) * sizeof(uint8_t*))
+#define VM_STACK_END(s) (offsetof(VM, stackEnd) + (s) * sizeof(uint8_t*))
+#define VM_CALLS offsetof(VM, calls)
+#define VM_CALL_DEPTH offsetof(VM, callDepth)
+#define VM_BUDGET offsetof(VM, budget)
+
+// int enter(VM* vm, int32_t flags, const void* block), followed by the code
+// every block exit jumps to with the status in eax. Returns the exit's offset.
+static size_t emitTrampoline(Asm* a) {
+  static const uint8_t save[] = { 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 };
+  static const uint8_t restore[] = { 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b, 0xc3 };
+  put(a, save, sizeof(save));
+  rr(a, W, 0x89, RDI, RBX);
+  movRR(a, RBP, RSI);
+  for(int s = 0; s < NUM_STACKS; s++) {
+    rm(a, 0, 0x8b, RAX, -1, VM_SP(s));
+    rm(a, W, 0x8b, SP_REG(s), -1, VM_STACKS(s));
+    rr(a, W, 0x01, RAX, SP_REG(s)); // add
+  }
+  rr(a, 0, 0xff, 4, RDX); // jmp rdx
+
+  size_t exit = a->size;
+  for(int s = 0; s < NUM_STACKS; s++) {
+    rm(a, W, 0x2b, SP_REG(s), -1, VM_STACKS(s)); // sub
+    rm(a, 0, 0x89, SP_REG(s), -1, VM_SP(s));
+  }
+  rr(a, W, 0x63, RCX, RBP); // movsxd rcx, ebp
+  rm(a, W, 0x89, RCX, -1, VM_FLAGS);
+  put(a, restore, sizeof(restore));
+  return exit;
+}
+
+// ---- what the JIT covers ----
+
+enum {
+  K_NONE, K_LET, K_CPY, K_MOV, K_SWP, K_DEL,
+  K_ADD, K_SUB, K_MUL, K_DIV, K_MOD, K_SR, K_SL, K_SSR,
+  K_AND, K_OR, K_NOR, K_NAND, K_XOR, K_NOT, K_NEG,
+  K_INC, K_DEC, K_EQU,
+};
+
+// families of 8, 16 and 32 bit opcodes, in that order
+static const struct {
+  uint16_t op8;
+  uint8_t kind;
+} families[] = {
+  { LET8, K_LET }, { CPY8, K_CPY }, { MOV8, K_MOV }, { SWP8, K_SWP }, { DEL8, K_DEL },
+  { ADD8, K_ADD }, { SUB8, K_SUB }, { MUL8, K_MUL }, { DIV8, K_DIV }, { MOD8, K_MOD },
+  { SR8, K_SR }, { SL8, K_SL }, { SSR8, K_SSR },
+  { AND8, K_AND }, { OR8, K_OR }, { NOR8, K_NOR }, { NAND8, K_NAND }, { XOR8, K_XOR },
+  { NOT8, K_NOT }, { NEG8, K_NEG }, { INC8, K_INC }, { DEC8, K_DEC }, { EQU8, K_EQU },
+};
+
+static int kindOf(unsigned int op, uint32_t* size) {
+  for(size_t i = 0; i < sizeof(families) / sizeof(families[0]); i++) {
+    if(op >= families[i].op8 && op < families[i].op8 + 3u) {
+      *size = 1u << (op - families[i].op8);
+      return families[i].kind;
+    }
+  }
+  return K_NONE;
+}
+
+static int isTerminator(unsigned int op) {
+  return (op >= JMP && op <= JMPNN) || (op >= BR && op <= BRNN) || op == CALL || op == RET ||
+         (op >= END && op <= ENDN);
+}
+
+static int supported(unsigned int op) {
+  uint32_t size;
+  return kindOf(op, &size) != K_NONE || op == PPTR || isTerminator(op);
+}
+
+// ---- one block ----
+
+// registers that hold values; none of them is touched by div or shifts, and
+// no operation holds more than two of them outside the stacks at once
+static const int pool[] = { RSI, RDI, R8, R9, R10, R11 };
+#define POOL (sizeof(pool) / sizeof(pool[0]))
+#define MAX_PENDING 8 // values per stack not yet stored
+
+typedef struct {
+  uint8_t inReg; // else a constant
+  uint8_t reg;
+  uint8_t size;
+  uint32_t imm;
+} Value;
+
+typedef struct {
+  Value value;
+  int32_t at; // offset from the entry stack pointer it belongs at
+} Pending;
+
+typedef struct {
+  Asm* a;
+  const Program* prog;
+  const uint8_t* native; // records that start a block
+  const uint32_t* entry; // Jit.entry, filled in as the blocks are compiled
+  size_t exit; // the trampoline's exit
+  // the top MAX_PENDING values of each stack may still be in registers or
+  // constants, bottom first
+  Pending pending[NUM_STACKS][MAX_PENDING];
+  int count[NUM_STACKS];
+  int32_t top[NUM_STACKS]; // stack pointers, relative to their entry values
+  uint16_t busy; // registers in use
+  int flagsPending; // ebp is stale, the flags are those of flagsValue
+  int32_t flagsValue;
+} Block;
+
+static void release(Block* b, Value v) {
+  if(v.inReg)
+    b->busy &= ~(1u << v.reg);
+}
+
+static void store(Block* b, int s, const Pending* p) {
+  Asm* a = b->a;
+  if(p->value.inReg) {
+    if(p->value.size == 1)
+      rm(a, REG8, 0x88, p->value.reg, SP_REG(s), p->at);
+    else
+      rm(a, p->value.size == 2 ? P66 : 0, 0x89, p->value.reg, SP_REG(s), p->at);
+  } else if(p->value.size == 1) {
+    rm(a, 0, 0xc6, 0, SP_REG(s), p->at);
+    byte(a, p->value.imm);
+  } else if(p->value.size == 2) {
+    rm(a, P66, 0xc7, 0, SP_REG(s), p->at);
+    word(a, p->value.imm);
+  } else {
+    rm(a, 0, 0xc7, 0, SP_REG(s), p->at);
+    dword(a, p->value.imm);
+  }
+}
+
+// stores the bottom n pending values of stack s
+static void flushBottom(Block* b, int s, int n) {
+  for(int i = 0; i < n; i++) {
+    store(b, s, &b->pending[s][i]);
+    release(b, b->pending[s][i].value);
+  }
+  memmove(&b->pending[s][0], &b->pending[s][n], (b->count[s] - n) * sizeof(Pending));
+  b->count[s] -= n;
+}
+
+static void flush(Block* b, int s) {
+  flushBottom(b, s, b->count[s]);
+}
+
+// Returns a free register, storing pending values to free one if need be. If
+// none can be freed the block can't be compiled, and the whole program is
+// left to the interpreter.
+static int allocReg(Block* b) {
+  for(;;) {
+    for(size_t i = 0; i < POOL; i++) {
+      if(!(b->busy & 1u << pool[i])) {
+        b->busy |= 1u << pool[i];
+        return pool[i];
+      }
+    }
+    // all taken: store the lowest pending value that holds one
+    int spilled = 0;
+    for(int s = 0; s < NUM_STACKS && !spilled; s++) {
+      for(int i = 0; i < b->count[s]; i++) {
+        if(b->pending[s][i].value.inReg) {
+          flushBottom(b, s, i + 1);
+          spilled = 1;
+          break;
+        }
+      }
+    }
+    if(!spilled) {
+      b->a->failed = 1;
+      return pool[0]; // never run: jitCompile() throws the code away
+    }
+  }
+}
+
+static Value constant(uint32_t imm, uint32_t size) {
+  return (Value){ .inReg = 0, .imm = imm, .size = size };
+}
+
+static Value inReg(int reg, uint32_t size) {
+  return (Value){ .inReg = 1, .reg = reg, .size = size };
+}
+
+static void toReg(Block* b, Value* v) {
+  if(v->inReg)
+    return;
+  int r = allocReg(b);
+  movRI(b->a, r, v->imm);
+  *v = inReg(r, v->size);
+}
+
+static void push(Block* b, int s, Value v) {
+  if(b->count[s] == MAX_PENDING)
+    flushBottom(b, s, 1);
+  b->pending[s][b->count[s]++] = (Pending){ v, b->top[s] };
+  b->top[s] += v.size;
+}
+
+static Value load(Block* b, int s, uint32_t size) {
+  if(b->count[s])
+    flush(b, s); // the top is wider or narrower than asked for
+  int r = allocReg(b);
+  int32_t at = b->top[s] - size;
+  if(size == 1)
+    rm(b->a, 0, 0x0fb6, r, SP_REG(s), at);
+  else if(size == 2)
+    rm(b->a, 0, 0x0fb7, r, SP_REG(s), at);
+  else
+    rm(b->a, 0, 0x8b, r, SP_REG(s), at);
+  return inReg(r, size);
+}
+
+static Value pop(Block* b, int s, uint32_t size) {
+  Value v;
+  if(b->count[s] && b->pending[s][b->count[s] - 1].value.size == size)
+    v = b->pending[s][--b->count[s]].value;
+  else
+    v = load(b, s, size);
+  b->top[s] -= size;
+  return v;
+}
+
+static Value peek(Block* b, int s, uint32_t size) {
+  if(b->count[s] && b->pending[s][b->count[s] - 1].value.size == size) {
+    Value v = b->pending[s][b->count[s] - 1].value;
+    if(!v.inReg)
+      return v;
+    int r = allocReg(b);
+    movRR(b->a, r, v.reg);
+    return inReg(r, size);
+  }
+  return load(b, s, size);
+}
+
+// flags of a result in register r: sign-extended from size bits if the
+// handler in run() keeps it in a signed type, zero-extended otherwise
+static void flagsFrom(Block* b, int r, uint32_t size, int isSigned) {
+  if(isSigned)
+    signExtend(b->a, RBP, r, size);
+  else
+    movRR(b->a, RBP, r);
+  b->flagsPending = 0;
+}
+
+static void flagsConstant(Block* b, int32_t value) {
+  b->flagsPending = 1;
+  b->flagsValue = value;
+}
+
+static uint32_t mask(uint32_t size) {
+  return size == 4 ? UINT32_MAX : (1u << size * 8) - 1;
+}
+
+static int32_t signExtended(uint32_t v, uint32_t size) {
+  if(size == 1)
+    return (int8_t)v;
+  if(size == 2)
+    return (int16_t)v;
+  return (int32_t)v;
+}
+
+// stores everything and moves the stack pointers to where the block left them
+static void settle(Block* b) {
+  for(int s = 0; s < NUM_STACKS; s++) {
+    flush(b, s);
+    if(b->top[s]) {
+      rr(b->a, W, 0x81, ALU_ADD >> 3, SP_REG(s)); // a pointer: all 64 bits
+      dword(b->a, b->top[s]);
+    }
+    b->top[s] = 0;
+  }
+  if(b->flagsPending)
+    movRI(b->a, RBP, b->flagsValue);
+  b->flagsPending = 0;
+}
+
+static void exitAt(Block* b, uint32_t pc, int status) {
+  rm(b->a, 0, 0xc7, 0, -1, VM_PC);
+  dword(b->a, pc);
+  movRI(b->a, RAX, status);
+  jmpTo(b->a, b->exit);
+}
+
+// Takes n off VM.budget, for a branch back, like the interpreter does. If that
+// uses it up, leaves for byte pc with JIT_YIELD.
+static void charge(Block* b, uint32_t n, uint32_t pc) {
+  rm(b->a, W, 0x81, ALU_SUB >> 3, -1, VM_BUDGET);
+  dword(b->a, n);
+  size_t left = jcc(b->a, CC_G);
+  exitAt(b, pc, JIT_YIELD);
+  land(b->a, left);
+}
+
+// the same for a jump from byte pc from to the byte pc in reg, if it goes back
+static void chargeTo(Block* b, int reg, uint32_t from) {
+  Asm* a = b->a;
+  movRI(a, RAX, from);
+  aluRR(a, ALU_SUB, RAX, reg);
+  size_t ahead = jcc(a, CC_B);
+  rr(a, 0, 0xd1, 5, RAX); // shr eax, 1
+  rr(a, 0, 0xff, 0, RAX); // inc
+  rm(a, W, ALU_SUB, RAX, -1, VM_BUDGET);
+  size_t left = jcc(a, CC_G);
+  rm(a, 0, 0x89, reg, -1, VM_PC);
+  movRI(a, RAX, JIT_YIELD);
+  jmpTo(a, b->exit);
+  land(a, ahead);
+  land(a, left);
+}
+
+typedef struct {
+  size_t at; // rel32 to patch
+  uint32_t record; // with the offset of this record's block
+} Fixup;
+
+typedef struct {
+  Fixup* items;
+  size_t count;
+  size_t capacity;
+} Fixups;
+
+static void addFixup(Asm* a, Fixups* f, size_t at, uint32_t record) {
+  if(f->count == f->capacity) {
+    size_t capacity = f->capacity ? f->capacity * 2 : 64;
+    Fixup* items = realloc(f->items, capacity * sizeof(Fixup));
+    if(items == NULL) {
+      a->failed = 1;
+      return;
+    }
+    f->items = items;
+    f->capacity = capacity;
+  }
+  f->items[f->count++] = (Fixup){ at, record };
+}
+
+// continues at record t, natively if it starts a block; next is the block
+// emitted right after this one, which needs no jump
+// (every sweep ends in an OP_RESYNC, so t is always a record)
+static void goTo(Block* b, Fixups* f, uint32_t t, uint32_t next) {
+  if(b->native[t]) {
+    if(t != next)
+      addFixup(b->a, f, jmp(b->a), t);
+  } else {
+    exitAt(b, b->prog->pcOf[t], JIT_EXIT);
+  }
+}
+
+// continues at record t if the condition holds
+static void branchTo(Block* b, Fixups* f, int cc, uint32_t t) {
+  if(b->native[t]) {
+    addFixup(b->a, f, jcc(b->a, cc), t);
+  } else {
+    size_t skip = jcc(b->a, cc ^ 1);
+    exitAt(b, b->prog->pcOf[t], JIT_EXIT);
+    land(b->a, skip);
+  }
+}
+
+// continues at the byte pc in v, jumping from byte pc from
+static void jumpTo(Block* b, Fixups* f, Value v, uint32_t from) {
+  const Program* prog = b->prog;
+  if(!v.inReg) {
+    uint32_t pc = v.imm;
+    if(pc <= from)
+      charge(b, (from - pc) / 2 + 1, pc);
+    if(pc < prog->size && prog->index[pc] && b->native[prog->index[pc] - 1])
+      addFixup(b->a, f, jmp(b->a), prog->index[pc] - 1);
+    else
+      exitAt(b, pc, JIT_EXIT);
+    return;
+  }
+  chargeTo(b, v.reg, from);
+  rm(b->a, 0, 0x89, v.reg, -1, VM_PC);
+  movRI(b->a, RAX, JIT_EXIT);
+  jmpTo(b->a, b->exit);
+}
+
+static void movRI64(Asm* a, int dst, uint64_t imm) {
+  byte(a, 0x48 | (dst & 8) >> 3);
+  byte(a, 0xb8 + (dst & 7));
+  dword(a, imm);
+  dword(a, imm >> 32);
+}
+
+// pushes the return byte pc of the CALL at record i and goes to its target;
+// a full return stack is left for the interpreter to report
+static void call(Block* b, Fixups* f, uint32_t i, uint32_t next) {
+  Asm* a = b->a;
+  const Insn* insn = &b->prog->code[i];
+  rm(a, 0, 0x8b, RAX, -1, VM_CALL_DEPTH);
+  aluRI(a, ALU_CMP, RAX, CALL_DEPTH);
+  size_t room = jcc(a, CC_B);
+  exitAt(b, b->prog->pcOf[i], JIT_BAIL);
+  land(a, room);
+  rm(a, W, 0x8b, RCX, -1, VM_CALLS);
+  static const uint8_t storeReturn[] = { 0xc7, 0x04, 0x81 }; // mov dword [rcx + rax*4], imm32
+  put(a, storeReturn, sizeof(storeReturn));
+  dword(a, insn->imm);
+  rr(a, 0, 0xff, 0, RAX); // inc
+  rm(a, 0, 0x89, RAX, -1, VM_CALL_DEPTH);
+  if(insn->target <= 0)
+    charge(b, 1 - insn->target, b->prog->pcOf[i + insn->target]);
+  goTo(b, f, i + insn->target, next);
+}
+
+// pops a return byte pc and jumps straight to the block there, if there is
+// one; an empty return stack is left for the interpreter to report
+static void ret(Block* b, uint32_t i) {
+  Asm* a = b->a;
+  const Program* prog = b->prog;
+  rm(a, 0, 0x8b, RAX, -1, VM_CALL_DEPTH);
+  rr(a, 0, 0x85, RAX, RAX);
+  size_t some = jcc(a, CC_NZ);
+  exitAt(b, prog->pcOf[i], JIT_BAIL);
+  land(a, some);
+  rr(a, 0, 0xff, 1, RAX); // dec
+  rm(a, 0, 0x89, RAX, -1, VM_CALL_DEPTH);
+  rm(a, W, 0x8b, RCX, -1, VM_CALLS);
+  static const uint8_t loadReturn[] = { 0x8b, 0x0c, 0x81 }; // mov ecx, [rcx + rax*4]
+  put(a, loadReturn, sizeof(loadReturn));
+  rm(a, 0, 0x89, RCX, -1, VM_PC);
+  chargeTo(b, RCX, prog->pcOf[i]);
+  // a snapshot may have put any byte pc there
+  aluRI(a, ALU_CMP, RCX, prog->size);
+  size_t outside = jcc(a, CC_AE);
+  movRI64(a, RDX, (uintptr_t)prog->index);
+  static const uint8_t loadIndex[] = { 0x8b, 0x14, 0x8a }; // mov edx, [rdx + rcx*4]
+  put(a, loadIndex, sizeof(loadIndex));
+  rr(a, 0, 0x85, RDX, RDX);
+  size_t noRecord = jcc(a, CC_Z);
+  movRI64(a, RCX, (uintptr_t)b->entry);
+  static const uint8_t loadEntry[] = { 0x8b, 0x54, 0x91, 0xfc }; // mov edx, [rcx + rdx*4 - 4]
+  put(a, loadEntry, sizeof(loadEntry));
+  rr(a, 0, 0x85, RDX, RDX);
+  size_t noBlock = jcc(a, CC_Z);
+  static const uint8_t leaCode[] = { 0x48, 0x8d, 0x0d }; // lea rcx, [rip + disp32], the code's start
+  put(a, leaCode, sizeof(leaCode));
+  dword(a, -(uint32_t)(a->size + 4));
+  rr(a, W, 0x01, RCX, RDX); // add
+  rr(a, 0, 0xff, 4, RDX); // jmp rdx
+  land(a, outside);
+  land(a, noRecord);
+  land(a, noBlock);
+  movRI(a, RAX, JIT_EXIT);
+  jmpTo(a, b->exit);
+}
+
+static void binary(Block* b, int kind, const Insn* insn, uint32_t size) {
+  Asm* a = b->a;
+  Value y = pop(b, insn->source, size), x = pop(b, insn->source, size);
+  int isSigned = (kind == K_SL || kind == K_SSR) && size < 4;
+  if(!x.inReg && !y.inReg && !((kind == K_DIV || kind == K_MOD) && y.imm == 0)) {
+    uint32_t r = 0;
+    switch(kind) {
+      case K_ADD: r = x.imm + y.imm; break;
+      case K_SUB: r = x.imm - y.imm; break;
+      case K_MUL: r = x.imm * y.imm; break;
+      case K_DIV: r = x.imm / y.imm; break;
+      case K_MOD: r = x.imm % y.imm; break;
+      case K_SR: r = x.imm >> (y.imm & 31); break;
+      case K_SL: r = x.imm << (y.imm & 31); break;
+      case K_SSR: r = (uint32_t)(signExtended(x.imm, size) >> (y.imm & 31)); break;
+      case K_AND: r = x.imm & y.imm; break;
+      case K_OR: r = x.imm | y.imm; break;
+      case K_NOR: r = ~(x.imm | y.imm); break;
+      case K_NAND: r = ~(x.imm & y.imm); break;
+      case K_XOR: r = x.imm ^ y.imm; break;
+    }
+    r &= mask(size);
+    push(b, insn->destination, constant(r, size));
+    flagsConstant(b, isSigned ? signExtended(r, size) : (int32_t)r);
+    return;
+  }
+
+  toReg(b, &x);
+  int r = x.reg;
+  switch(kind) {
+    case K_ADD:
+    case K_SUB:
+    case K_AND:
+    case K_OR:
+    case K_XOR:
+    case K_NOR:
+    case K_NAND:
+    {
+      unsigned int op = kind == K_ADD ? ALU_ADD : kind == K_SUB ? ALU_SUB :
+                        kind == K_AND || kind == K_NAND ? ALU_AND :
+                        kind == K_XOR ? ALU_XOR : ALU_OR;
+      if(y.inReg)
+        aluRR(a, op, r, y.reg);
+      else
+        aluRI(a, op, r, y.imm);
+      if(kind == K_NOR || kind == K_NAND)
+        rr(a, 0, 0xf7, 2, r); // not
+      break;
+    }
+    case K_MUL:
+      if(y.inReg) {
+        rr(a, 0, 0x0faf, r, y.reg);
+      } else {
+        rr(a, 0, 0x69, r, r);
+        dword(a, y.imm);
+      }
+      break;
+    case K_DIV:
+    case K_MOD:
+      // division by zero traps, as it does in run()
+      movRR(a, RAX, r);
+      aluRR(a, ALU_XOR, RDX, RDX);
+      if(y.inReg) {
+        rr(a, 0, 0xf7, 6, y.reg);
+      } else {
+        movRI(a, RCX, y.imm);
+        rr(a, 0, 0xf7, 6, RCX);
+      }
+      movRR(a, r, kind == K_DIV ? RAX : RDX);
+      break;
+    case K_SR:
+    case K_SL:
+    case K_SSR:
+    {
+      int ext = kind == K_SR ? 5 : kind == K_SL ? 4 : 7;
+      if(kind == K_SSR)
+        signExtend(a, r, r, size);
+      if(y.inReg) {
+        movRR(a, RCX, y.reg);
+        rr(a, 0, 0xd3, ext, r);
+      } else {
+        rr(a, 0, 0xc1, ext, r);
+        byte(a, y.imm);
+      }
+      break;
+    }
+  }
+  release(b, y);
+  if(isSigned) {
+    flagsFrom(b, r, size, 1);
+    zeroExtend(a, r, size);
+  } else {
+    zeroExtend(a, r, size);
+    flagsFrom(b, r, size, 0);
+  }
+  push(b, insn->destination, x);
+}
+
+static void unary(Block* b, int kind, const Insn* insn, uint32_t size) {
+  Value x = pop(b, insn->source, size);
+  int isSigned = kind == K_NEG && size < 4;
+  if(!x.inReg) {
+    uint32_t r = (kind == K_NOT ? ~x.imm : -x.imm) & mask(size);
+    push(b, insn->destination, constant(r, size));
+    flagsConstant(b, isSigned ? signExtended(r, size) : (int32_t)r);
+    return;
+  }
+  rr(b->a, 0, 0xf7, kind == K_NOT ? 2 : 3, x.reg);
+  if(isSigned) {
+    flagsFrom(b, x.reg, size, 1);
+    zeroExtend(b->a, x.reg, size);
+  } else {
+    zeroExtend(b->a, x.reg, size);
+    flagsFrom(b, x.reg, size, 0);
+  }
+  push(b, insn->destination, x);
+}
+
+static void step(Block* b, int kind, const Insn* insn, uint32_t size) {
+  // run() peeks and pokes; popping and pushing back is the same thing here
+  Value x = pop(b, insn->source, size);
+  if(!x.inReg) {
+    uint32_t r = (kind == K_INC ? x.imm + 1 : x.imm - 1) & mask(size);
+    push(b, insn->source, constant(r, size));
+    flagsConstant(b, r);
+    return;
+  }
+  aluRI(b->a, kind == K_INC ? ALU_ADD : ALU_SUB, x.reg, 1);
+  zeroExtend(b->a, x.reg, size);
+  flagsFrom(b, x.reg, size, 0);
+  push(b, insn->source, x);
+}
+
+static void equ(Block* b, const Insn* insn, uint32_t size) {
+  Value y = pop(b, insn->source, size), x = pop(b, insn->source, size);
+  if(size == 4) // run() truncates the operand on top to 8 bits
+    y.imm &= 0xff;
+  if(!x.inReg && !y.inReg) {
+    flagsConstant(b, x.imm - y.imm);
+    return;
+  }
+  if(x.inReg)
+    movRR(b->a, RBP, x.reg);
+  else
+    movRI(b->a, RBP, x.imm);
+  if(y.inReg) {
+    if(size == 4)
+      zeroExtend(b->a, y.reg, 1);
+    aluRR(b->a, ALU_SUB, RBP, y.reg);
+  } else {
+    aluRI(b->a, ALU_SUB, RBP, y.imm);
+  }
+  b->flagsPending = 0;
+  release(b, x);
+  release(b, y);
+}
+
+static int conditionOf(unsigned int op) {
+  switch(op) {
+    case BRZ: case JMPZ: case ENDZ: return CC_Z;
+    case BRNZ: case JMPNZ: return CC_NZ;
+    case BRN: case JMPN: case ENDN: return CC_S;
+    default: return CC_NS;
+  }
+}
+
+// Compiles the block of records [first, last] and its stack checks, and
+// returns where it starts.
+static size_t compileBlock(Block* b, Fixups* f, Fixups* bails, uint32_t first, uint32_t last, uint32_t next) {
+  Asm* a = b->a;
+  const Program* prog = b->prog;
+
+  int32_t cur[NUM_STACKS] = {0}, need[NUM_STACKS] = {0}, high[NUM_STACKS] = {0};
+  int pushes[NUM_STACKS] = {0};
+  for(uint32_t i = first; i <= last; i++) {
+    StackAccess acc[4];
+    int n = stackAccesses(&prog->code[i], acc);
+    for(int k = 0; k < n; k++) {
+      int s = acc[k].stack;
+      if(acc[k].kind == ACCESS_PUSH) {
+        if(cur[s] + acc[k].size > high[s])
+          high[s] = cur[s] + acc[k].size;
+        pushes[s] = 1;
+        cur[s] += acc[k].size;
+      } else {
+        if(acc[k].size - cur[s] > need[s])
+          need[s] = acc[k].size - cur[s];
+        if(acc[k].kind == ACCESS_POP)
+          cur[s] -= acc[k].size;
+      }
+    }
+  }
+  // the ways out if a check fails all go after the last block
+  size_t entry = a->size;
+  for(int s = 0; s < NUM_STACKS; s++) {
+    if(need[s] > 0) {
+      rm(a, W, 0x8d, RCX, SP_REG(s), -need[s]); // lea rcx, [top - need]
+      rm(a, W, 0x3b, RCX, -1, VM_STACKS(s)); // cmp rcx, [bottom]
+      addFixup(a, bails, jcc(a, CC_B), first);
+    }
+    if(pushes[s]) {
+      rm(a, W, 0x8d, RCX, SP_REG(s), high[s]);
+      rm(a, W, 0x3b, RCX, -1, VM_STACK_END(s));
+      addFixup(a, bails, jcc(a, CC_AE), first);
+    }
+  }
+
+  memset(b->count, 0, sizeof(b->count));
+  memset(b->top, 0, sizeof(b->top));
+  b->busy = 0;
+  b->flagsPending = 0;
+  for(uint32_t i = first; i <= last; i++) {
+    const Insn* insn = &prog->code[i];
+    uint32_t size;
+    int kind = kindOf(insn->op, &size);
+    switch(kind) {
+      case K_LET:
+        push(b, insn->destination, constant(insn->imm & mask(size), size));
+        break;
+      case K_CPY:
+        push(b, insn->destination, peek(b, insn->source, size));
+        break;
+      case K_MOV:
+        push(b, insn->destination, pop(b, insn->source, size));
+        break;
+      case K_SWP:
+      {
+        Value x = pop(b, insn->source, size);
+        Value y = pop(b, insn->destination, size);
+        push(b, insn->source, y);
+        push(b, insn->destination, x);
+        break;
+      }
+      case K_DEL:
+        release(b, pop(b, insn->source, size));
+        break;
+      case K_NOT:
+      case K_NEG:
+        unary(b, kind, insn, size);
+        break;
+      case K_INC:
+      case K_DEC:
+        step(b, kind, insn, size);
+        break;
+      case K_EQU:
+        equ(b, insn, size);
+        break;
+      case K_NONE:
+        break;
+      default:
+        binary(b, kind, insn, size);
+        break;
+    }
+    if(kind != K_NONE)
+      continue;
+
+    if(insn->op == PPTR) {
+      push(b, insn->destination, constant(insn->imm, 4));
+    } else if(insn->op >= BR && insn->op <= BRNN) {
+      settle(b);
+      uint32_t t = i + insn->target;
+      if(insn->op == BR) {
+        if(t <= i)
+          charge(b, i - t + 1, prog->pcOf[t]);
+        goTo(b, f, t, next);
+      } else {
+        rr(a, 0, 0x85, RBP, RBP);
+        if(t <= i) {
+          size_t skip = jcc(a, conditionOf(insn->op) ^ 1);
+          charge(b, i - t + 1, prog->pcOf[t]);
+          goTo(b, f, t, next);
+          land(a, skip);
+        } else {
+          branchTo(b, f, conditionOf(insn->op), t);
+        }
+        goTo(b, f, i + 1, next);
+      }
+      break;
+    } else if(insn->op >= JMP && insn->op <= JMPNN) {
+      Value to = pop(b, insn->source, 4);
+      settle(b);
+      if(insn->op == JMP) {
+        jumpTo(b, f, to, prog->pcOf[i]);
+      } else {
+        rr(a, 0, 0x85, RBP, RBP);
+        size_t skip = jcc(a, conditionOf(insn->op) ^ 1);
+        jumpTo(b, f, to, prog->pcOf[i]);
+        land(a, skip);
+        goTo(b, f, i + 1, next);
+      }
+      release(b, to);
+      break;
+    } else if(insn->op == CALL) {
+      settle(b);
+      call(b, f, i, next);
+      break;
+    } else if(insn->op == RET) {
+      settle(b);
+      ret(b, i);
+      break;
+    } else if(insn->op >= END && insn->op <= ENDN) {
+      settle(b);
+      size_t skip = 0;
+      if(insn->op != END) {
+        rr(a, 0, 0x85, RBP, RBP);
+        skip = jcc(a, conditionOf(insn->op) ^ 1);
+      }
+      movRI(a, RAX, JIT_END);
+      jmpTo(a, b->exit);
+      if(insn->op != END) {
+        land(a, skip);
+        goTo(b, f, i + 1, next);
+      }
+      break;
+    }
+  }
+  if(!isTerminator(prog->code[last].op)) {
+    settle(b);
+    goTo(b, f, last + 1, next);
+  }
+  return entry;
+}
+
+int jitCompile(Program* p) {
+  p->jit = NULL;
+  if(p->length == 0)
+    return 0;
+  Jit* jit = calloc(1, sizeof(Jit));
+  uint8_t* leader = calloc(p->length, 1);
+  uint8_t* native = calloc(p->length, 1);
+  Asm a = {0};
+  Fixups fixups = {0}, bails = {0};
+  if(jit == NULL || leader == NULL || native == NULL)
+    goto fail;
+  jit->entry = calloc(p->length, sizeof(uint32_t));
+  if(jit->entry == NULL)
+    goto fail;
+
+  // blocks start at the program's start, at branch targets and wherever
+  // control comes back from something else
+  leader[0] = 1;
+  for(uint32_t i = 0; i < p->length; i++) {
+    const Insn* insn = &p->code[i];
+    if((insn->op >= BR && insn->op <= BRNN) || insn->op == CALL)
+      leader[i + insn->target] = 1;
+    if((isTerminator(insn->op) || !supported(insn->op)) && i + 1 < p->length)
+      leader[i + 1] = 1;
+  }
+  for(uint32_t i = 0; i < p->length; i++)
+    native[i] = leader[i] && supported(p->code[i].op);
+
+  Block b = { .a = &a, .prog = p, .native = native, .entry = jit->entry };
+  b.exit = emitTrampoline(&a);
+  for(uint32_t i = 0; i < p->length; i++) {
+    if(!native[i])
+      continue;
+    uint32_t last = i;
+    while(!isTerminator(p->code[last].op) && last + 1 < p->length &&
+          !leader[last + 1] && supported(p->code[last + 1].op))
+      last++;
+    uint32_t next = last + 1;
+    while(next < p->length && !native[next])
+      next++;
+    jit->entry[i] = compileBlock(&b, &fixups, &bails, i, last, next);
+    i = last;
+  }
+  size_t stub = 0;
+  for(size_t k = 0; k < bails.count; k++) {
+    if(k == 0 || bails.items[k].record != bails.items[k - 1].record) {
+      stub = a.size;
+      exitAt(&b, p->pcOf[bails.items[k].record], JIT_BAIL);
+    }
+    size_t at = bails.items[k].at;
+    patch32(&a, at, stub - (at + 4));
+  }
+  for(size_t k = 0; k < fixups.count; k++) {
+    size_t at = fixups.items[k].at;
+    patch32(&a, at, jit->entry[fixups.items[k].record] - (at + 4));
+  }
+  if(a.failed)
+    goto fail;
+
+  jit->size = a.size;
+  void* code = mmap(NULL, a.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if(code == MAP_FAILED)
+    goto fail;
+  memcpy(code, a.bytes, a.size);
+  if(mprotect(code, a.size, PROT_READ | PROT_EXEC)) {
+    munmap(code, a.size);
+    goto fail;
+  }
+  jit->code = code;
+  p->jit = jit;
+  free(a.bytes);
+  free(fixups.items);
+  free(bails.items);
+  free(leader);
+  free(native);
+  return 0;
+
+fail:
+  if(jit)
+    free(jit->entry);
+  free(jit);
+  free(a.bytes);
+  free(fixups.items);
+  free(bails.items);
+  free(leader);
+  free(native);
+  return -1;
+}
+
+void jitFree(Program* p) {
+  if(p->jit == NULL)
+    return;
+  munmap(p->jit->code, p->jit->size);
+  free(p->jit->entry);
+  free(p->jit);
+  p->jit = NULL;
+}
+
+int jitEnter(VM* vm) {
+  const Program* prog = vm->program;
+  const Jit* jit = prog->jit;
+  if(jit == NULL || vm->pc >= prog->size || !prog->index[vm->pc])
+    return JIT_NONE;
+  uint32_t at = jit->entry[prog->index[vm->pc] - 1];
+  if(!at || vm->flags == INT64_MIN)
+    return JIT_NONE;
+  int32_t flags = (int32_t)vm->flags;
+  int (*enter)(VM*, int32_t, const void*) = (int (*)(VM*, int32_t, const void*))(void*)jit->code;
+  return enter(vm, flags, jit->code + at);
+}
+
+#else
+
+int jitCompile(Program* p) {
+  p->jit = NULL;
+  return -1;
+}
+
+void jitFree(Program* p) {
+  (void)p;
+}
+
+int jitEnter(VM* vm) {
+  (void)vm;
+  return JIT_NONE;
+}
+
+#endif
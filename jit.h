@@ -0,0 +1,34 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vm.h"
+
+// Native code for one Program, shared read-only by every VM that runs it.
+typedef struct Jit {
+  uint8_t* code; // executable mapping
+  size_t size;
+  uint32_t* entry; // offset in code of the block each record starts, 0 for none
+} Jit;
+
+// how a trip through native code ended
+enum {
+  JIT_NONE, // there is no native code at vm->pc; nothing ran
+  JIT_EXIT, // continue at vm->pc
+  JIT_BAIL, // vm->pc starts a block that would fault somewhere; interpret it
+  JIT_END, // the program ended
+  JIT_YIELD, // VM.budget ran out at a branch back to vm->pc
+};
+
+// Compiles p to native code and attaches it as p->jit. Returns 0, or -1 if
+// this platform has no JIT, memory ran out or a block ran out of registers;
+// p->jit stays NULL then, and MODE_JIT runs everything in the interpreter.
+// programFree() calls jitFree().
+int jitCompile(Program* p);
+void jitFree(Program* p);
+
+// Runs native code from vm->pc for as long as there is some.
+int jitEnter(VM* vm);
+
+#endif
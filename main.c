@@ -0,0 +1,431 @@
+/*
+Command line front end for the CLAW virtual machine.
+
+  vm [-j threads] [-n copies] [--tos-cache | --jit] [--no-fuse] [--no-verify]
+     [--profile out [--profile-cycles] | --batch]
+     [--restore file] [--snapshot-at pc [--save-snapshot file]]
+     [--stack-size n[,n,n,n]] [--frames file [--frame-format f]]
+     [--virtual-time] [--slice n] program...
+
+A single program runs on the calling thread, as it always has. Several
+programs, or -n copies of each, go through the thread pool in runner.c with
+one worker per online CPU unless -j says otherwise. Their output interleaves.
+--tos-cache runs the interpreter that keeps the top stack element in a register.
+--jit compiles each program to native code first, where the platform allows,
+and interprets whatever it doesn't cover.
+Common instruction pairs run as superinstructions unless --no-fuse is given
+(the JIT compiles the pairs as they are). Programs that provably never
+under- or overflow a stack run without stack checks in the default mode unless
+--no-verify is given.
+--profile runs a single program traced and unfused, and writes out.json (counts
+per opcode and pc, and branch outcomes) and out.folded (folded stacks for flame
+graphs); --profile-cycles adds cycle counts where the CPU has a cheap counter.
+--batch runs a single program once per line of stdin, with that line as its
+input, and frames each run's output and status on stdout (see batch.h).
+--snapshot-at runs a single program up to byte pc and snapshots it there (see
+snapshot.h); --save-snapshot writes that to a file and stops, otherwise the
+run (or, with --batch, every run) carries on from the snapshot. --restore
+starts from a saved snapshot instead of from the beginning.
+--stack-size gives every stack, or each of A, B, C and D, that many bytes
+instead of STACK_SIZE.
+--frames writes every frame a single program shows with SWBUFF to a file, one
+after another: binary PPM images, or with --frame-format raw the framebuffer
+bytes as screen.h lays them out. The rects and xor formats only write what
+changed since the frame before (see screenWriteRects() and screenWriteXor()).
+SLEEP waits on the clock. Through the thread pool, a worker runs other
+programs while one sleeps (see scheduler.c). --virtual-time makes sleeps take
+no time at all: a single program's SLEEPs return at once, and in the pool they
+only order its programs' wakeups.
+--slice has the pool run programs n instructions at a time (see vmRunFor()),
+taking turns, so that programs that run long, or never end, don't keep the
+others from starting. Idle workers steal runnable programs from busy ones.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "vm.h"
+#include "runner.h"
+#include "jit.h"
+#include "image.h"
+#include "profile.h"
+#include "batch.h"
+#include "snapshot.h"
+
+static void reportError(RuntimeError error, uint32_t pc) {
+  switch(error) {
+    case ERR_ARITHMETIC:
+      printf("Runtime error: arithmetic exception at PC %x\n", pc);
+      break;
+    case ERR_STACK_UNDERFLOW:
+      printf("Runtime error: stack underflow at PC %x\n", pc);
+      break;
+    case ERR_STACK_OVERFLOW:
+      printf("Runtime error: stack overflow at PC %x\n", pc);
+      break;
+    case ERR_INSUFFICIENT_PERMISSIONS:
+      printf("Runtime error: insufficient permissions at PC %x\n", pc);
+      break;
+    case ERR_TARGET:
+      printf("Runtime error: target %x out of bounds\n", pc);
+      break;
+    case ERR_END_OF_INPUT:
+      printf("Runtime error: end of input at PC %x\n", pc);
+      break;
+    case ERR_MALFORMED_INPUT:
+      printf("Runtime error: malformed input at PC %x\n", pc);
+      break;
+    case ERR_CALL_OVERFLOW:
+      printf("Runtime error: calls nested too deep at PC %x\n", pc);
+      break;
+    case ERR_CALL_UNDERFLOW:
+      printf("Runtime error: return without call at PC %x\n", pc);
+      break;
+    default:
+      break;
+  }
+}
+
+// --frame-format
+enum { FRAMES_PPM, FRAMES_RAW, FRAMES_RECTS, FRAMES_XOR };
+static const char* const frameFormats[] = { "ppm", "raw", "rects", "xor" };
+#define FRAME_FORMATS (int)(sizeof(frameFormats) / sizeof(frameFormats[0]))
+
+// where --frames go
+typedef struct {
+  FILE* f;
+  int format;
+  int failed;
+  uint32_t count; // frames so far; the first of an incremental stream is whole
+  uint8_t last[SCREEN_BYTES]; // for FRAMES_XOR
+} FrameFile;
+
+static void writeFrame(void* arg, const Screen* screen) {
+  FrameFile* out = arg;
+  if(out->failed)
+    return;
+  int full = out->count++ == 0;
+  switch(out->format) {
+    case FRAMES_PPM: out->failed = screenWritePpm(screen->front, out->f); break;
+    case FRAMES_RAW: out->failed = screenWriteRaw(screen->front, out->f); break;
+    case FRAMES_RECTS: out->failed = screenWriteRects(screen, full, out->f); break;
+    case FRAMES_XOR: out->failed = screenWriteXor(screen, out->last, full, out->f); break;
+  }
+}
+
+// writes out.json and out.folded
+static int writeProfile(const Profile* profile, const char* out, const char* name) {
+  size_t length = strlen(out);
+  char* path = malloc(length + sizeof(".folded"));
+  if(path == NULL) {fputs ("Memory error",stderr); exit (2);}
+  int result = 0;
+  for(int folded = 0; folded < 2 && !result; folded++) {
+    strcpy(path, out);
+    strcpy(path + length, folded ? ".folded" : ".json");
+    FILE* f = fopen(path, "w");
+    if(f == NULL) {
+      printf("Error opening %s\n", path);
+      result = -1;
+      break;
+    }
+    result = folded ? profileWriteFolded(profile, f, name) : profileWriteJson(profile, f, name);
+    if(fclose(f) || result) {
+      printf("Error writing %s\n", path);
+      result = -1;
+    }
+  }
+  free(path);
+  return result;
+}
+
+// Runs program from start (or from the beginning, if NULL) to its breakpoint
+// and snapshots it there into start. Output goes to stdout, and GETN* reads
+// stdin unless batch is set, which leaves stdin to the records. Returns 0, or
+// -1 if the program ended first.
+static int runSetup(VM* vm, Program* program, ExecMode mode, SleepMode sleep, Snapshot* start, int haveStart, int batch) {
+  static const uint8_t none[1];
+  Input empty;
+  vmInit(vm, program);
+  vm->mode = mode;
+  vm->sleepMode = sleep;
+  if(haveStart) {
+    snapshotRestore(start, vm); // checked to fit by main()
+    snapshotFree(start);
+  }
+  if(batch) {
+    if(inputOpenBytes(&empty, none, 0)) {fputs ("Memory error",stderr); exit (2);}
+    vm->input = &empty;
+  }
+  RunStatus status = vmRun(vm);
+  if(batch) {
+    inputClose(&empty);
+    vm->input = NULL;
+  }
+  programUnbreak(program);
+  if(status != RUN_BREAK) {
+    reportError(vm->last_error, vm->pc);
+    printf("Program ended before reaching the snapshot pc\n");
+    return -1;
+  }
+  if(snapshotTake(start, vm)) {fputs ("Memory error",stderr); exit (2);}
+  return 0;
+}
+
+// n or n,n,n,n: the size of every stack or of each one
+static int parseStackSizes(const char* arg, uint32_t* sizes) {
+  char* end;
+  for(int i = 0; i < NUM_STACKS; i++) {
+    unsigned long size = strtoul(arg, &end, 0);
+    if(end == arg || size == 0 || size > MAX_STACK_SIZE)
+      return -1;
+    sizes[i] = size;
+    if(*end == '\0' && i == 0) {
+      for(int j = 1; j < NUM_STACKS; j++)
+        sizes[j] = size;
+      return 0;
+    }
+    if(*end != (i == NUM_STACKS - 1 ? '\0' : ','))
+      return -1;
+    arg = end + 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  /* PASTEBIN SAMPLE
+  LET8 A
+  .db8u(101)
+  LET8 A
+  .db8u(99)
+  ADD8 A
+  LET8 A
+  .db8u(200)
+  SUB8 A
+  BRZ A
+  .db16(2)
+  END
+  MOV8 A B
+  END
+  */
+  unsigned int threads = 0, copies = 1;
+  ExecMode mode = MODE_PLAIN;
+  int fuse = 1, verify = 1;
+  const char* profileOut = NULL;
+  int profileCycles = 0;
+  int batch = 0;
+  const char* restorePath = NULL;
+  const char* savePath = NULL;
+  const char* snapshotAt = NULL;
+  uint32_t stackSizes[NUM_STACKS];
+  const uint32_t* sizes = NULL; // STACK_SIZE each
+  const char* framesPath = NULL;
+  int frameFormat = FRAMES_PPM;
+  int virtualTime = 0;
+  uint64_t slice = 0; // no limit
+  int first = 1;
+  for(; first < argc && argv[first][0] == '-'; first++) {
+    if(!strcmp(argv[first], "-j") && first + 1 < argc)
+      threads = atoi(argv[++first]);
+    else if(!strcmp(argv[first], "-n") && first + 1 < argc)
+      copies = atoi(argv[++first]);
+    else if(!strcmp(argv[first], "--tos-cache"))
+      mode = MODE_TOS_CACHE;
+    else if(!strcmp(argv[first], "--jit"))
+      mode = MODE_JIT;
+    else if(!strcmp(argv[first], "--no-fuse"))
+      fuse = 0;
+    else if(!strcmp(argv[first], "--no-verify"))
+      verify = 0;
+    else if(!strcmp(argv[first], "--profile") && first + 1 < argc)
+      profileOut = argv[++first];
+    else if(!strcmp(argv[first], "--profile-cycles"))
+      profileCycles = 1;
+    else if(!strcmp(argv[first], "--batch"))
+      batch = 1;
+    else if(!strcmp(argv[first], "--restore") && first + 1 < argc)
+      restorePath = argv[++first];
+    else if(!strcmp(argv[first], "--snapshot-at") && first + 1 < argc)
+      snapshotAt = argv[++first];
+    else if(!strcmp(argv[first], "--save-snapshot") && first + 1 < argc)
+      savePath = argv[++first];
+    else if(!strcmp(argv[first], "--stack-size") && first + 1 < argc) {
+      if(parseStackSizes(argv[++first], stackSizes)) {
+        printf("Stack sizes are 1 to %u bytes: n or n,n,n,n\n", MAX_STACK_SIZE);
+        return 1;
+      }
+      sizes = stackSizes;
+    }
+    else if(!strcmp(argv[first], "--frames") && first + 1 < argc)
+      framesPath = argv[++first];
+    else if(!strcmp(argv[first], "--frame-format") && first + 1 < argc) {
+      const char* format = argv[++first];
+      for(frameFormat = 0; frameFormat < FRAME_FORMATS && strcmp(format, frameFormats[frameFormat]); frameFormat++)
+        ;
+      if(frameFormat == FRAME_FORMATS) {
+        printf("Frame formats are ppm, raw, rects and xor\n");
+        return 1;
+      }
+    }
+    else if(!strcmp(argv[first], "--virtual-time"))
+      virtualTime = 1;
+    else if(!strcmp(argv[first], "--slice") && first + 1 < argc)
+      slice = strtoull(argv[++first], NULL, 10);
+    else {
+      printf("Unknown option %s\n", argv[first]);
+      return 1;
+    }
+  }
+  if(first >= argc) {
+    printf("Give me an input file!\n");
+    return 1;
+  }
+
+  int count = argc - first;
+  if(profileOut && (count > 1 || copies > 1 || threads || mode != MODE_PLAIN)) {
+    printf("--profile runs a single program in the default mode\n");
+    return 1;
+  }
+  if(batch && (count > 1 || copies > 1 || threads || profileOut)) {
+    printf("--batch runs a single program\n");
+    return 1;
+  }
+  if((restorePath || snapshotAt) && (count > 1 || copies > 1 || threads)) {
+    printf("Snapshots are of a single program\n");
+    return 1;
+  }
+  if(framesPath && (count > 1 || copies > 1 || threads || batch)) {
+    printf("--frames runs a single program once\n");
+    return 1;
+  }
+  if(slice && (batch || (count == 1 && copies == 1 && threads == 0))) {
+    printf("--slice is for the thread pool: give -j, -n or several programs\n");
+    return 1;
+  }
+  if(savePath && !snapshotAt) {
+    printf("--save-snapshot needs --snapshot-at\n");
+    return 1;
+  }
+  if(profileOut)
+    fuse = 0; // count the instructions the program is made of
+  SleepMode sleep = virtualTime ? SLEEP_SKIP : SLEEP_WAIT; // outside the pool
+  Image* images = calloc(count, sizeof(Image));
+  Program* programs = calloc(count, sizeof(Program));
+  if(images == NULL || programs == NULL) {fputs ("Memory error",stderr); exit (2);}
+  for(int i = 0; i < count; i++) {
+    if(imageOpen(&images[i], argv[first + i])) {
+      printf("Error opening input file\n");
+      return 1;
+    }
+    if(programLoad(&programs[i], images[i].bytes, images[i].size)) {fputs ("Memory error",stderr); exit (2);}
+    if(verify && mode != MODE_JIT)
+      programVerify(&programs[i]); // if it fails, the checks stay in
+    if(snapshotAt && programBreak(&programs[i], strtoul(snapshotAt, NULL, 0))) {
+      printf("No instruction starts at %s\n", snapshotAt);
+      return 1;
+    }
+    if(mode == MODE_JIT) {
+      jitCompile(&programs[i]); // if it can't, the interpreter runs it all
+      continue;
+    }
+    if(fuse)
+      programFuse(&programs[i]);
+  }
+
+  static VM vm; // for everything but the thread pool
+  if(vmCreate(&vm, sizes)) {fputs ("Memory error",stderr); exit (2);}
+  static Snapshot start;
+  int haveStart = 0;
+  if(restorePath) {
+    FILE* f = fopen(restorePath, "rb");
+    if(f == NULL || snapshotLoad(&start, &programs[0], f)) {
+      printf("Error reading snapshot %s\n", restorePath);
+      return 1;
+    }
+    fclose(f);
+    haveStart = 1;
+    if(snapshotRestore(&start, &vm)) {
+      printf("Snapshot %s doesn't fit on these stacks\n", restorePath);
+      return 1;
+    }
+  }
+  if(snapshotAt) {
+    if(runSetup(&vm, &programs[0], mode, sleep, &start, haveStart, batch))
+      return 1;
+    haveStart = 1;
+    if(savePath) {
+      FILE* f = fopen(savePath, "wb");
+      if(f == NULL || snapshotSave(&start, &programs[0], f) || fclose(f)) {
+        printf("Error writing snapshot %s\n", savePath);
+        return 1;
+      }
+      return 0;
+    }
+  }
+
+  if(batch) {
+    if(runBatch(&vm, &programs[0], mode, sleep, haveStart ? &start : NULL, stdin, stdout)) {fputs ("Memory error",stderr); exit (2);}
+  } else if(count == 1 && copies == 1 && threads == 0) {
+    static Profile profile;
+    vmInit(&vm, &programs[0]);
+    vm.mode = mode;
+    vm.sleepMode = sleep;
+    if(haveStart)
+      snapshotRestore(&start, &vm);
+    static FrameFile frames;
+    if(framesPath) {
+      frames.f = fopen(framesPath, "wb");
+      if(frames.f == NULL) {
+        printf("Error opening %s\n", framesPath);
+        return 1;
+      }
+      frames.format = frameFormat;
+      vm.frame = writeFrame;
+      vm.frameArg = &frames;
+    }
+    if(profileOut) {
+      if(profileInit(&profile, &programs[0], profileCycles)) {fputs ("Memory error",stderr); exit (2);}
+      profileAttach(&profile, &vm);
+    }
+    vmRun(&vm);
+    reportError(vm.last_error, vm.pc);
+    if(framesPath && (fclose(frames.f) || frames.failed)) {
+      printf("Error writing %s\n", framesPath);
+      return 1;
+    }
+    if(profileOut) {
+      profileFinish(&profile);
+      fflush(stdout);
+      if(writeProfile(&profile, profileOut, argv[first]))
+        return 1;
+      profileFree(&profile);
+    }
+  } else {
+    size_t jobCount = (size_t)count * copies;
+    Job* jobs = calloc(jobCount, sizeof(Job));
+    if(jobs == NULL) {fputs ("Memory error",stderr); exit (2);}
+    for(size_t i = 0; i < jobCount; i++) {
+      jobs[i].program = &programs[i / copies];
+      jobs[i].mode = mode;
+    }
+    if(runJobs(jobs, jobCount, threads ? threads : onlineCpus(), sizes, virtualTime, slice)) {fputs ("Memory error",stderr); exit (2);}
+    for(size_t i = 0; i < jobCount; i++) {
+      if(jobs[i].error == NONE)
+        continue;
+      printf("%s#%zu: ", argv[first + i / copies], i % copies);
+      reportError(jobs[i].error, jobs[i].pc);
+    }
+    free(jobs);
+  }
+
+  for(int i = 0; i < count; i++) {
+    programFree(&programs[i]);
+    imageClose(&images[i]);
+  }
+  if(haveStart)
+    snapshotFree(&start);
+  vmDestroy(&vm);
+  free(programs);
+  free(images);
+  return 0;
+}
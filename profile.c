@@ -0,0 +1,253 @@
+/*
+Execution profiler. It runs on the MODE_TRACED hook, so it costs one indirect
+call per instruction and nothing at all when it isn't attached.
+
+Branch outcomes are read off the instruction that runs next: a BR* or JMP*
+that is followed by the instruction after it fell through, anything else was
+taken. A new basic block starts wherever control arrives other than by falling
+through. Cycles are read with rdtsc when an instruction starts and charged to
+it when the next one starts, so they include the dispatch to the next handler
+but, as far as possible, not the profiler itself.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "bytecode.h"
+#include "profile.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+static uint64_t readCycles(void) {
+  return __rdtsc();
+}
+#else
+#define HAVE_CYCLES 0
+static uint64_t readCycles(void) {
+  return 0;
+}
+#endif
+
+#define NO_OP UINT32_MAX
+
+static int isBranch(unsigned int op) {
+  return (op >= JMP && op <= JMPNN) || (op >= BR && op <= BRNN);
+}
+
+static uint64_t siteKey(uint32_t block, uint32_t pc) {
+  return ((uint64_t)block << 32 | pc) + 1;
+}
+
+static size_t siteSlot(const ProfileSite* sites, size_t capacity, uint64_t key) {
+  size_t slot = (key * 0x9e3779b97f4a7c15ull) >> 40 & (capacity - 1);
+  while(sites[slot].key != key && sites[slot].key != 0)
+    slot = (slot + 1) & (capacity - 1);
+  return slot;
+}
+
+// Finds or adds the site for key; returns its slot, or SIZE_MAX if out of memory.
+static size_t site(Profile* prof, uint64_t key) {
+  if(2 * (prof->siteCount + 1) > prof->siteCapacity) {
+    size_t capacity = prof->siteCapacity * 2;
+    ProfileSite* sites = calloc(capacity, sizeof(ProfileSite));
+    if(sites == NULL)
+      return SIZE_MAX;
+    for(size_t i = 0; i < prof->siteCapacity; i++) {
+      if(prof->sites[i].key)
+        sites[siteSlot(sites, capacity, prof->sites[i].key)] = prof->sites[i];
+    }
+    free(prof->sites);
+    prof->sites = sites;
+    prof->siteCapacity = capacity;
+  }
+  size_t slot = siteSlot(prof->sites, prof->siteCapacity, key);
+  if(prof->sites[slot].key == 0) {
+    prof->sites[slot].key = key;
+    prof->siteCount++;
+  }
+  return slot;
+}
+
+int profileInit(Profile* prof, const Program* program, int cycles) {
+  memset(prof, 0, sizeof(Profile));
+  prof->program = program;
+  prof->timed = cycles && HAVE_CYCLES;
+  prof->hits = calloc((size_t)program->size + 1, sizeof(uint64_t));
+  prof->taken = calloc((size_t)program->size + 1, sizeof(uint64_t));
+  prof->notTaken = calloc((size_t)program->size + 1, sizeof(uint64_t));
+  prof->siteCapacity = 256;
+  prof->sites = calloc(prof->siteCapacity, sizeof(ProfileSite));
+  prof->lastOp = NO_OP;
+  if(prof->hits == NULL || prof->taken == NULL || prof->notTaken == NULL || prof->sites == NULL) {
+    profileFree(prof);
+    return -1;
+  }
+  return 0;
+}
+
+void profileFree(Profile* prof) {
+  free(prof->hits);
+  free(prof->taken);
+  free(prof->notTaken);
+  free(prof->sites);
+  prof->hits = prof->taken = prof->notTaken = NULL;
+  prof->sites = NULL;
+}
+
+// charges the last instruction with the cycles up to now
+static void account(Profile* prof, uint64_t now) {
+  if(prof->lastOp == NO_OP || !prof->timed)
+    return;
+  prof->cycles[prof->lastOp] += now - prof->lastAt;
+  if(prof->lastSite != SIZE_MAX)
+    prof->sites[prof->lastSite].cycles += now - prof->lastAt;
+}
+
+static void onInsn(void* arg, uint32_t pc, unsigned int op) {
+  Profile* prof = arg;
+  if(op >= OP_RESYNC)
+    return; // internal handlers stand for no instruction of their own
+  account(prof, prof->timed ? readCycles() : 0);
+  if(prof->lastOp != NO_OP && isBranch(prof->lastOp)) {
+    if(pc == prof->next)
+      prof->notTaken[prof->lastPc]++;
+    else
+      prof->taken[prof->lastPc]++;
+  }
+  if(pc != prof->next)
+    prof->block = pc;
+
+  prof->executed++;
+  prof->counts[op]++;
+  prof->hits[pc]++;
+  prof->lastSite = site(prof, siteKey(prof->block, pc));
+  if(prof->lastSite != SIZE_MAX)
+    prof->sites[prof->lastSite].count++;
+  Insn insn;
+  prof->next = decodeInsn(prof->program->bytes, prof->program->size, pc, &insn);
+  if(op == LETA)
+    prof->next = NO_OP; // where it ends depends on the length it pops
+  prof->lastPc = pc;
+  prof->lastOp = op;
+  if(prof->timed)
+    prof->lastAt = readCycles();
+}
+
+void profileAttach(Profile* prof, VM* vm) {
+  vm->mode = MODE_TRACED;
+  vm->trace = onInsn;
+  vm->traceArg = prof;
+}
+
+void profileFinish(Profile* prof) {
+  account(prof, prof->timed ? readCycles() : 0);
+  prof->lastOp = NO_OP;
+}
+
+static void writeOpName(FILE* f, unsigned int op) {
+  const char* name = opcodeName(op);
+  if(name)
+    fputs(name, f);
+  else
+    fprintf(f, "0x%x", op);
+}
+
+typedef struct {
+  uint32_t at; // opcode or pc
+  uint64_t n;
+} Ranked;
+
+static int byCount(const void* a, const void* b) {
+  const Ranked* x = a;
+  const Ranked* y = b;
+  if(x->n != y->n)
+    return x->n < y->n ? 1 : -1;
+  return x->at < y->at ? -1 : x->at > y->at;
+}
+
+// the non-zero entries of counts[0, n), hottest first
+static Ranked* hottest(const uint64_t* counts, uint32_t n, uint32_t* found) {
+  Ranked* ranked = malloc(((size_t)n + 1) * sizeof(Ranked));
+  if(ranked == NULL)
+    return NULL;
+  *found = 0;
+  for(uint32_t i = 0; i < n; i++) {
+    if(counts[i])
+      ranked[(*found)++] = (Ranked){ i, counts[i] };
+  }
+  qsort(ranked, *found, sizeof(Ranked), byCount);
+  return ranked;
+}
+
+int profileWriteJson(const Profile* prof, FILE* f, const char* name) {
+  uint32_t opCount, pcCount;
+  Ranked* ops = hottest(prof->counts, NUM_OPS, &opCount);
+  Ranked* pcs = hottest(prof->hits, prof->program->size, &pcCount);
+  if(ops == NULL || pcs == NULL) {
+    free(ops);
+    free(pcs);
+    return -1;
+  }
+
+  fprintf(f, "{\n  \"program\": \"");
+  for(const char* c = name; *c; c++) {
+    if(*c == '"' || *c == '\\')
+      fputc('\\', f);
+    if((unsigned char)*c >= 0x20)
+      fputc(*c, f);
+  }
+  fprintf(f, "\",\n  \"instructions\": %llu,\n  \"cycles\": %s,\n", (unsigned long long)prof->executed,
+          prof->timed ? "true" : "false");
+
+  fprintf(f, "  \"opcodes\": [");
+  for(uint32_t i = 0; i < opCount; i++) {
+    fprintf(f, "%s\n    {\"op\": \"", i ? "," : "");
+    writeOpName(f, ops[i].at);
+    fprintf(f, "\", \"count\": %llu", (unsigned long long)ops[i].n);
+    if(prof->timed)
+      fprintf(f, ", \"cycles\": %llu", (unsigned long long)prof->cycles[ops[i].at]);
+    fputc('}', f);
+  }
+  fprintf(f, "\n  ],\n  \"pcs\": [");
+  Insn insn;
+  for(uint32_t i = 0; i < pcCount; i++) {
+    decodeInsn(prof->program->bytes, prof->program->size, pcs[i].at, &insn);
+    fprintf(f, "%s\n    {\"pc\": %u, \"op\": \"", i ? "," : "", pcs[i].at);
+    writeOpName(f, insn.op);
+    fprintf(f, "\", \"count\": %llu}", (unsigned long long)pcs[i].n);
+  }
+  fprintf(f, "\n  ],\n  \"branches\": [");
+  int first = 1;
+  for(uint32_t pc = 0; pc < prof->program->size; pc++) {
+    if(!prof->taken[pc] && !prof->notTaken[pc])
+      continue;
+    decodeInsn(prof->program->bytes, prof->program->size, pc, &insn);
+    fprintf(f, "%s\n    {\"pc\": %u, \"op\": \"", first ? "" : ",", pc);
+    writeOpName(f, insn.op);
+    fprintf(f, "\", \"taken\": %llu, \"not_taken\": %llu}",
+            (unsigned long long)prof->taken[pc], (unsigned long long)prof->notTaken[pc]);
+    first = 0;
+  }
+  fprintf(f, "\n  ]\n}\n");
+  free(ops);
+  free(pcs);
+  return ferror(f) ? -1 : 0;
+}
+
+int profileWriteFolded(const Profile* prof, FILE* f, const char* name) {
+  for(size_t i = 0; i < prof->siteCapacity; i++) {
+    const ProfileSite* s = &prof->sites[i];
+    if(s->key == 0)
+      continue;
+    uint32_t block = (s->key - 1) >> 32, pc = (uint32_t)(s->key - 1);
+    Insn insn;
+    decodeInsn(prof->program->bytes, prof->program->size, pc, &insn);
+    // frame names can't have spaces or semicolons, the format's separators
+    for(const char* c = name; *c; c++)
+      fputc(*c == ' ' || *c == ';' ? '_' : *c, f);
+    fprintf(f, ";block@0x%x;", block);
+    writeOpName(f, insn.op);
+    fprintf(f, "@0x%x %llu\n", pc, (unsigned long long)(prof->timed ? s->cycles : s->count));
+  }
+  return ferror(f) ? -1 : 0;
+}
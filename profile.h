@@ -0,0 +1,53 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "vm.h"
+
+// One (block, pc) pair for the folded-stack report: pc as reached from the
+// basic block that starts at block.
+typedef struct {
+  uint64_t key; // block << 32 | pc, plus one so that 0 marks a free slot
+  uint64_t count;
+  uint64_t cycles;
+} ProfileSite;
+
+// Execution profile of one MODE_TRACED run of an unfused program: how often
+// each opcode and each byte pc ran, which way every branch and jump went, and
+// optionally how many timestamp-counter cycles each opcode took.
+typedef struct {
+  const Program* program;
+  int timed; // count cycles; only where there is a cheap cycle counter
+  uint64_t executed;
+  uint64_t counts[NUM_OPS];
+  uint64_t cycles[NUM_OPS];
+  uint64_t* hits; // per byte pc
+  uint64_t* taken; // per byte pc of a BR* or JMP*
+  uint64_t* notTaken;
+  ProfileSite* sites;
+  size_t siteCapacity, siteCount;
+  // the instruction the hook saw last, accounted for once the next one shows
+  // where it went
+  uint32_t lastPc, next, block;
+  unsigned int lastOp;
+  size_t lastSite;
+  uint64_t lastAt;
+} Profile;
+
+// Sets prof up for program; cycles asks for per-opcode cycle counts, which
+// only some platforms have (see prof->timed). Returns 0, or -1 if out of memory.
+int profileInit(Profile* prof, const Program* program, int cycles);
+void profileFree(Profile* prof);
+
+// Puts vm in MODE_TRACED, feeding prof. Call profileFinish() after vmRun().
+void profileAttach(Profile* prof, VM* vm);
+void profileFinish(Profile* prof);
+
+// The report as JSON, and as folded stacks (program;block;instruction weight,
+// one per line, for flame graph tools) weighted by cycles if there are any,
+// else by count. name labels the program in both. Return 0, or -1 on a write error.
+int profileWriteJson(const Profile* prof, FILE* f, const char* name);
+int profileWriteFolded(const Profile* prof, FILE* f, const char* name);
+
+#endif
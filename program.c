@@ -0,0 +1,583 @@
+/*
+CLAW program loading: decodes the raw bytecode once into an array of Insn
+records that run() can step through without re-parsing anything.
+
+Decoding is a linear sweep from byte pc 0, plus a sweep from every static
+branch target that doesn't land on an instruction already decoded. Each sweep
+ends with an OP_RESYNC record, which looks the next byte pc up at run time.
+Jumps to byte pcs that start no record (computed JMPs into data, for one) are
+decoded on the fly by run(), so every program still behaves as if it were
+interpreted straight from the bytes.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "bytecode.h"
+#include "program.h"
+#include "vm.h"
+#include "jit.h"
+
+static uint32_t read16(const uint8_t* bytes, uint32_t pc) {
+  return bytes[pc] | bytes[pc + 1] << 8;
+}
+
+static uint32_t read32(const uint8_t* bytes, uint32_t pc) {
+  return bytes[pc] | bytes[pc + 1]<<8 | bytes[pc + 2]<<16 | (uint32_t)bytes[pc + 3]<<24;
+}
+
+static uint32_t truncated(Insn* insn, uint32_t end) {
+  insn->op = OP_RESYNC;
+  insn->imm = end;
+  return end;
+}
+
+// branches and CALL: the instructions with a target known at load time
+static int hasTarget(uint16_t op) {
+  return op == BR || op == BRZ || op == BRNZ || op == BRN || op == BRNN || op == CALL;
+}
+
+uint32_t decodeInsn(const uint8_t* bytes, uint32_t size, uint32_t pc, Insn* insn) {
+  memset(insn, 0, sizeof(Insn));
+  if(size - pc < 2)
+    return truncated(insn, pc + 2);
+  uint16_t instruction = read16(bytes, pc);
+  pc += 2;
+  insn->destination = instruction & 3;
+  insn->source = (instruction & 12) >> 2;
+  insn->op = instruction >> 4;
+
+  switch(insn->op) {
+    case LET8:
+      if(size - pc < 1)
+        return truncated(insn, pc + 1);
+      insn->imm = bytes[pc];
+      return pc + 1;
+    case LET16:
+      if(size - pc < 2)
+        return truncated(insn, pc + 2);
+      insn->imm = read16(bytes, pc);
+      return pc + 2;
+    case LET32:
+      if(size - pc < 4)
+        return truncated(insn, pc + 4);
+      insn->imm = read32(bytes, pc);
+      return pc + 4;
+    case BR:
+    case BRZ:
+    case BRNZ:
+    case BRN:
+    case BRNN:
+    case CALL:
+      if(size - pc < 2)
+        return truncated(insn, pc + 2);
+      insn->aux = pc + 2 + (int16_t)read16(bytes, pc);
+      insn->imm = pc + 2; // where a CALL's RET comes back to
+      return pc + 2;
+    case PPTR:
+      insn->imm = pc;
+      return pc;
+    case DMPSSTR:
+    {
+      const uint8_t* end = memchr(&bytes[pc], 0, size - pc);
+      if(end == NULL)
+        return truncated(insn, size);
+      insn->imm = pc;
+      insn->aux = end - &bytes[pc];
+      return pc + insn->aux + 1;
+    }
+    case LETA:
+      // the payload length is popped at run time; programLoad() resolves the
+      // usual LET16 + LETA pair statically
+      insn->imm = pc;
+      insn->aux = LETA_DYNAMIC;
+      return pc;
+    default:
+      return pc;
+  }
+}
+
+static int append(Program* p, uint32_t* capacity, const Insn* insn, uint32_t pc) {
+  if(p->length == *capacity) {
+    uint32_t n = *capacity ? *capacity * 2 : 64;
+    Insn* code = realloc(p->code, n * sizeof(Insn));
+    if(code == NULL)
+      return -1;
+    p->code = code;
+    uint32_t* pcOf = realloc(p->pcOf, n * sizeof(uint32_t));
+    if(pcOf == NULL)
+      return -1;
+    p->pcOf = pcOf;
+    *capacity = n;
+  }
+  p->code[p->length] = *insn;
+  p->pcOf[p->length] = pc;
+  p->length++;
+  return 0;
+}
+
+static int appendResync(Program* p, uint32_t* capacity, uint32_t pc) {
+  Insn insn = {0};
+  insn.op = OP_RESYNC;
+  insn.imm = pc;
+  return append(p, capacity, &insn, pc);
+}
+
+int programLoad(Program* p, const uint8_t* bytes, uint32_t size) {
+  memset(p, 0, sizeof(Program));
+  p->bytes = bytes;
+  p->size = size;
+  p->index = calloc((size_t)size + 1, sizeof(uint32_t));
+  uint32_t capacity = 0;
+  uint32_t workCapacity = 16, pending = 0;
+  uint32_t* work = malloc(workCapacity * sizeof(uint32_t));
+  if(p->index == NULL || work == NULL)
+    goto fail;
+  work[pending++] = 0;
+
+  while(pending) {
+    uint32_t pc = work[--pending];
+    int32_t last = -1; // previous record of this sweep
+    for(;;) {
+      if(pc >= size || p->index[pc]) {
+        if(appendResync(p, &capacity, pc))
+          goto fail;
+        break;
+      }
+      Insn insn;
+      uint32_t next = decodeInsn(bytes, size, pc, &insn);
+      if(insn.op == LETA && last >= 0 && p->code[last].op == LET16 &&
+         p->code[last].destination == insn.source) {
+        insn.aux = p->code[last].imm;
+        next = insn.imm + insn.aux;
+      }
+      p->index[pc] = p->length + 1;
+      last = p->length;
+      if(append(p, &capacity, &insn, pc))
+        goto fail;
+      if(hasTarget(insn.op) && insn.aux < size && !p->index[insn.aux]) {
+        if(pending == workCapacity) {
+          workCapacity *= 2;
+          uint32_t* w = realloc(work, workCapacity * sizeof(uint32_t));
+          if(w == NULL)
+            goto fail;
+          work = w;
+        }
+        work[pending++] = insn.aux;
+      }
+      if(insn.op == OP_RESYNC || (insn.op == LETA && insn.aux == LETA_DYNAMIC))
+        break;
+      pc = next;
+    }
+  }
+
+  // link branches to their target records
+  uint32_t decoded = p->length;
+  for(uint32_t i = 0; i < decoded; i++) {
+    Insn* insn = &p->code[i];
+    if(!hasTarget(insn->op))
+      continue;
+    uint32_t pc = insn->aux;
+    if(pc < size && p->index[pc]) {
+      insn->target = (int32_t)(p->index[pc] - 1) - (int32_t)i;
+    } else {
+      if(appendResync(p, &capacity, pc))
+        goto fail;
+      p->code[i].target = (int32_t)(p->length - 1) - (int32_t)i;
+    }
+  }
+  free(work);
+  return 0;
+
+fail:
+  free(work);
+  programFree(p);
+  return -1;
+}
+
+void programFree(Program* p) {
+  jitFree(p);
+  free(p->code);
+  free(p->pcOf);
+  free(p->index);
+  p->code = NULL;
+  p->pcOf = NULL;
+  p->index = NULL;
+  p->length = 0;
+}
+
+int programBreak(Program* p, uint32_t pc) {
+  programUnbreak(p);
+  if(pc >= p->size || p->index[pc] == 0)
+    return -1;
+  p->breakAt = p->index[pc];
+  p->brokenOp = p->code[p->breakAt - 1].op;
+  p->code[p->breakAt - 1].op = OP_BREAK;
+  return 0;
+}
+
+void programUnbreak(Program* p) {
+  if(p->breakAt)
+    p->code[p->breakAt - 1].op = p->brokenOp;
+  p->breakAt = 0;
+}
+
+static const struct {
+  uint16_t fused, first, second;
+} fusions[] = {
+#define X(name, a, b) { OP_##name, a, b },
+  FUSED_OPS(X)
+#undef X
+};
+
+void programFuse(Program* p) {
+  if(p->length < 2)
+    return;
+  for(uint32_t i = 0; i < p->length - 1; i++) {
+    Insn* first = &p->code[i];
+    const Insn* second = &p->code[i + 1];
+    for(size_t f = 0; f < sizeof(fusions) / sizeof(fusions[0]); f++) {
+      if(fusions[f].first != first->op || fusions[f].second != second->op)
+        continue;
+      // only LET, EQU, INC and DEC start a pair, and a sweep never stops right
+      // after one of those, so second is always the instruction that follows first
+      if(first->op == LET8 || first->op == LET16 || first->op == LET32) {
+        if(first->destination != second->source)
+          break;
+        // the literal goes straight into the arithmetic, never onto the stack
+        first->source = second->source;
+        first->destination = second->destination;
+      } else {
+        first->target = second->target + 1;
+        first->aux = second->aux;
+      }
+      first->op = fusions[f].fused;
+      break;
+    }
+  }
+}
+
+int stackAccesses(const Insn* insn, StackAccess* out) {
+  unsigned int s = insn->source, d = insn->destination;
+  int n = 0;
+#define ACCESS(k, st, bytes) out[n++] = (StackAccess){ ACCESS_##k, st, bytes }
+#define WIDTH(first) (1u << (insn->op - (first))) // families run 8, 16, 32 bits
+  switch(insn->op) {
+    case LET8: case LET16: case LET32:
+      ACCESS(PUSH, d, WIDTH(LET8));
+      break;
+    case CPY8: case CPY16: case CPY32:
+      ACCESS(PEEK, s, WIDTH(CPY8));
+      ACCESS(PUSH, d, WIDTH(CPY8));
+      break;
+    case MOV8: case MOV16: case MOV32:
+      ACCESS(POP, s, WIDTH(MOV8));
+      ACCESS(PUSH, d, WIDTH(MOV8));
+      break;
+    case SWP8: case SWP16: case SWP32:
+      ACCESS(POP, s, WIDTH(SWP8));
+      ACCESS(POP, d, WIDTH(SWP8));
+      ACCESS(PUSH, s, WIDTH(SWP8));
+      ACCESS(PUSH, d, WIDTH(SWP8));
+      break;
+    case DEL8: case DEL16: case DEL32:
+      ACCESS(POP, s, WIDTH(DEL8));
+      break;
+    case DELALL:
+      ACCESS(CLEAR, 0, 0); // only ever empties stack 0, see run()
+      break;
+#define BINARY(first) \
+    case first: case first + 1: case first + 2: \
+      ACCESS(POP, s, WIDTH(first)); \
+      ACCESS(POP, s, WIDTH(first)); \
+      ACCESS(PUSH, d, WIDTH(first)); \
+      break;
+    BINARY(ADD8) BINARY(SUB8) BINARY(MUL8) BINARY(DIV8) BINARY(MOD8)
+    BINARY(SR8) BINARY(SSR8) BINARY(SL8)
+    BINARY(AND8) BINARY(OR8) BINARY(NOR8) BINARY(NAND8) BINARY(XOR8)
+#undef BINARY
+    case NOT8: case NOT16: case NOT32:
+      ACCESS(POP, s, WIDTH(NOT8));
+      ACCESS(PUSH, d, WIDTH(NOT8));
+      break;
+    case NEG8: case NEG16: case NEG32:
+      ACCESS(POP, s, WIDTH(NEG8));
+      ACCESS(PUSH, d, WIDTH(NEG8));
+      break;
+    case INC8: case INC16: case INC32:
+      ACCESS(PEEK, s, WIDTH(INC8));
+      break;
+    case DEC8: case DEC16: case DEC32:
+      ACCESS(PEEK, s, WIDTH(DEC8));
+      break;
+    case EQU8: case EQU16: case EQU32:
+      ACCESS(POP, s, WIDTH(EQU8));
+      ACCESS(POP, s, WIDTH(EQU8));
+      break;
+    case JMP: case JMPZ: case JMPNZ: case JMPN: case JMPNN:
+      ACCESS(POP, s, 4);
+      break;
+    case PPTR:
+      ACCESS(PUSH, d, 4);
+      break;
+    case DMPN8: case DMPN16: case DMPN32:
+      ACCESS(POP, s, WIDTH(DMPN8));
+      break;
+    case SLEEP:
+      ACCESS(POP, s, 4);
+      break;
+    case GETN8: case GETN16: case GETN32:
+      ACCESS(PUSH, d, WIDTH(GETN8));
+      break;
+    case COLOR: case GMODE: case MIRROR: case FONT:
+      ACCESS(POP, s, 1);
+      break;
+    case POINT:
+      ACCESS(POP, s, 2);
+      ACCESS(POP, s, 2);
+      break;
+    case GETPIX:
+      ACCESS(POP, s, 2);
+      ACCESS(POP, s, 2);
+      ACCESS(PUSH, d, 1);
+      break;
+    case HLINE: case VLINE: case CIRCL: case LCIRCL:
+      for(int k = 0; k < 3; k++)
+        ACCESS(POP, s, 2);
+      break;
+    case LINE: case RECT: case LRECT: case ELIPS: case LELIPS:
+      for(int k = 0; k < 4; k++)
+        ACCESS(POP, s, 2);
+      break;
+    case SPRT: case BITM:
+      ACCESS(POP, s, 4);
+      ACCESS(POP, s, 2);
+      ACCESS(POP, s, 2);
+      break;
+    case LETA: case CPYA: case MOVA: case DELA: case MMCP: case POLY: case PRINT:
+    case ADDA8: case ADDA16: case ADDA32: case SUBA8: case SUBA16: case SUBA32:
+    case ANDA8: case ANDA16: case ANDA32: case ORA8: case ORA16: case ORA32:
+    case XORA8: case XORA16: case XORA32:
+      return -1;
+    case OP_RESYNC:
+      break;
+    default:
+      if(insn->op > OP_RESYNC)
+        return -1;
+      break; // a nop in run()
+  }
+#undef WIDTH
+#undef ACCESS
+  return n;
+}
+
+// bounds of each stack's depth on entry to a record, in bytes
+typedef struct {
+  uint32_t lo[NUM_STACKS], hi[NUM_STACKS];
+} Depths;
+
+// joins at one record after which its bounds are widened to the extremes,
+// so that loops that keep pushing fail quickly instead of one byte at a time
+#define WIDEN_AFTER 8
+
+// Steps d over insn, raising depth to the deepest it gets; returns -1 if a
+// check run() makes could fail on a stack of MAX_STACK_SIZE.
+static int stepDepths(const Insn* insn, Depths* d, uint32_t* depth) {
+  StackAccess acc[4];
+  int n = stackAccesses(insn, acc);
+  if(n < 0)
+    return -1;
+  for(int k = 0; k < n; k++) {
+    unsigned int s = acc[k].stack;
+    switch(acc[k].kind) {
+      case ACCESS_PUSH:
+        if(d->hi[s] + acc[k].size >= MAX_STACK_SIZE)
+          return -1;
+        d->lo[s] += acc[k].size;
+        d->hi[s] += acc[k].size;
+        if(d->hi[s] > depth[s])
+          depth[s] = d->hi[s];
+        break;
+      case ACCESS_POP:
+      case ACCESS_PEEK:
+        if(d->lo[s] < acc[k].size)
+          return -1;
+        if(acc[k].kind == ACCESS_POP) {
+          d->lo[s] -= acc[k].size;
+          d->hi[s] -= acc[k].size;
+        }
+        break;
+      case ACCESS_CLEAR:
+        d->lo[s] = d->hi[s] = 0;
+        break;
+    }
+  }
+  return 0;
+}
+
+// Stores the records control can go to after record i into out and returns
+// how many, or -1 if that is only known at run time.
+static int successors(const Program* p, uint32_t i, uint32_t* out) {
+  const Insn* insn = &p->code[i];
+  switch(insn->op) {
+    case OP_RESYNC:
+      if(insn->imm >= p->size)
+        return 0; // faults with ERR_TARGET, no stack involved
+      if(!p->index[insn->imm])
+        return -1; // decoded on the fly by run()
+      out[0] = p->index[insn->imm] - 1;
+      return 1;
+    case BR:
+      out[0] = i + insn->target;
+      return 1;
+    case BRZ: case BRNZ: case BRN: case BRNN:
+      out[0] = i + insn->target;
+      out[1] = i + 1;
+      return i + 1 < p->length ? 2 : -1;
+    case JMP: case JMPZ: case JMPNZ: case JMPN: case JMPNN:
+      return -1;
+    case CALL: case RET:
+      return -1; // where RET goes depends on the return stack
+    case END:
+      return 0;
+    default:
+      out[0] = i + 1;
+      return i + 1 < p->length ? 1 : -1;
+  }
+}
+
+int programVerify(Program* p) {
+  p->verified = 0;
+  memset(p->depth, 0, sizeof(p->depth));
+  Depths* at = malloc((size_t)p->length * sizeof(Depths));
+  uint8_t* joins = calloc(p->length, 1); // 0 until the record is reached
+  uint8_t* queued = calloc(p->length, 1);
+  uint32_t* work = malloc((size_t)p->length * sizeof(uint32_t));
+  uint32_t pending = 0;
+  int ok = at != NULL && joins != NULL && queued != NULL && work != NULL && p->length > 0;
+  if(ok) {
+    memset(&at[0], 0, sizeof(Depths));
+    joins[0] = 1;
+    queued[0] = 1;
+    work[pending++] = 0;
+  }
+
+  while(ok && pending) {
+    uint32_t i = work[--pending];
+    queued[i] = 0;
+    Depths d = at[i];
+    uint32_t next[2];
+    int count = successors(p, i, next);
+    if(count < 0 || stepDepths(&p->code[i], &d, p->depth)) {
+      ok = 0;
+      break;
+    }
+    for(int k = 0; k < count; k++) {
+      uint32_t j = next[k];
+      int changed = 0;
+      if(!joins[j]) {
+        at[j] = d;
+        joins[j] = 1;
+        changed = 1;
+      } else {
+        int widen = joins[j] >= WIDEN_AFTER;
+        for(int s = 0; s < NUM_STACKS; s++) {
+          if(d.lo[s] < at[j].lo[s]) {
+            at[j].lo[s] = widen ? 0 : d.lo[s];
+            changed = 1;
+          }
+          if(d.hi[s] > at[j].hi[s]) {
+            at[j].hi[s] = widen ? MAX_STACK_SIZE : d.hi[s];
+            changed = 1;
+          }
+        }
+        if(changed && joins[j] < WIDEN_AFTER)
+          joins[j]++;
+      }
+      if(changed && !queued[j]) {
+        queued[j] = 1;
+        work[pending++] = j;
+      }
+    }
+  }
+
+  free(at);
+  free(joins);
+  free(queued);
+  free(work);
+  p->verified = ok;
+  return ok ? 0 : -1;
+}
+
+static const char* const names[] = {
+  [NOP] = "NOP", [SLEEP] = "SLEEP", [LET8] = "LET8", [LET16] = "LET16",
+  [LET32] = "LET32", [LETA] = "LETA", [CPY8] = "CPY8", [CPY16] = "CPY16",
+  [CPY32] = "CPY32", [CPYA] = "CPYA", [MOV8] = "MOV8", [MOV16] = "MOV16",
+  [MOV32] = "MOV32", [MOVA] = "MOVA", [SWP8] = "SWP8", [SWP16] = "SWP16",
+  [SWP32] = "SWP32", [SWPA] = "SWPA", [PEEKD8] = "PEEKD8",
+  [PEEKD16] = "PEEKD16", [PEEKD32] = "PEEKD32", [SPTR] = "SPTR",
+  [DEL8] = "DEL8", [DEL16] = "DEL16", [DEL32] = "DEL32", [DELA] = "DELA",
+  [DELALL] = "DELALL", [DMPSSTR] = "DMPSSTR", [DMPN8] = "DMPN8",
+  [DMPN16] = "DMPN16", [DMPN32] = "DMPN32", [DMPF] = "DMPF", [GETN8] = "GETN8",
+  [GETN16] = "GETN16", [GETN32] = "GETN32", [MMCP] = "MMCP", [ADD8] = "ADD8",
+  [ADD16] = "ADD16", [ADD32] = "ADD32", [ADDF] = "ADDF", [SUB8] = "SUB8",
+  [SUB16] = "SUB16", [SUB32] = "SUB32", [SUBF] = "SUBF", [MUL8] = "MUL8",
+  [MUL16] = "MUL16", [MUL32] = "MUL32", [MULF] = "MULF", [DIV8] = "DIV8",
+  [DIV16] = "DIV16", [DIV32] = "DIV32", [DIVF] = "DIVF", [DIVU8] = "DIVU8",
+  [DIVU16] = "DIVU16", [DIVU32] = "DIVU32", [MOD8] = "MOD8", [MOD16] = "MOD16",
+  [MOD32] = "MOD32", [MODF] = "MODF", [MODU8] = "MODU8", [MODU16] = "MODU16",
+  [MODU32] = "MODU32", [SR8] = "SR8", [SR16] = "SR16", [SR32] = "SR32",
+  [SL8] = "SL8", [SL16] = "SL16", [SL32] = "SL32", [SSR8] = "SSR8",
+  [SSR16] = "SSR16", [SSR32] = "SSR32", [AND8] = "AND8", [AND16] = "AND16",
+  [AND32] = "AND32", [OR8] = "OR8", [OR16] = "OR16", [OR32] = "OR32",
+  [NOT8] = "NOT8", [NOT16] = "NOT16", [NOT32] = "NOT32", [NOR8] = "NOR8",
+  [NOR16] = "NOR16", [NOR32] = "NOR32", [NAND8] = "NAND8", [NAND16] = "NAND16",
+  [NAND32] = "NAND32", [XOR8] = "XOR8", [XOR16] = "XOR16", [XOR32] = "XOR32",
+  [NEG8] = "NEG8", [NEG16] = "NEG16", [NEG32] = "NEG32", [INC8] = "INC8",
+  [INC16] = "INC16", [INC32] = "INC32", [DEC8] = "DEC8", [DEC16] = "DEC16",
+  [DEC32] = "DEC32", [ADDA8] = "ADDA8", [ADDA16] = "ADDA16",
+  [ADDA32] = "ADDA32", [SUBA8] = "SUBA8", [SUBA16] = "SUBA16",
+  [SUBA32] = "SUBA32", [ANDA8] = "ANDA8", [ANDA16] = "ANDA16",
+  [ANDA32] = "ANDA32", [ORA8] = "ORA8", [ORA16] = "ORA16", [ORA32] = "ORA32",
+  [XORA8] = "XORA8", [XORA16] = "XORA16", [XORA32] = "XORA32", [C8T16] = "C8T16", [C8T32] = "C8T32", [C16T8] = "C16T8",
+  [C16T32] = "C16T32", [C32T8] = "C32T8", [C32T16] = "C32T16",
+  [C8UT16U] = "C8UT16U", [C8UT32U] = "C8UT32U", [C16UT8U] = "C16UT8U",
+  [C16UT32U] = "C16UT32U", [C32UT8U] = "C32UT8U", [C32UT16U] = "C32UT16U",
+  [CFT32] = "CFT32", [C32TF] = "C32TF", [EQU8] = "EQU8", [EQU16] = "EQU16",
+  [EQU32] = "EQU32", [STZ] = "STZ", [STN] = "STN", [CLZ] = "CLZ",
+  [CLN] = "CLN", [TGZ] = "TGZ", [TGN] = "TGN", [JMP] = "JMP", [JMPZ] = "JMPZ",
+  [JMPNZ] = "JMPNZ", [JMPN] = "JMPN", [JMPNN] = "JMPNN", [BR] = "BR",
+  [BRZ] = "BRZ", [BRNZ] = "BRNZ", [BRN] = "BRN", [BRNN] = "BRNN",
+  [CALL] = "CALL", [RET] = "RET", [PPTR] = "PPTR", [END] = "END",
+  [ENDZ] = "ENDZ", [ENDN] = "ENDN", [CLR] = "CLR", [OLED] = "OLED",
+  [GETPIX] = "GETPIX", [FILL] = "FILL", [FONT] = "FONT", [PRINT] = "PRINT",
+  [COLOR] = "COLOR", [POINT] = "POINT", [HLINE] = "HLINE", [VLINE] = "VLINE",
+  [LINE] = "LINE", [RECT] = "RECT", [LRECT] = "LRECT", [ELIPS] = "ELIPS",
+  [LELIPS] = "LELIPS", [CIRCL] = "CIRCL", [LCIRCL] = "LCIRCL", [SPRT] = "SPRT",
+  [POLY] = "POLY", [BITM] = "BITM", [SWBUFF] = "SWBUFF", [GMODE] = "GMODE",
+  [MIRROR] = "MIRROR", [CONST8_M1] = "CONST8_M1", [CONST8_0] = "CONST8_0",
+  [CONST8_1] = "CONST8_1", [CONST8_2] = "CONST8_2",
+  [CONST16_M1] = "CONST16_M1", [CONST16_0] = "CONST16_0",
+  [CONST16_1] = "CONST16_1", [CONST16_2] = "CONST16_2",
+  [CONST32_M1] = "CONST32_M1", [CONST32_0] = "CONST32_0",
+  [CONST32_1] = "CONST32_1", [CONST32_2] = "CONST32_2",
+  [CONSTF_M1] = "CONSTF_M1", [CONSTF_0] = "CONSTF_0", [CONSTF_1] = "CONSTF_1",
+  [CONSTF_2] = "CONSTF_2", [VMID] = "VMID", [CPUID] = "CPUID",
+  [EXTID] = "EXTID", [HWID] = "HWID", [BTN] = "BTN", [STANDBY] = "STANDBY",
+  [POWEROFF] = "POWEROFF", [DOOM] = "DOOM", [RICK] = "RICK"
+};
+
+static const char* const internalNames[] = {
+  [OP_RESYNC - OP_RESYNC] = "RESYNC",
+  [OP_BREAK - OP_RESYNC] = "BREAK",
+#define X(name, a, b) [OP_##name - OP_RESYNC] = #name,
+  FUSED_OPS(X)
+#undef X
+};
+
+const char* opcodeName(unsigned int op) {
+  if(op < sizeof(names) / sizeof(names[0]))
+    return names[op];
+  if(op >= OP_RESYNC && op < NUM_OPS)
+    return internalNames[op - OP_RESYNC];
+  return NULL;
+}
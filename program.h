@@ -0,0 +1,118 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdint.h>
+
+#define NUM_STACKS 4 // the 2-bit stack fields of an instruction
+
+// Superinstructions programFuse() builds out of common opcode pairs:
+// name, first opcode, second opcode.
+#define FUSED_OPS(X) \
+  X(LET_ADD8, LET8, ADD8) X(LET_ADD16, LET16, ADD16) X(LET_ADD32, LET32, ADD32) \
+  X(LET_SUB8, LET8, SUB8) X(LET_SUB16, LET16, SUB16) X(LET_SUB32, LET32, SUB32) \
+  X(LET_MUL8, LET8, MUL8) X(LET_MUL16, LET16, MUL16) X(LET_MUL32, LET32, MUL32) \
+  X(LET_AND8, LET8, AND8) X(LET_AND16, LET16, AND16) X(LET_AND32, LET32, AND32) \
+  X(LET_OR8, LET8, OR8) X(LET_OR16, LET16, OR16) X(LET_OR32, LET32, OR32) \
+  X(LET_XOR8, LET8, XOR8) X(LET_XOR16, LET16, XOR16) X(LET_XOR32, LET32, XOR32) \
+  X(EQU8_BRZ, EQU8, BRZ) X(EQU16_BRZ, EQU16, BRZ) X(EQU32_BRZ, EQU32, BRZ) \
+  X(EQU8_BRNZ, EQU8, BRNZ) X(EQU16_BRNZ, EQU16, BRNZ) X(EQU32_BRNZ, EQU32, BRNZ) \
+  X(INC8_BRZ, INC8, BRZ) X(INC16_BRZ, INC16, BRZ) X(INC32_BRZ, INC32, BRZ) \
+  X(INC8_BRNZ, INC8, BRNZ) X(INC16_BRNZ, INC16, BRNZ) X(INC32_BRNZ, INC32, BRNZ) \
+  X(INC8_BRN, INC8, BRN) X(INC16_BRN, INC16, BRN) X(INC32_BRN, INC32, BRN) \
+  X(INC8_BRNN, INC8, BRNN) X(INC16_BRNN, INC16, BRNN) X(INC32_BRNN, INC32, BRNN) \
+  X(DEC8_BRZ, DEC8, BRZ) X(DEC16_BRZ, DEC16, BRZ) X(DEC32_BRZ, DEC32, BRZ) \
+  X(DEC8_BRNZ, DEC8, BRNZ) X(DEC16_BRNZ, DEC16, BRNZ) X(DEC32_BRNZ, DEC32, BRNZ) \
+  X(DEC8_BRN, DEC8, BRN) X(DEC16_BRN, DEC16, BRN) X(DEC32_BRN, DEC32, BRN) \
+  X(DEC8_BRNN, DEC8, BRNN) X(DEC16_BRNN, DEC16, BRNN) X(DEC32_BRNN, DEC32, BRNN)
+
+// Internal handlers, numbered above the 12-bit CLAW opcode space so they can
+// share the dispatch table with the real instructions.
+enum {
+  OP_RESYNC = 0x1000, // continue at byte pc imm, wherever that is
+  OP_BREAK, // stop vmRun() here, see programBreak()
+#define X(name, first, second) OP_##name,
+  FUSED_OPS(X)
+#undef X
+  NUM_OPS
+};
+
+// A decoded instruction. Everything run() would otherwise re-parse on every
+// step is resolved once at load time: literals are read into imm and branch
+// offsets are turned into a record offset.
+typedef struct {
+  uint16_t op; // CLAW opcode or internal handler
+  uint8_t source;
+  uint8_t destination;
+  uint32_t imm; // literal (LET*, OP_LET_*), byte pc (PPTR, OP_RESYNC, CALL's return) or payload offset (LETA, DMPSSTR)
+  uint32_t aux; // branch or CALL target byte pc, string length (DMPSSTR) or payload length (LETA)
+  int32_t target; // branch or CALL target, relative to this record
+} Insn;
+
+#define LETA_DYNAMIC UINT32_MAX // LETA payload length only known at run time
+
+typedef struct {
+  const uint8_t* bytes;
+  uint32_t size;
+  Insn* code; // records in decode order; code[0] is the instruction at byte pc 0
+  uint32_t length;
+  uint32_t* pcOf; // byte pc of each record, for error reports
+  uint32_t* index; // record index + 1 for every byte pc that starts a record, 0 otherwise
+  struct Jit* jit; // native code, see jit.h; NULL unless jitCompile() made some
+  int verified; // set by programVerify(): no stack can underflow...
+  uint32_t depth[NUM_STACKS]; // ...or get deeper than this many bytes
+  uint32_t breakAt; // record index + 1 of the breakpoint, 0 for none
+  uint16_t brokenOp; // the op OP_BREAK replaced there
+} Program;
+
+// Decodes bytes into p. The bytes are not copied and must outlive p.
+// Returns 0, or -1 if out of memory.
+int programLoad(Program* p, const uint8_t* bytes, uint32_t size);
+void programFree(Program* p);
+
+// Rewrites every fusable pair into a superinstruction in the first record's
+// place. The second record stays where it is, so branches into the middle of
+// a pair still land on it; the superinstruction itself skips over it.
+void programFuse(Program* p);
+
+// Makes vmRun() stop with RUN_BREAK whenever it gets to the instruction at
+// byte pc, before running it, for taking a Snapshot there. Call it before
+// programFuse() and jitCompile(), which leave the breakpoint alone, so that no
+// superinstruction or native code runs past it. One breakpoint at a time.
+// Returns 0, or -1 if no instruction starts at pc.
+int programBreak(Program* p, uint32_t pc);
+// Removes the breakpoint, if any.
+void programUnbreak(Program* p);
+
+// Proves that running p from byte pc 0 with empty stacks can never underflow
+// a stack, and finds how deep each one can get, by tracking the bounds of
+// every stack's depth over all paths through the records. Programs that pass
+// get p->verified and p->depth set, and vmRun() runs them without any stack
+// checks on VMs whose stacks are all deeper than that. Anything whose stack
+// effect or destination depends on run-time values (computed JMPs, LETA,
+// CPYA, MOVA, DELA) fails, and so does anything that keeps pushing in a loop.
+// Must be called before programFuse(). Returns 0 if p passed.
+int programVerify(Program* p);
+
+// The stack accesses an instruction makes, in the order run() makes them.
+enum { ACCESS_POP, ACCESS_PEEK, ACCESS_PUSH, ACCESS_CLEAR };
+
+typedef struct {
+  uint8_t kind;
+  uint8_t stack;
+  uint8_t size; // bytes
+} StackAccess;
+
+// Stores the accesses of insn into out (room for 4) and returns how many, or
+// -1 if how far it moves a stack depends on run-time values. Superinstructions
+// are not described and return -1 too.
+int stackAccesses(const Insn* insn, StackAccess* out);
+
+// Mnemonic of a CLAW opcode or internal handler, NULL if it has none.
+const char* opcodeName(unsigned int op);
+
+// Decodes the single instruction at pc into insn and returns the byte pc of the
+// following one. Instructions cut short by the end of the program decode to an
+// OP_RESYNC past the end, so running them reports an out-of-bounds target.
+uint32_t decodeInsn(const uint8_t* bytes, uint32_t size, uint32_t pc, Insn* insn);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+Thread pool for running many CLAW programs (or many copies of one) at once.
+
+Workers take the next job off a shared counter, so long and short programs
+balance out across cores without any up-front partitioning. Programs are
+shared read-only. Every worker runs its jobs on a Scheduler of its own (see
+scheduler.c), one at a time, and takes on another job whenever it has
+nothing left to run but tasks that have had a slice and are waiting for
+another turn, up to MAX_RUNNABLE of those. So a worker can keep thousands of
+programs that mostly SLEEP in flight, and with slices, programs that never
+end only slow the others down.
+
+A worker that has nothing at all to run, and no job left to start, steals
+a task from another worker's deque, trying each in turn from the one after
+the last it stole from. Tasks otherwise stay on the worker that started
+them, which on Linux stays on one CPU when there are enough to go round, so
+their VMs stay in that core's caches.
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "runner.h"
+#include "scheduler.h"
+
+#define IDLE_WAIT 1 // ms a worker with only sleeping tasks waits before looking for some to steal
+
+typedef struct Worker Worker;
+
+typedef struct {
+  Job* jobs;
+  size_t count;
+  atomic_size_t next;
+  atomic_size_t unfinished; // jobs that haven't ended yet
+  atomic_int failed; // out of memory
+  Worker* workers;
+  unsigned int threads;
+} Pool;
+
+struct Worker {
+  Scheduler sched; // first, so that its deque starts on a cache line
+  Pool* pool;
+  unsigned int index;
+  unsigned int victim; // whom to try stealing from first
+  int cpu; // to run on, or -1 for anywhere
+};
+
+static uint64_t clockNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// starts the next job, if there is one left
+static int admit(Worker* w) {
+  Pool* pool = w->pool;
+  size_t i = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+  if(i >= pool->count)
+    return 0;
+  Job* job = &pool->jobs[i];
+  job->started = clockNs();
+  if(schedStart(&w->sched, job->program, job->mode, job) == NULL) {
+    atomic_store(&pool->failed, 1);
+    atomic_fetch_sub(&pool->unfinished, 1);
+  }
+  return 1;
+}
+
+static Task* steal(Worker* w) {
+  Pool* pool = w->pool;
+  for(unsigned int k = 0; k < pool->threads; k++) {
+    unsigned int v = (w->victim + k) % pool->threads;
+    if(v == w->index)
+      continue;
+    Task* task = schedSteal(&pool->workers[v].sched);
+    if(task) {
+      w->victim = v;
+      return task;
+    }
+  }
+  return NULL;
+}
+
+// sleeps a little longer each time round that there is still nothing to do
+static void backOff(unsigned int* idle) {
+  struct timespec ts = { 0, 10000L << (*idle < 7 ? *idle : 7) }; // 10 us to 1.28 ms
+  nanosleep(&ts, NULL);
+  ++*idle;
+}
+
+static void pin(int cpu) {
+#ifdef __linux__
+  if(cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#else
+  (void)cpu;
+#endif
+}
+
+static void* work(void* arg) {
+  Worker* w = arg;
+  Pool* pool = w->pool;
+  Scheduler* sched = &w->sched;
+  unsigned int idle = 0;
+  pin(w->cpu);
+  while(atomic_load(&pool->unfinished)) {
+    Task* task = schedNext(sched);
+    if(task == NULL && sched->yieldedCount < MAX_RUNNABLE && admit(w))
+      continue;
+    if(task == NULL)
+      task = schedResume(sched);
+    if(task == NULL)
+      task = steal(w);
+    if(task == NULL) {
+      // everything here is asleep, if anything: wait for a wakeup, or for
+      // something to steal
+      if(schedWait(sched, IDLE_WAIT))
+        backOff(&idle);
+      continue;
+    }
+    idle = 0;
+    RunStatus status = schedRun(sched, task);
+    if(status == RUN_SLEEP || status == RUN_YIELD)
+      continue;
+    Job* job = task->arg;
+    job->error = task->vm.last_error;
+    job->pc = task->vm.pc;
+    job->ended = clockNs();
+    schedFinish(sched, task);
+    atomic_fetch_sub(&pool->unfinished, 1);
+  }
+  return NULL;
+}
+
+unsigned int onlineCpus(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (unsigned int)n : 1;
+}
+
+// Gives each worker a CPU of its own out of those this process may run on,
+// if there are enough.
+static void placeWorkers(Worker* workers, unsigned int threads) {
+  for(unsigned int i = 0; i < threads; i++)
+    workers[i].cpu = -1;
+#ifdef __linux__
+  cpu_set_t set;
+  if(sched_getaffinity(0, sizeof(set), &set) || (unsigned int)CPU_COUNT(&set) < threads)
+    return;
+  unsigned int i = 0;
+  for(int cpu = 0; cpu < CPU_SETSIZE && i < threads; cpu++) {
+    if(CPU_ISSET(cpu, &set))
+      workers[i++].cpu = cpu;
+  }
+#endif
+}
+
+int runJobs(Job* jobs, size_t count, unsigned int threads, const uint32_t* stackSizes, int virtualTime, uint64_t slice) {
+  if(threads == 0)
+    threads = 1;
+  if(threads > count)
+    threads = count ? count : 1;
+
+  // a Worker is a whole number of cache lines, like its Scheduler, so
+  // neighbouring workers never share one
+  Worker* workers = aligned_alloc(CACHE_LINE, threads * sizeof(Worker));
+  pthread_t* tids = calloc(threads, sizeof(pthread_t));
+  if(workers == NULL || tids == NULL) {
+    free(workers);
+    free(tids);
+    return -1;
+  }
+  Pool pool = { .jobs = jobs, .count = count, .workers = workers, .threads = threads };
+  atomic_init(&pool.next, 0);
+  atomic_init(&pool.unfinished, count);
+  atomic_init(&pool.failed, 0);
+  unsigned int ready = 0;
+  for(; ready < threads; ready++) {
+    Worker* w = &workers[ready];
+    w->pool = &pool;
+    w->index = ready;
+    w->victim = ready + 1;
+    if(schedInit(&w->sched, virtualTime, slice, stackSizes))
+      break;
+  }
+  if(ready < threads) {
+    for(unsigned int i = 0; i < ready; i++)
+      schedFree(&workers[i].sched);
+    free(workers);
+    free(tids);
+    return -1;
+  }
+  placeWorkers(workers, threads);
+
+  // the calling thread is worker 0, and goes back to running anywhere after
+#ifdef __linux__
+  cpu_set_t affinity;
+  int restore = workers[0].cpu >= 0 && !pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+#endif
+  unsigned int started = 1;
+  for(unsigned int i = 1; i < threads; i++) {
+    if(pthread_create(&tids[i], NULL, work, &workers[i]))
+      break; // run with whatever we got
+    started++;
+  }
+  work(&workers[0]);
+  for(unsigned int i = 1; i < started; i++)
+    pthread_join(tids[i], NULL);
+#ifdef __linux__
+  if(restore)
+    pthread_setaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+#endif
+
+  for(unsigned int i = 0; i < threads; i++)
+    schedFree(&workers[i].sched);
+  free(workers);
+  free(tids);
+  return atomic_load(&pool.failed) ? -1 : 0;
+}
@@ -0,0 +1,27 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <stddef.h>
+#include "vm.h"
+
+// One program run by runJobs(), and how it ended.
+typedef struct {
+  const Program* program;
+  ExecMode mode;
+  RuntimeError error;
+  uint32_t pc;
+  uint64_t started, ended; // ns on the monotonic clock
+} Job;
+
+// Runs every job to completion on a pool of threads workers, with stacks of the
+// given sizes (see vmCreate()). Each worker parks the jobs that SLEEP and runs
+// or starts others meanwhile, reusing the VMs of those that end, with SLEEPs
+// on the clock or, if virtualTime is set, in a virtual time of the worker's
+// own (see Scheduler). Unless slice is 0, jobs run slice instructions at a
+// time (see vmRunFor()) and take turns. Workers with nothing to do steal
+// runnable jobs from the others. Returns 0, or -1 if out of memory.
+int runJobs(Job* jobs, size_t count, unsigned int threads, const uint32_t* stackSizes, int virtualTime, uint64_t slice);
+
+unsigned int onlineCpus(void);
+
+#endif
@@ -0,0 +1,300 @@
+/*
+Timer-wheel scheduling for programs that SLEEP. A program that paces itself
+with SLEEP gives its thread back for as long as it asks: its VM returns
+RUN_SLEEP (see SLEEP_PARK), and the task is hung in the wheel slot for the
+millisecond it is due in. Moving the clock on one millisecond wakes exactly
+one slot, so parking and waking are constant time whatever the number of
+tasks. Wakeups more than WHEEL_SLOTS ms off wait in one unsorted list, swept
+only when the earliest of them comes within the wheel's reach.
+
+The tasks ready to run are in a deque other threads can steal from (see
+Scheduler). Everything else here is only ever touched by the owning thread.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scheduler.h"
+
+#define RING_SIZE 64 // a deque's to start with
+
+static uint64_t clockMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static TaskRing* newRing(int64_t size, TaskRing* retired) {
+  TaskRing* ring = malloc(sizeof(TaskRing) + size * sizeof(ring->tasks[0]));
+  if(ring == NULL)
+    return NULL;
+  ring->mask = size - 1;
+  ring->retired = retired;
+  return ring;
+}
+
+int schedInit(Scheduler* s, int virtualTime, uint64_t slice, const uint32_t* stackSizes) {
+  memset(s, 0, sizeof(*s));
+  TaskRing* ring = newRing(RING_SIZE, NULL);
+  if(ring == NULL)
+    return -1;
+  atomic_init(&s->top, 0);
+  atomic_init(&s->bottom, 0);
+  atomic_init(&s->ring, ring);
+  s->virtualTime = virtualTime;
+  s->slice = slice;
+  s->origin = virtualTime ? 0 : clockMs();
+  s->stackSizes = stackSizes;
+  return 0;
+}
+
+static void destroy(Task* task) {
+  vmDestroy(&task->vm);
+  free(task);
+}
+
+static void freeList(Task* task) {
+  while(task) {
+    Task* next = task->next;
+    destroy(task);
+    task = next;
+  }
+}
+
+void schedFree(Scheduler* s) {
+  TaskRing* ring = atomic_load(&s->ring);
+  for(int64_t i = atomic_load(&s->top); i < atomic_load(&s->bottom); i++)
+    destroy(atomic_load(&ring->tasks[i & ring->mask]));
+  while(ring) {
+    TaskRing* retired = ring->retired;
+    free(ring);
+    ring = retired;
+  }
+  freeList(s->yielded);
+  for(int i = 0; i < WHEEL_SLOTS; i++)
+    freeList(s->slots[i]);
+  freeList(s->later);
+  freeList(s->idle);
+  memset(s, 0, sizeof(*s));
+}
+
+// queues task behind the deque's, to take its turn after them
+static void yield(Scheduler* s, Task* task) {
+  task->next = NULL;
+  if(s->yieldedTail)
+    s->yieldedTail->next = task;
+  else
+    s->yielded = task;
+  s->yieldedTail = task;
+  s->yieldedCount++;
+}
+
+// ---- the deque ----
+
+// Pushes task at the bottom, growing the ring if it is full. The old ring is
+// kept, since a thief may have loaded it and be about to read a task from it;
+// the slots it can read hold the same tasks in both.
+static void push(Scheduler* s, Task* task) {
+  int64_t b = atomic_load_explicit(&s->bottom, memory_order_relaxed);
+  int64_t t = atomic_load_explicit(&s->top, memory_order_acquire);
+  TaskRing* ring = atomic_load_explicit(&s->ring, memory_order_relaxed);
+  if(b - t > ring->mask) {
+    TaskRing* grown = newRing(2 * (ring->mask + 1), ring);
+    if(grown == NULL) {
+      yield(s, task); // not stealable, but it runs all the same
+      return;
+    }
+    for(int64_t i = t; i < b; i++) {
+      Task* moved = atomic_load_explicit(&ring->tasks[i & ring->mask], memory_order_relaxed);
+      atomic_store_explicit(&grown->tasks[i & grown->mask], moved, memory_order_relaxed);
+    }
+    atomic_store_explicit(&s->ring, grown, memory_order_release);
+    ring = grown;
+  }
+  atomic_store_explicit(&ring->tasks[b & ring->mask], task, memory_order_relaxed);
+  atomic_store_explicit(&s->bottom, b + 1, memory_order_release);
+}
+
+// Takes the task at the bottom. Only a race with a thief for the last task
+// needs the compare-and-swap.
+static Task* take(Scheduler* s) {
+  int64_t b = atomic_load_explicit(&s->bottom, memory_order_relaxed) - 1;
+  TaskRing* ring = atomic_load_explicit(&s->ring, memory_order_relaxed);
+  atomic_store_explicit(&s->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t t = atomic_load_explicit(&s->top, memory_order_relaxed);
+  if(t > b) {
+    atomic_store_explicit(&s->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+  Task* task = atomic_load_explicit(&ring->tasks[b & ring->mask], memory_order_relaxed);
+  if(t == b) {
+    if(!atomic_compare_exchange_strong_explicit(&s->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+      task = NULL;
+    atomic_store_explicit(&s->bottom, b + 1, memory_order_relaxed);
+  }
+  return task;
+}
+
+Task* schedSteal(Scheduler* victim) {
+  int64_t t = atomic_load_explicit(&victim->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t b = atomic_load_explicit(&victim->bottom, memory_order_acquire);
+  if(t >= b)
+    return NULL;
+  TaskRing* ring = atomic_load_explicit(&victim->ring, memory_order_acquire);
+  Task* task = atomic_load_explicit(&ring->tasks[t & ring->mask], memory_order_relaxed);
+  if(!atomic_compare_exchange_strong_explicit(&victim->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+    return NULL;
+  return task;
+}
+
+// ---- scheduling ----
+
+Task* schedStart(Scheduler* s, const Program* program, ExecMode mode, void* arg) {
+  Task* task = s->idle;
+  if(task) {
+    s->idle = task->next;
+  } else {
+    task = calloc(1, sizeof(Task));
+    if(task == NULL)
+      return NULL;
+    if(vmCreate(&task->vm, s->stackSizes)) {
+      free(task);
+      return NULL;
+    }
+  }
+  vmInit(&task->vm, program);
+  task->vm.mode = mode;
+  task->vm.sleepMode = SLEEP_PARK;
+  task->arg = arg;
+  push(s, task);
+  return task;
+}
+
+// hangs task in the wheel, or in later if it is due too far off
+static void hang(Scheduler* s, Task* task) {
+  if(task->wake - s->now < WHEEL_SLOTS) {
+    Task** slot = &s->slots[task->wake % WHEEL_SLOTS];
+    task->next = *slot;
+    *slot = task;
+    return;
+  }
+  if(!s->later || task->wake < s->laterWake)
+    s->laterWake = task->wake;
+  task->next = s->later;
+  s->later = task;
+}
+
+// Moves the clock on to now, queuing every task due by then. A slot only
+// ever holds wakes from the WHEEL_SLOTS ms after the time it was filled at,
+// so each one is due by the time the clock gets back round to it.
+static void advance(Scheduler* s, uint64_t now) {
+  if(now <= s->now)
+    return;
+  if(!s->parked) {
+    s->now = now;
+    return;
+  }
+  uint64_t steps = now - s->now < WHEEL_SLOTS ? now - s->now : WHEEL_SLOTS;
+  for(uint64_t t = s->now + 1; t <= s->now + steps; t++) {
+    Task** slot = &s->slots[t % WHEEL_SLOTS];
+    while(*slot) {
+      Task* task = *slot;
+      *slot = task->next;
+      s->parked--;
+      push(s, task);
+    }
+  }
+  s->now = now;
+  if(!s->later || s->laterWake >= now + WHEEL_SLOTS)
+    return;
+  Task* task = s->later;
+  s->later = NULL;
+  while(task) {
+    Task* next = task->next;
+    if(task->wake <= now) {
+      s->parked--;
+      push(s, task);
+    } else {
+      hang(s, task);
+    }
+    task = next;
+  }
+}
+
+Task* schedNext(Scheduler* s) {
+  if(s->parked && !s->virtualTime)
+    advance(s, clockMs() - s->origin);
+  return take(s);
+}
+
+Task* schedResume(Scheduler* s) {
+  // pushed last first, so that the first is taken first
+  Task* reversed = NULL;
+  while(s->yielded) {
+    Task* task = s->yielded;
+    s->yielded = task->next;
+    task->next = reversed;
+    reversed = task;
+  }
+  s->yieldedTail = NULL;
+  s->yieldedCount = 0;
+  while(reversed) {
+    Task* task = reversed;
+    reversed = task->next;
+    push(s, task);
+  }
+  return take(s);
+}
+
+RunStatus schedRun(Scheduler* s, Task* task) {
+  RunStatus status = s->slice ? vmRunFor(&task->vm, s->slice) : vmRun(&task->vm);
+  if(status == RUN_YIELD || (status == RUN_SLEEP && task->vm.sleep == 0)) {
+    yield(s, task);
+    return status;
+  }
+  if(status != RUN_SLEEP)
+    return status;
+  if(!s->virtualTime)
+    advance(s, clockMs() - s->origin);
+  task->wake = s->now + task->vm.sleep;
+  s->parked++;
+  hang(s, task);
+  return status;
+}
+
+void schedFinish(Scheduler* s, Task* task) {
+  task->next = s->idle;
+  s->idle = task;
+}
+
+// when the earliest parked task is due
+static uint64_t nextWake(const Scheduler* s) {
+  for(uint64_t t = s->now + 1; t < s->now + WHEEL_SLOTS; t++) {
+    if(s->slots[t % WHEEL_SLOTS])
+      return t;
+  }
+  return s->laterWake;
+}
+
+int schedWait(Scheduler* s, uint32_t limit) {
+  if(!s->parked)
+    return -1;
+  uint64_t wake = nextWake(s);
+  if(!s->virtualTime) {
+    uint64_t now = clockMs() - s->origin;
+    if(wake > now + limit)
+      wake = now + limit;
+    if(wake > now) {
+      struct timespec left = { (wake - now) / 1000, (wake - now) % 1000 * 1000000L };
+      while(nanosleep(&left, &left) && errno == EINTR)
+        ;
+    }
+    wake = clockMs() - s->origin;
+  }
+  advance(s, wake);
+  return 0;
+}
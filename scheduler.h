@@ -0,0 +1,95 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "vm.h"
+
+#define WHEEL_SLOTS 256 // of a millisecond each
+// Runnable tasks a worker shares its time between, counting those that used
+// up a slice, before it stops taking on new jobs.
+#define MAX_RUNNABLE 64
+
+// One program in flight on a Scheduler, on a VM of its own.
+typedef struct Task {
+  VM vm;
+  void* arg; // whoever started it
+  uint64_t wake; // when its SLEEP is up, in ms on the scheduler's clock
+  struct Task* next; // in yielded, a wheel slot, later or idle
+} Task;
+
+// The array a deque keeps its tasks in, indexed modulo its size.
+typedef struct TaskRing {
+  int64_t mask; // size - 1, for a power of two size
+  struct TaskRing* retired; // the one this replaced, which a thief may still be reading
+  _Atomic(Task*) tasks[];
+} TaskRing;
+
+// Runs any number of programs on one thread. Each runs until it ends, SLEEPs
+// or uses up its slice; a sleeping one is parked in a timer wheel, where it
+// costs nothing until it is due, while the others run. In real time the clock
+// is the system's monotonic one and, once every task is asleep, the thread
+// sleeps too. In virtual time the clock is the scheduler's own and only moves
+// when every task is asleep, straight to the next wakeup, so no one waits.
+//
+// Tasks ready to run wait in a work-stealing deque (Chase and Lev's, with
+// Le et al.'s memory orders), which is the one part other threads touch. The
+// owner pushes and takes at the bottom, so it runs the task it started or
+// woke last, whose VM is likeliest still in its cache. Other schedulers with
+// nothing to do steal from the top, the task that has waited longest.
+typedef struct {
+  // shared with thieves: top on a line of its own, as every steal writes it
+  _Alignas(CACHE_LINE) _Atomic int64_t top;
+  _Alignas(CACHE_LINE) _Atomic int64_t bottom;
+  _Atomic(TaskRing*) ring;
+
+  // the owner's alone
+  _Alignas(CACHE_LINE) int virtualTime;
+  uint64_t slice; // instructions a task runs for at a time (see vmRunFor()), 0 for no limit
+  uint64_t now; // ms since schedInit()
+  uint64_t origin; // the monotonic clock at schedInit(), in ms
+  // Ready, but behind everything in the deque: tasks that used up a slice or
+  // did a SLEEP 0, first in, first out, so they take turns.
+  Task* yielded;
+  Task* yieldedTail;
+  size_t yieldedCount;
+  // parked until a wake less than WHEEL_SLOTS ms after now, at wake % WHEEL_SLOTS
+  Task* slots[WHEEL_SLOTS];
+  Task* later; // parked until after that
+  uint64_t laterWake; // the earliest wake in later
+  size_t parked; // in slots or later
+  Task* idle; // finished, their VMs kept for the next schedStart()
+  const uint32_t* stackSizes; // for vmCreate()
+} Scheduler;
+
+// Returns 0, or -1 if memory ran out.
+int schedInit(Scheduler* s, int virtualTime, uint64_t slice, const uint32_t* stackSizes);
+// Destroys every task's VM, finished or not. No other thread may be using s.
+void schedFree(Scheduler* s);
+
+// Queues a task that runs program from the start in mode, on a VM left over
+// from a finished task if there is one. Returns NULL if memory ran out.
+Task* schedStart(Scheduler* s, const Program* program, ExecMode mode, void* arg);
+// Takes the next task to run off the deque, once the tasks whose SLEEP is up
+// have joined it; NULL if it is empty.
+Task* schedNext(Scheduler* s);
+// Moves the yielded tasks to the deque, to take their turns, and takes the
+// first of them; NULL if there are none.
+Task* schedResume(Scheduler* s);
+// Takes the task that has waited longest off another thread's scheduler, for
+// s's owner to run; NULL if victim had none or another thread got there first.
+Task* schedSteal(Scheduler* victim);
+// Runs task until it ends, SLEEPs or uses up its slice. A task that SLEEPs is
+// parked until it is due, and RUN_SLEEP returned; one out of its slice is
+// yielded, and RUN_YIELD returned. Either way the caller has nothing more to
+// do with it.
+RunStatus schedRun(Scheduler* s, Task* task);
+// Keeps an ended task's VM for the next schedStart().
+void schedFinish(Scheduler* s, Task* task);
+// Sleeps, or in virtual time moves the clock, until the earliest parked task
+// is due, but in real time for no more than limit ms. Returns 0, or -1 if none
+// is parked.
+int schedWait(Scheduler* s, uint32_t limit);
+
+#endif
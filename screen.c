@@ -0,0 +1,444 @@
+/*
+The OLED framebuffer behind the graphics opcodes. Everything is drawn as
+horizontal spans: a span is masked into a row 64 pixels at a time, so a
+filled rectangle or ellipse costs a couple of word operations per row rather
+than one per pixel. Lines are Bresenham, ellipses and circles midpoint, both
+in integers. MIRROR is applied to each span as it is drawn.
+
+Each span also widens its row's dirty byte range. Outside those ranges back
+is the same as front, so SWBUFF compares and copies just them, and from the
+bytes that really changed builds the rectangles the incremental frame formats
+send.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "screen.h"
+
+_Static_assert(SCREEN_HEIGHT <= 64, "dirtyRows has a bit per row");
+#define ALL_ROWS (~0ull >> (64 - SCREEN_HEIGHT))
+#define RECT_HEADER (int)sizeof(ScreenRect) // bytes a rects frame spends on each rectangle
+
+static uint64_t load64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+static void store64(uint8_t* p, uint64_t v) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  memcpy(p, &v, sizeof(v));
+}
+
+// widens row y's dirty range to take in bytes lo to hi
+static void damage(Screen* s, int y, int lo, int hi) {
+  uint64_t bit = 1ull << y;
+  if(!(s->dirtyRows & bit)) {
+    s->dirtyRows |= bit;
+    s->dirtyLo[y] = lo;
+    s->dirtyHi[y] = hi;
+    return;
+  }
+  if(lo < s->dirtyLo[y])
+    s->dirtyLo[y] = lo;
+  if(hi > s->dirtyHi[y])
+    s->dirtyHi[y] = hi;
+}
+
+void screenDamageAll(Screen* s) {
+  s->dirtyRows = ALL_ROWS;
+  memset(s->dirtyLo, 0, sizeof(s->dirtyLo));
+  memset(s->dirtyHi, SCREEN_STRIDE - 1, sizeof(s->dirtyHi));
+}
+
+// draws pixels x0 to x1 of row y, both included
+static void span(Screen* s, int x0, int x1, int y) {
+  if(s->mirror & MIRROR_X) {
+    int t = SCREEN_WIDTH - 1 - x1;
+    x1 = SCREEN_WIDTH - 1 - x0;
+    x0 = t;
+  }
+  if(s->mirror & MIRROR_Y)
+    y = SCREEN_HEIGHT - 1 - y;
+  if(y < 0 || y >= SCREEN_HEIGHT || x0 > x1 || x1 < 0 || x0 >= SCREEN_WIDTH)
+    return;
+  if(x0 < 0)
+    x0 = 0;
+  if(x1 >= SCREEN_WIDTH)
+    x1 = SCREEN_WIDTH - 1;
+  s->drawn = 1;
+  damage(s, y, x0 >> 3, x1 >> 3);
+  uint8_t* row = s->back + y * SCREEN_STRIDE;
+  for(int w = x0 >> 6; w <= x1 >> 6; w++) {
+    uint64_t mask = ~0ull;
+    if(w == x0 >> 6)
+      mask &= ~0ull << (x0 & 63);
+    if(w == x1 >> 6)
+      mask &= ~0ull >> (63 - (x1 & 63));
+    uint64_t v = load64(row + w * 8);
+    if(s->mode == GMODE_XOR)
+      v ^= mask;
+    else if(s->color)
+      v |= mask;
+    else
+      v &= ~mask;
+    store64(row + w * 8, v);
+  }
+}
+
+void screenReset(Screen* s) {
+  if(s->drawn) {
+    memset(s->back, 0, SCREEN_BYTES);
+    memset(s->front, 0, SCREEN_BYTES);
+  }
+  s->color = 1;
+  s->mode = GMODE_SET;
+  s->mirror = 0;
+  s->font = 0;
+  s->drawn = 0;
+  s->rectCount = 0;
+  s->dirtyRows = 0;
+}
+
+void screenClear(Screen* s) {
+  if(s->drawn) {
+    memset(s->back, 0, SCREEN_BYTES);
+    screenDamageAll(s);
+  }
+}
+
+void screenFill(Screen* s) {
+  s->drawn = 1;
+  screenDamageAll(s);
+  if(s->mode == GMODE_XOR) {
+    for(int i = 0; i < SCREEN_BYTES; i += 8)
+      store64(s->back + i, ~load64(s->back + i));
+  } else {
+    memset(s->back, s->color ? 0xff : 0, SCREEN_BYTES);
+  }
+}
+
+void screenPoint(Screen* s, int x, int y) {
+  span(s, x, x, y);
+}
+
+int screenPixel(const Screen* s, int x, int y) {
+  if(s->mirror & MIRROR_X)
+    x = SCREEN_WIDTH - 1 - x;
+  if(s->mirror & MIRROR_Y)
+    y = SCREEN_HEIGHT - 1 - y;
+  if(x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT)
+    return 0;
+  return s->back[y * SCREEN_STRIDE + x / 8] >> (x % 8) & 1;
+}
+
+void screenHLine(Screen* s, int x, int y, int width) {
+  if(width > 0)
+    span(s, x, x + width - 1, y);
+}
+
+void screenVLine(Screen* s, int x, int y, int height) {
+  int last = y + height - 1;
+  if(y < 0)
+    y = 0;
+  if(last >= SCREEN_HEIGHT)
+    last = SCREEN_HEIGHT - 1;
+  for(; y <= last; y++)
+    span(s, x, x, y);
+}
+
+void screenLine(Screen* s, int x0, int y0, int x1, int y1, int last) {
+  if(y0 == y1) {
+    if(!last && x0 == x1)
+      return;
+    if(x0 <= x1)
+      span(s, x0, last ? x1 : x1 - 1, y0);
+    else
+      span(s, last ? x1 : x1 + 1, x0, y0);
+    return;
+  }
+  int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+  int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+  int err = dx + dy;
+  for(;;) {
+    if(x0 == x1 && y0 == y1) {
+      if(last)
+        span(s, x0, x0, y0);
+      return;
+    }
+    span(s, x0, x0, y0);
+    int e2 = 2 * err;
+    if(e2 >= dy) {
+      err += dy;
+      x0 += sx;
+    }
+    if(e2 <= dx) {
+      err += dx;
+      y0 += sy;
+    }
+  }
+}
+
+void screenRect(Screen* s, int x, int y, int width, int height, int filled) {
+  if(width <= 0 || height <= 0)
+    return;
+  int right = x + width - 1, bottom = y + height - 1;
+  if(filled) {
+    for(int row = y < 0 ? 0 : y; row <= bottom && row < SCREEN_HEIGHT; row++)
+      span(s, x, right, row);
+    return;
+  }
+  span(s, x, right, y);
+  if(bottom > y)
+    span(s, x, right, bottom);
+  // the sides without the corners, which the top and bottom have drawn
+  screenVLine(s, x, y + 1, height - 2);
+  if(right > x)
+    screenVLine(s, right, y + 1, height - 2);
+}
+
+// widens row cy - dy's and row cy + dy's run of ellipse pixels right of the
+// centre, lo to hi, to take in x
+static void widen(int* lo, int* hi, int cy, int64_t x, int64_t dy) {
+  for(int side = 0; side < (dy ? 2 : 1); side++) {
+    int64_t y = side ? cy + dy : cy - dy;
+    if(y < 0 || y >= SCREEN_HEIGHT)
+      continue;
+    if(hi[y] < 0 || x < lo[y])
+      lo[y] = x;
+    if(x > hi[y])
+      hi[y] = x;
+  }
+}
+
+void screenEllipse(Screen* s, int x, int y, int rx, int ry, int filled) {
+  if(rx < 0 || ry < 0)
+    return;
+  if(rx == 0 || ry == 0) {
+    if(ry == 0)
+      span(s, x - rx, x + rx, y);
+    else
+      screenVLine(s, x, y - ry, 2 * ry + 1);
+    return;
+  }
+  // the first quadrant, from the top round to the right, in integers
+  // scaled by 4 to keep the midpoints' halves whole
+  int lo[SCREEN_HEIGHT], hi[SCREEN_HEIGHT];
+  for(int i = 0; i < SCREEN_HEIGHT; i++)
+    hi[i] = -1;
+  int64_t rx2 = (int64_t)rx * rx, ry2 = (int64_t)ry * ry;
+  int64_t px = 0, py = 2 * rx2 * ry;
+  int64_t qx = 0, qy = ry;
+  int64_t p = 4 * ry2 - 4 * rx2 * ry + rx2;
+  while(px < py) {
+    widen(lo, hi, y, qx, qy);
+    qx++;
+    px += 2 * ry2;
+    if(p < 0) {
+      p += 4 * (ry2 + px);
+    } else {
+      qy--;
+      py -= 2 * rx2;
+      p += 4 * (ry2 + px - py);
+    }
+  }
+  p = ry2 * (2 * qx + 1) * (2 * qx + 1) + 4 * rx2 * (qy - 1) * (qy - 1) - 4 * rx2 * ry2;
+  while(qy >= 0) {
+    widen(lo, hi, y, qx, qy);
+    qy--;
+    py -= 2 * rx2;
+    if(p > 0) {
+      p += 4 * (rx2 - py);
+    } else {
+      qx++;
+      px += 2 * ry2;
+      p += 4 * (rx2 - py + px);
+    }
+  }
+  for(int row = 0; row < SCREEN_HEIGHT; row++) {
+    if(hi[row] < 0)
+      continue;
+    if(filled || lo[row] == 0) {
+      span(s, x - hi[row], x + hi[row], row);
+    } else {
+      span(s, x - hi[row], x - lo[row], row);
+      span(s, x + lo[row], x + hi[row], row);
+    }
+  }
+}
+
+void screenBlit(Screen* s, int column, int y, const uint64_t* image, const uint64_t* mask, int words, int height) {
+  int first = column < 0 ? 0 : column, last = column + 8 * words - 1;
+  if(last >= SCREEN_STRIDE)
+    last = SCREEN_STRIDE - 1;
+  if(first > last)
+    return;
+  for(int r = 0; r < height; r++, image += words, mask += words) {
+    if(y + r < 0 || y + r >= SCREEN_HEIGHT)
+      continue;
+    s->drawn = 1;
+    damage(s, y + r, first, last);
+    uint8_t* row = s->back + (y + r) * SCREEN_STRIDE;
+    uint64_t w[SCREEN_STRIDE / 8];
+    for(int j = 0; j < SCREEN_STRIDE / 8; j++)
+      w[j] = load64(row + j * 8);
+    for(int k = 0; k < words; k++) {
+      // image word k starts this many bits into the row, maybe before it
+      int at = (column + 8 * k) * 8;
+      for(int j = 0; j < SCREEN_STRIDE / 8; j++) {
+        int shift = at - 64 * j;
+        if(shift <= -64 || shift >= 64)
+          continue;
+        uint64_t i = shift >= 0 ? image[k] << shift : image[k] >> -shift;
+        uint64_t m = shift >= 0 ? mask[k] << shift : mask[k] >> -shift;
+        if(s->mode == GMODE_XOR)
+          w[j] ^= i & m;
+        else
+          w[j] = (w[j] & ~m) | ((s->color ? i : ~i) & m);
+      }
+    }
+    for(int j = 0; j < SCREEN_STRIDE / 8; j++)
+      store64(row + j * 8, w[j]);
+  }
+}
+
+static void pointAt(const uint8_t* points, unsigned int i, int* x, int* y) {
+  int16_t xy[2];
+  memcpy(xy, points + i * sizeof(xy), sizeof(xy));
+  *x = xy[0];
+  *y = xy[1];
+}
+
+void screenPolygon(Screen* s, const uint8_t* points, unsigned int count) {
+  if(count == 0)
+    return;
+  int x0, y0, x1, y1;
+  pointAt(points, 0, &x0, &y0);
+  if(count <= 2) {
+    // a point, or a line that there and back would draw twice
+    pointAt(points, count - 1, &x1, &y1);
+    screenLine(s, x0, y0, x1, y1, 1);
+    return;
+  }
+  // each edge leaves its last point to the next one
+  for(unsigned int i = 1; i <= count; i++) {
+    pointAt(points, i % count, &x1, &y1);
+    screenLine(s, x0, y0, x1, y1, 0);
+    x0 = x1;
+    y0 = y1;
+  }
+}
+
+void screenSwap(Screen* s) {
+  s->rectCount = 0;
+  ScreenRect* r = NULL; // the one rows are being added to
+  for(uint64_t rows = s->dirtyRows; rows; rows &= rows - 1) {
+    int y = __builtin_ctzll(rows);
+    const uint8_t* back = s->back + y * SCREEN_STRIDE;
+    uint8_t* front = s->front + y * SCREEN_STRIDE;
+    int lo = s->dirtyLo[y], hi = s->dirtyHi[y];
+    while(lo <= hi && back[lo] == front[lo])
+      lo++;
+    while(hi >= lo && back[hi] == front[hi])
+      hi--;
+    if(lo > hi) {
+      r = NULL;
+      continue;
+    }
+    memcpy(front, back, SCREEN_STRIDE); // two words, whatever lo and hi are
+    // add the row to the rectangle above if that sends fewer bytes than
+    // starting one of its own
+    if(r && r->y + r->height == y) {
+      int left = lo < r->x ? lo : r->x;
+      int right = hi > r->x + r->width - 1 ? hi : r->x + r->width - 1;
+      int grown = (right - left + 1) * (r->height + 1) - r->width * r->height;
+      if(grown <= RECT_HEADER + hi - lo + 1) {
+        r->x = left;
+        r->width = right - left + 1;
+        r->height++;
+        continue;
+      }
+    }
+    r = &s->rects[s->rectCount++];
+    *r = (ScreenRect){ lo, y, hi - lo + 1, 1 };
+  }
+  s->dirtyRows = 0;
+}
+
+int screenWritePpm(const uint8_t* frame, FILE* f) {
+  static const char header[] = "P6\n128 64\n255\n";
+  uint8_t rgb[SCREEN_WIDTH * 3];
+  if(fwrite(header, 1, sizeof(header) - 1, f) != sizeof(header) - 1)
+    return -1;
+  for(int y = 0; y < SCREEN_HEIGHT; y++) {
+    const uint8_t* row = frame + y * SCREEN_STRIDE;
+    for(int x = 0; x < SCREEN_WIDTH; x++)
+      memset(&rgb[x * 3], row[x / 8] >> (x % 8) & 1 ? 0xff : 0, 3);
+    if(fwrite(rgb, 1, sizeof(rgb), f) != sizeof(rgb))
+      return -1;
+  }
+  return 0;
+}
+
+int screenWriteRaw(const uint8_t* frame, FILE* f) {
+  return fwrite(frame, 1, SCREEN_BYTES, f) == SCREEN_BYTES ? 0 : -1;
+}
+
+static const ScreenRect whole = { 0, 0, SCREEN_STRIDE, SCREEN_HEIGHT };
+
+int screenWriteRects(const Screen* s, int full, FILE* f) {
+  uint8_t out[1 + SCREEN_HEIGHT * RECT_HEADER + SCREEN_BYTES]; // at worst a rectangle a row
+  uint32_t length = 0;
+  const ScreenRect* rects = full ? &whole : s->rects;
+  uint8_t count = full ? 1 : s->rectCount;
+  out[length++] = count;
+  for(const ScreenRect* r = rects; r < rects + count; r++) {
+    memcpy(&out[length], r, RECT_HEADER);
+    length += RECT_HEADER;
+    for(int y = r->y; y < r->y + r->height; y++) {
+      // a loop rather than memcpy(): rows are a handful of bytes
+      const uint8_t* row = s->front + y * SCREEN_STRIDE + r->x;
+      for(int i = 0; i < r->width; i++)
+        out[length++] = row[i];
+    }
+  }
+  return fwrite(out, 1, length, f) == length ? 0 : -1;
+}
+
+int screenWriteXor(const Screen* s, uint8_t* last, int full, FILE* f) {
+  // at worst a whole row of changes, and its run's two bytes, on every row
+  uint8_t runs[2 + SCREEN_HEIGHT * (SCREEN_STRIDE + 2) + SCREEN_BYTES / 255 * 2];
+  uint32_t length = 2, at = 0; // where the last run left off
+  const ScreenRect* rects = full ? &whole : s->rects;
+  uint8_t count = full ? 1 : s->rectCount;
+  for(const ScreenRect* r = rects; r < rects + count; r++) {
+    for(int y = r->y; y < r->y + r->height; y++) {
+      uint32_t lo = y * SCREEN_STRIDE + r->x, hi = lo + r->width - 1;
+      while(lo <= hi && s->front[lo] == last[lo])
+        lo++;
+      while(hi >= lo && s->front[hi] == last[hi])
+        hi--;
+      if(lo > hi)
+        continue;
+      for(; lo - at > 255; at += 255) {
+        runs[length++] = 255;
+        runs[length++] = 0;
+      }
+      runs[length++] = lo - at;
+      runs[length++] = hi - lo + 1;
+      for(uint32_t i = lo; i <= hi; i++) {
+        runs[length++] = s->front[i] ^ last[i];
+        last[i] = s->front[i];
+      }
+      at = hi + 1;
+    }
+  }
+  runs[0] = length - 2;
+  runs[1] = (length - 2) >> 8;
+  return fwrite(runs, 1, length, f) == length ? 0 : -1;
+}
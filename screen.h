@@ -0,0 +1,98 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// The microcat's OLED: 128x64 monochrome pixels, one bit each. Pixel x of a
+// row is bit x % 8 of byte x / 8, so 64 pixels are one little-endian word.
+#define SCREEN_WIDTH 128
+#define SCREEN_HEIGHT 64
+#define SCREEN_STRIDE (SCREEN_WIDTH / 8) // bytes per row, a whole number of words
+#define SCREEN_BYTES (SCREEN_STRIDE * SCREEN_HEIGHT)
+
+// what GMODE picks: drawn pixels take the COLOR, or flip
+enum { GMODE_SET, GMODE_XOR };
+// MIRROR bits: flip everything drawn from then on left to right, top to bottom
+enum { MIRROR_X = 1, MIRROR_Y = 2 };
+
+// Part of the screen: x and width count bytes, 8 pixels each, y and height rows.
+typedef struct {
+  uint8_t x, y, width, height;
+} ScreenRect;
+
+// A headless framebuffer. The graphics opcodes draw into back, and SWBUFF
+// copies it to front and hands front on as the next frame, so nothing ever
+// sees a frame half drawn and programs can keep drawing on top of the last
+// one. Both live in the VM's arena and are only touched once a program draws.
+// Drawing records which bytes of each row it may have changed, so SWBUFF only
+// compares and copies those, and works out the rectangles of front that
+// actually changed for the incremental frame formats.
+typedef struct {
+  uint8_t* back; // SCREEN_BYTES each
+  uint8_t* front;
+  uint8_t color; // pixels drawn are on unless it is 0
+  uint8_t mode; // GMODE_*
+  uint8_t mirror; // MIRROR_* bits
+  uint8_t font; // FONT_*, see font.h
+  uint8_t drawn; // 0 while both buffers are still blank
+  uint8_t rectCount; // rects the last SWBUFF changed, in order from the top
+  ScreenRect rects[SCREEN_HEIGHT];
+  uint64_t dirtyRows; // bit y: row y of back may differ from front...
+  uint8_t dirtyLo[SCREEN_HEIGHT], dirtyHi[SCREEN_HEIGHT]; // ...in bytes lo to hi
+} Screen;
+
+// Blanks both buffers, if anything was drawn, and goes back to drawing on
+// pixels in GMODE_SET, unmirrored, in the small font.
+void screenReset(Screen* s);
+
+// CLR blanks the back buffer; FILL draws every pixel of it.
+void screenClear(Screen* s);
+void screenFill(Screen* s);
+
+// The drawing primitives. Coordinates may be anywhere: whatever falls outside
+// the screen is clipped. Every pixel of a shape is drawn exactly once, so in
+// GMODE_XOR drawing a shape twice takes it off again.
+void screenPoint(Screen* s, int x, int y);
+int screenPixel(const Screen* s, int x, int y); // GETPIX: 1 if on, 0 if off or outside
+void screenHLine(Screen* s, int x, int y, int width);
+void screenVLine(Screen* s, int x, int y, int height);
+// Bresenham, from (x0, y0) up to (x1, y1), which is only drawn if last is set.
+void screenLine(Screen* s, int x0, int y0, int x1, int y1, int last);
+void screenRect(Screen* s, int x, int y, int width, int height, int filled);
+// midpoint ellipse centred on (x, y), filled or just its outline
+void screenEllipse(Screen* s, int x, int y, int rx, int ry, int filled);
+// The closed outline through count points, given as they are on a stack:
+// 16-bit x then y each, in host byte order. Where edges cross or run over each
+// other, their pixels are drawn once per edge.
+void screenPolygon(Screen* s, const uint8_t* points, unsigned int count);
+
+// SWBUFF: copies what changed of the back buffer to the front, and records
+// where in rects.
+void screenSwap(Screen* s);
+// Masks height rows of an image, words 64-bit words each, into back, starting
+// at byte column (which may be off either side) of row y: pixels where mask is
+// set take the image's pixel, or its inverse with COLOR 0, or are flipped
+// where the image is set in GMODE_XOR. The image is drawn as it is; whoever
+// made it has already applied MIRROR (see sprite.c).
+void screenBlit(Screen* s, int column, int y, const uint64_t* image, const uint64_t* mask, int words, int height);
+// Marks all of back as possibly changed, for when it was written behind the
+// drawing primitives' backs.
+void screenDamageAll(Screen* s);
+
+// Frame dumps, appended one frame at a time: a binary PPM (P6) image each,
+// which image tools read as a multi-image file, or the SCREEN_BYTES bytes as
+// they are in memory. Both return 0, or -1 on an I/O error.
+int screenWritePpm(const uint8_t* frame, FILE* f);
+int screenWriteRaw(const uint8_t* frame, FILE* f);
+// Incremental frames: only what the last SWBUFF changed, or all of front if
+// full is set, as in a stream's first frame. A rects frame is a byte with the
+// number of rectangles, then each one's x, y, width and height bytes followed
+// by its rows of front. An XOR frame is a 16-bit little-endian length and that
+// many bytes of runs: a byte skip, a byte n and n bytes, meaning skip bytes of
+// the frame are unchanged and the next n change by XOR with the n given.
+// last is the frame before, which the XOR writer keeps up to date.
+int screenWriteRects(const Screen* s, int full, FILE* f);
+int screenWriteXor(const Screen* s, uint8_t* last, int full, FILE* f);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+VM snapshots. A restore is one memcpy per stack, of the bytes below its
+stack pointer; nothing above it can be read before it is written again, so
+a snapshot of a program that built 200 bytes of tables costs 200 bytes to
+take and to restore, whatever the stack size. The screen's buffers are only
+kept once something has been drawn.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "CLAWSNP4"
+
+typedef struct {
+  char magic[8];
+  uint64_t programHash;
+  uint32_t programSize;
+  uint32_t pc;
+  uint32_t sp[NUM_STACKS];
+  uint32_t lastError;
+  int64_t flags;
+  uint32_t callDepth; // followed by that many return byte pcs, then the live bytes
+  uint32_t screen; // color, mode << 8, mirror << 16, drawn << 24, font << 25
+} Header;
+
+static size_t liveBytes(const uint32_t* sp, int drawn) {
+  size_t n = drawn ? 2 * SCREEN_BYTES : 0;
+  for(int i = 0; i < NUM_STACKS; i++)
+    n += sp[i];
+  return n;
+}
+
+// 64-bit FNV-1a
+static uint64_t programHash(const Program* program) {
+  uint64_t h = 14695981039346656037ull;
+  for(uint32_t i = 0; i < program->size; i++) {
+    h ^= program->bytes[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+int snapshotTake(Snapshot* snapshot, const VM* vm) {
+  snapshot->live = malloc(liveBytes(vm->sp, vm->screen.drawn) + 1);
+  if(snapshot->live == NULL)
+    return -1;
+  snapshot->pc = vm->pc;
+  memcpy(snapshot->sp, vm->sp, sizeof(vm->sp));
+  snapshot->callDepth = vm->callDepth;
+  memcpy(snapshot->calls, vm->calls, vm->callDepth * sizeof(uint32_t));
+  snapshot->flags = vm->flags;
+  snapshot->last_error = vm->last_error;
+  snapshot->color = vm->screen.color;
+  snapshot->mode = vm->screen.mode;
+  snapshot->mirror = vm->screen.mirror;
+  snapshot->drawn = vm->screen.drawn;
+  snapshot->font = vm->screen.font;
+  uint8_t* at = snapshot->live;
+  for(int i = 0; i < NUM_STACKS; i++) {
+    memcpy(at, vm->stacks[i], vm->sp[i]);
+    at += vm->sp[i];
+  }
+  if(snapshot->drawn) {
+    memcpy(at, vm->screen.back, SCREEN_BYTES);
+    memcpy(at + SCREEN_BYTES, vm->screen.front, SCREEN_BYTES);
+  }
+  return 0;
+}
+
+int snapshotRestore(const Snapshot* snapshot, VM* vm) {
+  for(int i = 0; i < NUM_STACKS; i++) {
+    if(snapshot->sp[i] >= vm->stackSize[i])
+      return -1;
+  }
+  vm->pc = snapshot->pc;
+  memcpy(vm->sp, snapshot->sp, sizeof(vm->sp));
+  vm->callDepth = snapshot->callDepth;
+  memcpy(vm->calls, snapshot->calls, snapshot->callDepth * sizeof(uint32_t));
+  vm->flags = snapshot->flags;
+  vm->last_error = snapshot->last_error;
+  vm->resumeVerified = 0;
+  const uint8_t* at = snapshot->live;
+  for(int i = 0; i < NUM_STACKS; i++) {
+    memcpy(vm->stacks[i], at, snapshot->sp[i]);
+    at += snapshot->sp[i];
+  }
+  screenReset(&vm->screen);
+  if(snapshot->drawn) {
+    memcpy(vm->screen.back, at, SCREEN_BYTES);
+    memcpy(vm->screen.front, at + SCREEN_BYTES, SCREEN_BYTES);
+    screenDamageAll(&vm->screen);
+  }
+  vm->screen.color = snapshot->color;
+  vm->screen.mode = snapshot->mode;
+  vm->screen.mirror = snapshot->mirror;
+  vm->screen.drawn = snapshot->drawn;
+  vm->screen.font = snapshot->font;
+  return 0;
+}
+
+void snapshotFree(Snapshot* snapshot) {
+  free(snapshot->live);
+  snapshot->live = NULL;
+}
+
+int snapshotSave(const Snapshot* snapshot, const Program* program, FILE* f) {
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.programHash = programHash(program);
+  header.programSize = program->size;
+  header.pc = snapshot->pc;
+  memcpy(header.sp, snapshot->sp, sizeof(header.sp));
+  header.lastError = snapshot->last_error;
+  header.flags = snapshot->flags;
+  header.callDepth = snapshot->callDepth;
+  header.screen = snapshot->color | snapshot->mode << 8 | snapshot->mirror << 16 | (uint32_t)snapshot->drawn << 24 |
+                  (uint32_t)snapshot->font << 25;
+  size_t live = liveBytes(snapshot->sp, snapshot->drawn);
+  if(fwrite(&header, sizeof(header), 1, f) != 1 ||
+     fwrite(snapshot->calls, sizeof(uint32_t), header.callDepth, f) != header.callDepth ||
+     fwrite(snapshot->live, 1, live, f) != live)
+    return -1;
+  return 0;
+}
+
+int snapshotLoad(Snapshot* snapshot, const Program* program, FILE* f) {
+  Header header;
+  if(fread(&header, sizeof(header), 1, f) != 1 ||
+     memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) ||
+     header.programSize != program->size ||
+     header.programHash != programHash(program) || header.lastError > ERR_CALL_UNDERFLOW ||
+     header.callDepth > CALL_DEPTH || header.screen >> 8 & 0xfcfcfe ||
+     fread(snapshot->calls, sizeof(uint32_t), header.callDepth, f) != header.callDepth)
+    return -1;
+  for(int i = 0; i < NUM_STACKS; i++) {
+    if(header.sp[i] >= MAX_STACK_SIZE)
+      return -1;
+  }
+  size_t live = liveBytes(header.sp, header.screen >> 24 & 1);
+  snapshot->live = malloc(live + 1);
+  if(snapshot->live == NULL)
+    return -1;
+  if(fread(snapshot->live, 1, live, f) != live) {
+    snapshotFree(snapshot);
+    return -1;
+  }
+  snapshot->pc = header.pc;
+  memcpy(snapshot->sp, header.sp, sizeof(header.sp));
+  snapshot->callDepth = header.callDepth;
+  snapshot->flags = header.flags;
+  snapshot->last_error = header.lastError;
+  snapshot->color = header.screen;
+  snapshot->mode = header.screen >> 8 & 1;
+  snapshot->mirror = header.screen >> 16 & 3;
+  snapshot->drawn = header.screen >> 24 & 1;
+  snapshot->font = header.screen >> 25;
+  return 0;
+}
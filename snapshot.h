@@ -0,0 +1,39 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "vm.h"
+
+// Everything about a VM that a run can change, so that any number of later
+// runs can start from where one left off: typically the breakpoint after a
+// program's setup, with its tables already built on the stacks. Only the live
+// bytes of each stack are kept, and restoring copies just those back, along
+// with the screen.
+typedef struct {
+  uint32_t pc;
+  uint32_t sp[NUM_STACKS];
+  uint32_t callDepth;
+  uint32_t calls[CALL_DEPTH];
+  int64_t flags;
+  RuntimeError last_error;
+  uint8_t color, mode, mirror, drawn, font; // vm->screen's
+  // the sp[i] live bytes of every stack, one after another, then the screen's
+  // back and front buffers if drawn is set
+  uint8_t* live;
+} Snapshot;
+
+// Returns 0, or -1 if out of memory.
+int snapshotTake(Snapshot* snapshot, const VM* vm);
+// Puts vm (bound to the program the snapshot was taken of) back in that state.
+// Returns 0, or -1 if what was on a stack doesn't fit on vm's.
+int snapshotRestore(const Snapshot* snapshot, VM* vm);
+void snapshotFree(Snapshot* snapshot);
+
+// Snapshot files record which program they belong to (by size and hash) and
+// are in this machine's byte order. Both return 0, or -1 on an I/O error, or,
+// for loading, a file that isn't a snapshot of program or is out of memory.
+int snapshotSave(const Snapshot* snapshot, const Program* program, FILE* f);
+int snapshotLoad(Snapshot* snapshot, const Program* program, FILE* f);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+The BITM/SPRT image cache. An image is looked up by its address in the
+program, and each mirrored, pre-shifted variant of it is decoded on first use
+into rows of words that screenBlit() can mask straight into the screen's rows.
+A game that draws the same sprites every frame decodes each of them at most
+once per alignment and mirror, and after that every blit is word operations.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "sprite.h"
+
+#define MAX_WORDS ((255 + 7 + 63) / 64)
+#define MAX_VARIANT (2 * 255 * MAX_WORDS) // words: a full-size masked image
+
+void spriteFlush(SpriteCache* cache) {
+  for(uint32_t i = 0; cache->slots && cache->count && i < SPRITE_CACHE_SIZE; i++) {
+    Sprite* sprite = &cache->slots[i];
+    if(!sprite->addr)
+      continue;
+    for(int m = 0; m < 4; m++) {
+      for(int shift = 0; shift < 8; shift++)
+        free(sprite->variants[m][shift]);
+    }
+    memset(sprite, 0, sizeof(*sprite));
+    cache->count--;
+  }
+}
+
+void spriteFree(SpriteCache* cache) {
+  spriteFlush(cache);
+  free(cache->slots);
+  cache->slots = NULL;
+}
+
+// the slot for the image at addr, found or claimed; NULL if there is no table
+static Sprite* lookup(SpriteCache* cache, uint32_t addr, int masked) {
+  if(cache->slots == NULL) {
+    cache->slots = calloc(SPRITE_CACHE_SIZE, sizeof(Sprite));
+    if(cache->slots == NULL)
+      return NULL;
+  }
+  // kept at most three quarters full, so probes stay short and always end
+  if(cache->count >= SPRITE_CACHE_SIZE / 4 * 3)
+    spriteFlush(cache);
+  uint32_t i = (addr * 2 + masked) * 2654435761u % SPRITE_CACHE_SIZE;
+  for(;; i = (i + 1) % SPRITE_CACHE_SIZE) {
+    Sprite* sprite = &cache->slots[i];
+    if(sprite->addr == addr + 1 && sprite->masked == masked)
+      return sprite;
+    if(!sprite->addr) {
+      sprite->addr = addr + 1;
+      sprite->masked = masked;
+      cache->count++;
+      return sprite;
+    }
+  }
+}
+
+// Decodes the image (and mask) rows at data into out, mirrored and shifted
+// right by shift pixels.
+static void decode(const uint8_t* data, int width, int height, int masked, int mirror, int shift, int words, uint64_t* out) {
+  int stride = (width + 7) / 8;
+  memset(out, 0, (size_t)(masked + 1) * height * words * sizeof(uint64_t));
+  for(int plane = 0; plane <= masked; plane++) {
+    for(int r = 0; r < height; r++) {
+      const uint8_t* src = data + ((size_t)plane * height + (mirror & MIRROR_Y ? height - 1 - r : r)) * stride;
+      uint64_t* dst = out + ((size_t)plane * height + r) * words;
+      for(int b = 0; b < width; b++) {
+        if(!(src[b / 8] >> (b % 8) & 1))
+          continue;
+        int at = (mirror & MIRROR_X ? width - 1 - b : b) + shift;
+        dst[at / 64] |= 1ull << (at % 64);
+      }
+    }
+  }
+}
+
+int spriteDraw(SpriteCache* cache, Screen* s, const uint8_t* bytes, uint32_t size, uint32_t addr, int masked, int x, int y) {
+  if(addr >= size || size - addr < 2)
+    return -1;
+  int width = bytes[addr], height = bytes[addr + 1];
+  uint32_t length = (uint32_t)(width + 7) / 8 * height * (masked + 1);
+  if(size - addr - 2 < length)
+    return -1;
+  // where it lands once mirrored
+  int left = s->mirror & MIRROR_X ? SCREEN_WIDTH - x - width : x;
+  int top = s->mirror & MIRROR_Y ? SCREEN_HEIGHT - y - height : y;
+  if(!width || !height || left >= SCREEN_WIDTH || left + width <= 0 || top >= SCREEN_HEIGHT || top + height <= 0)
+    return 0;
+  int shift = left & 7, words = (width + 7 + 63) / 64;
+  Sprite* sprite = lookup(cache, addr, masked);
+  uint64_t** variant = sprite ? &sprite->variants[s->mirror][shift] : NULL;
+  uint64_t local[MAX_VARIANT];
+  const uint64_t* rows;
+  if(variant && *variant) {
+    rows = *variant;
+  } else {
+    // decoded into the cache, or just for this once if memory ran out
+    uint64_t* out = variant ? malloc((size_t)(masked + 1) * height * words * sizeof(uint64_t)) : NULL;
+    if(variant)
+      *variant = out;
+    if(out == NULL)
+      out = local;
+    decode(&bytes[addr + 2], width, height, masked, s->mirror, shift, words, out);
+    rows = out;
+  }
+  screenBlit(s, (left - shift) / 8, top, rows, masked ? rows + (size_t)height * words : rows, words, height);
+  return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include <stdint.h>
+#include "screen.h"
+
+// Images for BITM and SPRT, read out of the program image at a byte address:
+// a width byte, a height byte, then height rows of (width + 7) / 8 bytes,
+// pixel x of a row in bit x % 8 of byte x / 8 as on the screen. A SPRT image
+// is followed by a mask of the same shape; BITM images are their own mask.
+#define SPRITE_CACHE_SIZE 256 // images a cache holds before it starts over
+
+// Each image is decoded once, the first time it is drawn with a given mirror
+// and sub-byte alignment, into rows of 64-bit words already mirrored and
+// shifted into place, so drawing it is a few masked word operations a row.
+typedef struct {
+  uint32_t addr; // byte address of the image, plus 1; 0 for an empty slot
+  uint8_t masked; // SPRT's, with a mask of its own
+  // [mirror][x % 8]: height rows of image words, then height rows of mask
+  // words (masked only), each row enough words for width bits shifted by up
+  // to 7; NULL until first drawn that way
+  uint64_t* variants[4][8];
+} Sprite;
+
+// Per VM, since it is filled in as the program runs. Entries are only valid
+// for the program they were decoded from, so vmInit() empties it.
+typedef struct {
+  Sprite* slots; // SPRITE_CACHE_SIZE, hashed by address; NULL until first used
+  uint32_t count;
+} SpriteCache;
+
+// Draws the image at byte addr of bytes (size long) with its top left corner at
+// (x, y), in s's color, mode and mirror. Returns 0, or -1 if the image runs
+// past the end of bytes.
+int spriteDraw(SpriteCache* cache, Screen* s, const uint8_t* bytes, uint32_t size, uint32_t addr, int masked, int x, int y);
+// Empties cache, keeping its table for the next program.
+void spriteFlush(SpriteCache* cache);
+void spriteFree(SpriteCache* cache);
+
+#endif
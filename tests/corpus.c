@@ -0,0 +1,460 @@
+/*
+Builds the programs tests/diff.sh runs through every execution mode, with
+emit.h, and writes each to a file of its own in the directory given:
+
+  corpus [--pool] dir
+
+They are chosen for where the modes could disagree: every arithmetic and
+bitwise operation on edge values, both on constants the JIT folds and on
+values it has to load, with the flags it leaves; loops; faults in the middle
+of a block; instruction pairs that superinstructions would fuse, split by a
+branch target; computed jumps; and RANDOM seeded random programs.
+
+With --pool it writes the three that tests/stress.sh runs many copies of
+through the thread pool instead: one that calls a function in a long loop,
+one that sleeps, and one that faults, each printing a line of its own.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "../bench/emit.h"
+
+#define RANDOM 300
+#define RANDOM_LENGTH 60
+
+static const uint32_t values[] = {
+  0, 1, 2, 3, 7, 0x7f, 0x80, 0xff, 0x100, 0x7fff, 0x8000, 0xffff, 0x7fffffff, 0x80000000, 0xffffffff, 0x12345678,
+};
+static const uint32_t places[] = { 0, 1, 3, 7, 8, 15, 16, 31 };
+
+// the 8-bit opcodes of families with a 16 and a 32-bit one right after
+static const InstructionSet binaries[] = {
+  ADD8, SUB8, MUL8, DIV8, DIVU8, MOD8, MODU8, SR8, SL8, SSR8, AND8, OR8, NOR8, NAND8, XOR8,
+};
+static const InstructionSet unaries[] = { NOT8, NEG8, INC8, DEC8 };
+
+#define COUNT(a) (sizeof(a) / sizeof(a[0]))
+
+// w is 0, 1 or 2 for 8, 16 or 32 bits
+static void let(Emitter* e, int w, unsigned int stack, uint32_t v) {
+  if(w == 0)
+    let8(e, stack, v);
+  else if(w == 1)
+    let16(e, stack, v);
+  else
+    let32(e, stack, v);
+}
+
+// a block boundary, so that the JIT can't fold what comes before into what
+// comes after and no pair fuses across it
+static void boundary(Emitter* e) {
+  branch(e, BR, A, e->size + 4);
+}
+
+// prints z and n if the zero and negative flags are set
+static void flags(Emitter* e) {
+  uint32_t skip = branchForward(e, BRNZ, A);
+  dmpsstr(e, "z");
+  patch(e, skip);
+  skip = branchForward(e, BRNN, A);
+  dmpsstr(e, "n");
+  patch(e, skip);
+}
+
+// prints the flags and pops and prints the w-sized top of A
+static void result(Emitter* e, int w) {
+  flags(e);
+  op(e, DMPN8 + w, A);
+  dmpsstr(e, "\n");
+}
+
+static int isShift(InstructionSet code) {
+  return code == SR8 || code == SL8 || code == SSR8;
+}
+
+static int isDivision(InstructionSet code) {
+  return code == DIV8 || code == DIVU8 || code == MOD8 || code == MODU8;
+}
+
+static void arithmetic(Emitter* e, int folded) {
+  for(int w = 0; w < 3; w++) {
+    uint32_t mask = w == 2 ? UINT32_MAX : (1u << (8 << w)) - 1;
+    for(size_t k = 0; k < COUNT(binaries); k++) {
+      for(size_t i = 0; i < COUNT(values); i++) {
+        size_t n = isShift(binaries[k]) ? COUNT(places) : COUNT(values);
+        for(size_t j = 0; j < n; j++) {
+          uint32_t y = isShift(binaries[k]) ? places[j] : values[j];
+          if(isDivision(binaries[k]) && !(y & mask))
+            continue;
+          let(e, w, A, values[i]);
+          let(e, w, A, y);
+          if(!folded)
+            boundary(e);
+          op(e, binaries[k] + w, A);
+          result(e, w);
+        }
+      }
+    }
+    for(size_t k = 0; k < COUNT(unaries); k++) {
+      for(size_t i = 0; i < COUNT(values); i++) {
+        let(e, w, A, values[i]);
+        if(!folded)
+          boundary(e);
+        op(e, unaries[k] + w, A);
+        result(e, w);
+      }
+    }
+    for(size_t i = 0; i < COUNT(values); i += 3) {
+      for(size_t j = 0; j < COUNT(values); j += 2) {
+        let(e, w, A, values[i]);
+        let(e, w, A, values[j]);
+        if(!folded)
+          boundary(e);
+        op(e, EQU8 + w, A);
+        flags(e);
+        dmpsstr(e, "\n");
+      }
+    }
+  }
+  op(e, END, A);
+}
+
+static void folded(Emitter* e) { arithmetic(e, 1); }
+static void loaded(Emitter* e) { arithmetic(e, 0); }
+
+// sums i * j ^ k over nested counted loops, printing the sum so far after
+// every inner loop
+static void loops(Emitter* e) {
+  let32(e, C, 0);
+  let32(e, D, 40);
+  uint32_t outer = e->size;
+  let32(e, B, 25);
+  uint32_t inner = e->size;
+  op2(e, CPY32, D, C);
+  op2(e, CPY32, B, C);
+  op(e, MUL32, C);
+  let32(e, C, 0x9e3779b9);
+  op(e, XOR32, C);
+  op(e, ADD32, C);
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, inner);
+  op2(e, CPY32, C, A);
+  op(e, DMPN32, A);
+  dmpsstr(e, " ");
+  op(e, DEC32, D);
+  branch(e, BRNZ, D, outer);
+  op(e, END, A);
+}
+
+// LET8 A, 5 and ADD8 A would fuse, but ADD8 is also reached by a branch
+// with another value pushed
+static void splitLet(Emitter* e) {
+  let8(e, A, 7);
+  let8(e, B, 6);
+  uint32_t top = e->size;
+  let8(e, A, 5);
+  uint32_t add = e->size;
+  op(e, ADD8, A);
+  op2(e, CPY8, A, C);
+  op(e, DMPN8, C);
+  dmpsstr(e, " ");
+  op(e, DEC8, B);
+  uint32_t done = branchForward(e, BRZ, B);
+  op2(e, CPY8, B, D);
+  let8(e, D, 1);
+  op(e, AND8, D);
+  branch(e, BRZ, D, top);
+  let8(e, A, 11);
+  branch(e, BR, A, add);
+  patch(e, done);
+  op(e, END, A);
+}
+
+// EQU8 and BRZ would fuse, but BRZ is also reached with the flags STZ set
+static void splitEqu(Emitter* e) {
+  let8(e, B, 6);
+  uint32_t top = e->size;
+  op2(e, CPY8, B, A);
+  let8(e, A, 3);
+  op(e, EQU8, A);
+  uint32_t test = e->size;
+  uint32_t equal = branchForward(e, BRZ, A);
+  dmpsstr(e, "ne ");
+  uint32_t next = branchForward(e, BR, A);
+  patch(e, equal);
+  dmpsstr(e, "eq ");
+  patch(e, next);
+  op(e, DEC8, B);
+  uint32_t done = branchForward(e, BRZ, B);
+  op2(e, CPY8, B, D);
+  let8(e, D, 1);
+  op(e, AND8, D);
+  branch(e, BRZ, D, top);
+  op(e, STZ, A);
+  branch(e, BR, A, test);
+  patch(e, done);
+  op(e, END, A);
+}
+
+// DEC8 and BRNZ would fuse, but BRNZ is also reached with the flags CLZ set
+static void splitDec(Emitter* e) {
+  let8(e, C, 2);
+  let8(e, B, 4);
+  uint32_t top = e->size;
+  op2(e, CPY8, B, A);
+  op(e, DMPN8, A);
+  dmpsstr(e, " ");
+  op(e, DEC8, B);
+  uint32_t test = e->size;
+  branch(e, BRNZ, B, top);
+  dmpsstr(e, "| ");
+  op(e, DEC8, C);
+  uint32_t done = branchForward(e, BRZ, C);
+  let8(e, B, 3);
+  op(e, CLZ, A);
+  branch(e, BR, A, test);
+  patch(e, done);
+  op(e, END, A);
+}
+
+// loops by JMPing to the address a PPTR pushed, and to one pushed with LET32
+static void jumps(Emitter* e) {
+  let8(e, B, 4);
+  op(e, PPTR, C); // the pc of the instruction after it
+  op2(e, CPY8, B, A);
+  op(e, DMPN8, A);
+  dmpsstr(e, " ");
+  op(e, DEC8, B);
+  uint32_t done = branchForward(e, BRZ, B);
+  op2(e, CPY32, C, C);
+  op(e, JMP, C);
+  patch(e, done);
+  let8(e, B, 3);
+  uint32_t again = e->size;
+  op(e, DEC8, B);
+  uint32_t out = branchForward(e, BRZ, B);
+  dmpsstr(e, "j ");
+  let32(e, A, again);
+  op(e, JMP, A);
+  patch(e, out);
+  op(e, END, A);
+}
+
+// faults, each after printing something, in the middle of a block
+
+static void underflow(Emitter* e) {
+  let8(e, A, 5);
+  let8(e, A, 6);
+  op(e, ADD8, A);
+  op2(e, CPY8, A, B);
+  op(e, DMPN8, B);
+  op(e, ADD8, A);
+  dmpsstr(e, "unreachable");
+  op(e, END, A);
+}
+
+static void underflowMove(Emitter* e) {
+  let32(e, A, 1);
+  let32(e, A, 2);
+  op(e, ADD32, A);
+  op2(e, CPY32, A, C);
+  op(e, DMPN32, C);
+  op2(e, MOV32, B, A);
+  op(e, END, A);
+}
+
+static void overflow(Emitter* e) {
+  dmpsstr(e, "pushing ");
+  let32(e, B, 1000);
+  uint32_t top = e->size;
+  let32(e, A, 1);
+  let32(e, C, 2);
+  let32(e, A, 3);
+  op(e, ADD32, A);
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, top);
+  op(e, END, A);
+}
+
+static void badJump(Emitter* e) {
+  let8(e, A, 9);
+  op(e, DMPN8, A);
+  let32(e, A, 0xfffff0);
+  op(e, JMP, A);
+  op(e, END, A);
+}
+
+typedef struct {
+  const char* name;
+  void (*build)(Emitter* e);
+} Case;
+
+static const Case cases[] = {
+  { "folded", folded },
+  { "loaded", loaded },
+  { "loops", loops },
+  { "split-let", splitLet },
+  { "split-equ", splitEqu },
+  { "split-dec", splitDec },
+  { "jumps", jumps },
+  { "underflow", underflow },
+  { "underflow-move", underflowMove },
+  { "overflow", overflow },
+  { "bad-jump", badJump },
+};
+
+// ---- random programs ----
+
+static uint64_t state;
+
+static uint32_t below(uint32_t n) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return (uint32_t)((state * 0x2545f4914f6cdd1dull) >> 32) % n;
+}
+
+static const InstructionSet operations[] = {
+  ADD8, SUB8, MUL8, SR8, SL8, SSR8, AND8, OR8, NOR8, NAND8, XOR8, NOT8, NEG8, INC8, DEC8, EQU8,
+};
+static const InstructionSet moves[] = { CPY8, MOV8, SWP8, DEL8 };
+static const InstructionSet flagOps[] = { STZ, STN, CLZ, CLN, TGZ, TGN };
+static const InstructionSet branches[] = { BR, BRZ, BRNZ, BRN, BRNN };
+
+// RANDOM_LENGTH random instructions on stacks full of random values, with
+// forward branches only, so that it ends, then what is left on the stacks
+static void randomProgram(Emitter* e, uint32_t seed) {
+  state = seed * 0x9e3779b97f4a7c15ull + 1;
+  for(unsigned int s = 0; s < 4; s++) {
+    for(int i = 0; i < 10; i++)
+      let32(e, s, below(UINT32_MAX));
+  }
+  uint32_t after[RANDOM_LENGTH];
+  int target[RANDOM_LENGTH], pending = 0;
+  for(int i = 0; i < RANDOM_LENGTH; i++) {
+    for(int k = 0; k < pending; k++) {
+      if(target[k] == i) {
+        patch(e, after[k]);
+        after[k] = after[--pending];
+        target[k--] = target[pending];
+      }
+    }
+    unsigned int s = below(4), d = below(4), w = below(3), kind = below(100);
+    if(kind < 25)
+      let(e, w, s, below(2) ? values[below(COUNT(values))] : below(UINT32_MAX));
+    else if(kind < 50)
+      op2(e, operations[below(COUNT(operations))] + w, s, d);
+    else if(kind < 65)
+      op2(e, moves[below(COUNT(moves))] + w, s, d);
+    else if(kind < 72)
+      op2(e, flagOps[below(COUNT(flagOps))], s, d);
+    else if(kind < 85) {
+      after[pending] = branchForward(e, branches[below(COUNT(branches))], s);
+      target[pending++] = i + 1 + below(RANDOM_LENGTH - i);
+    } else if(kind < 95)
+      op2(e, DMPN8 + w, s, d);
+    else if(kind < 97)
+      op2(e, below(2) ? ENDZ : ENDN, s, d);
+    else
+      op2(e, PPTR, s, d);
+  }
+  for(int k = 0; k < pending; k++)
+    patch(e, after[k]);
+  for(unsigned int s = 0; s < 4; s++) {
+    dmpsstr(e, "|");
+    for(int i = 0; i < 3; i++)
+      op(e, DMPN8, s);
+  }
+  op(e, END, A);
+}
+
+static int save(const char* dir, const char* name, const Emitter* e) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s.bin", dir, name);
+  FILE* f = fopen(path, "wb");
+  if(f == NULL || fwrite(e->bytes, 1, e->size, f) != e->size || fclose(f)) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+// ---- for the thread pool ----
+
+// CALLs a function that INC32s C SPINS times, then prints spin and the count,
+// so that it has slices to take with --slice
+#define SPINS 3000
+static void spin(Emitter* e) {
+  let32(e, B, SPINS);
+  let32(e, C, 0);
+  uint32_t top = e->size;
+  uint32_t call = branchForward(e, CALL, A);
+  op(e, DEC32, B);
+  branch(e, BRNZ, B, top);
+  dmpsstr(e, "spin ");
+  op(e, DMPN32, C);
+  dmpsstr(e, "\n");
+  op(e, END, A);
+  patch(e, call);
+  op(e, INC32, C);
+  op(e, RET, A);
+}
+
+// sleeps for a few ms at a time, once past the wheel, and for no time at all
+static void naps(Emitter* e) {
+  static const uint32_t ms[] = { 0, 0, 2, 2, 2, 2, 2, 300, 200, 200 };
+  for(size_t i = 0; i < COUNT(ms); i++) {
+    let32(e, A, ms[i]);
+    op(e, SLEEP, A);
+  }
+  dmpsstr(e, "naps\n");
+  op(e, END, A);
+}
+
+static void fault(Emitter* e) {
+  dmpsstr(e, "fault\n");
+  let8(e, A, 1);
+  op(e, ADD8, A);
+  op(e, END, A);
+}
+
+static const Case pool[] = {
+  { "spin", spin },
+  { "naps", naps },
+  { "fault", fault },
+};
+
+int main(int argc, char* argv[]) {
+  int forPool = argc == 3 && !strcmp(argv[1], "--pool");
+  if(argc != 2 && !forPool) {
+    fputs("usage: corpus [--pool] dir\n", stderr);
+    return 2;
+  }
+  if(forPool) {
+    for(size_t i = 0; i < COUNT(pool); i++) {
+      Emitter e = {0};
+      pool[i].build(&e);
+      if(save(argv[2], pool[i].name, &e))
+        return 1;
+      free(e.bytes);
+    }
+    return 0;
+  }
+  for(size_t i = 0; i < COUNT(cases); i++) {
+    Emitter e = {0};
+    cases[i].build(&e);
+    if(save(argv[1], cases[i].name, &e))
+      return 1;
+    free(e.bytes);
+  }
+  for(uint32_t seed = 0; seed < RANDOM; seed++) {
+    Emitter e = {0};
+    char name[32];
+    randomProgram(&e, seed);
+    snprintf(name, sizeof(name), "random-%03u", seed);
+    if(save(argv[1], name, &e))
+      return 1;
+    free(e.bytes);
+  }
+  return 0;
+}
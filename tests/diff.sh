@@ -0,0 +1,46 @@
+#!/bin/sh
+# Differential test of the execution modes: runs every program tests/corpus
+# builds in each mode, and on the switch interpreter, and checks that each
+# prints the same output, runtime errors and their pcs included, and exits
+# with the same status as the plain interpreter without superinstructions
+# or verification.
+#
+#   sh tests/diff.sh [vm [switch-vm]]
+
+VM=${1:-./vm}
+SWITCH=${2:-tests/vm-switch}
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+tests/corpus "$dir" || exit 1
+
+failed=0
+count=0
+for program in "$dir"/*.bin; do
+  count=$((count + 1))
+  expected=$($VM --no-verify --no-fuse "$program" </dev/null 2>&1; echo "exit $?")
+  while read -r run; do
+    got=$($run "$program" </dev/null 2>&1; echo "exit $?")
+    if [ "$got" != "$expected" ]; then
+      echo "$(basename "$program"): '$run' differs from '$VM --no-verify --no-fuse'"
+      failed=1
+    fi
+  done <<MODES
+$VM
+$VM --no-fuse
+$VM --no-verify
+$VM --tos-cache
+$VM --tos-cache --no-verify
+$VM --tos-cache --no-fuse
+$VM --jit
+$VM --jit --no-fuse
+$VM --jit --no-verify
+$SWITCH
+$SWITCH --no-fuse
+$SWITCH --no-verify
+$SWITCH --tos-cache
+$SWITCH --jit
+MODES
+done
+[ $failed = 0 ] && echo "diff: $count programs, same in every mode"
+exit $failed
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Stress test of the thread pool: runs many copies of the programs
+# tests/corpus --pool builds at once, with a range of thread counts and
+# slices, in virtual and real time, and checks that every copy ran to its
+# end, printed its line once and, for the one that faults, had its error
+# reported.
+#
+#   sh tests/stress.sh [vm]
+
+VM=${1:-./vm}
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+tests/corpus --pool "$dir" || exit 1
+
+failed=0
+runs=0
+# runs the pool with the options given, n copies of each program
+check() {
+  n=$1
+  shift
+  runs=$((runs + 1))
+  out=$($VM "$@" -n "$n" "$dir/spin.bin" "$dir/naps.bin" "$dir/fault.bin" </dev/null 2>&1)
+  for line in '^spin 3000$' '^naps$' '^fault$' 'fault\.bin#[0-9]*: Runtime error: stack underflow at PC '; do
+    got=$(printf '%s\n' "$out" | grep -c "$line")
+    if [ "$got" != "$n" ]; then
+      echo "'$*': $got lines match '$line', not $n"
+      failed=1
+    fi
+  done
+  lines=$(printf '%s\n' "$out" | wc -l)
+  if [ "$lines" != $((4 * n)) ]; then
+    echo "'$*': $lines lines of output, not $((4 * n))"
+    failed=1
+  fi
+}
+
+for threads in 1 2 4 8; do
+  check 200 --virtual-time -j $threads
+  for slice in 1 7 1000; do
+    check 200 --virtual-time -j $threads --slice $slice
+  done
+done
+check 50 -j 4
+check 50 -j 3 --slice 5
+
+[ $failed = 0 ] && echo "stress: $runs pool runs, every copy accounted for"
+exit $failed
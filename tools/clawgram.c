@@ -0,0 +1,156 @@
+/*
+Opcode n-gram miner: runs a CLAW program in MODE_TRACED and counts which
+opcode pairs and triples execute back to back, to find candidates for new
+superinstructions (see FUSED_OPS in program.h).
+
+  clawgram [-t top] program
+
+Only fall-through sequences are counted: a pair whose second instruction was
+reached by a taken branch or jump can't be fused, so it is not a candidate.
+The program runs unfused, so every count is in terms of real CLAW opcodes.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../bytecode.h"
+#include "../vm.h"
+#include "../image.h"
+
+#define OPCODES 0x1000 // the 12-bit CLAW opcode space
+#define SLOTS 65536 // distinct n-grams counted; far more than any program has
+
+// pairs and triples share one open-addressed table, keyed by their opcodes
+// packed 12 bits each, with a leading 1 to tell the arities apart
+typedef struct {
+  uint64_t key[SLOTS];
+  uint64_t n[SLOTS];
+} Table;
+
+typedef struct {
+  const Program* program;
+  uint32_t next; // byte pc the last instruction falls through to
+  unsigned int last[2]; // last two opcodes of the current run, most recent first
+  unsigned int run; // length of the current fall-through run, up to 2
+  uint64_t executed;
+  uint64_t dropped; // n-grams that didn't fit in the table
+  Table grams;
+} Counts;
+
+static void bump(Counts* c, uint64_t key) {
+  size_t slot = (key * 0x9e3779b97f4a7c15ull) >> 48;
+  for(size_t i = 0; i < SLOTS; i++, slot = (slot + 1) % SLOTS) {
+    if(c->grams.key[slot] == key || c->grams.key[slot] == 0) {
+      c->grams.key[slot] = key;
+      c->grams.n[slot]++;
+      return;
+    }
+  }
+  c->dropped++;
+}
+
+static void count(void* arg, uint32_t pc, unsigned int op) {
+  Counts* c = arg;
+  if(op >= OPCODES)
+    return; // internal handlers stand for no instruction of their own
+  c->executed++;
+  if(pc != c->next)
+    c->run = 0;
+  if(c->run >= 1)
+    bump(c, 1ull << 24 | c->last[0] << 12 | op);
+  if(c->run >= 2)
+    bump(c, 1ull << 36 | (uint64_t)c->last[1] << 24 | c->last[0] << 12 | op);
+  c->last[1] = c->last[0];
+  c->last[0] = op;
+  if(c->run < 2)
+    c->run++;
+  Insn insn;
+  c->next = decodeInsn(c->program->bytes, c->program->size, pc, &insn);
+  if(op == LETA)
+    c->next = UINT32_MAX; // where it ends depends on the length it pops
+}
+
+typedef struct {
+  uint64_t n;
+  unsigned int ops[3];
+} Gram;
+
+static int byCount(const void* a, const void* b) {
+  uint64_t x = ((const Gram*)a)->n, y = ((const Gram*)b)->n;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static const char* name(unsigned int op) {
+  const char* s = opcodeName(op);
+  return s ? s : "?";
+}
+
+static void report(const char* title, Gram* grams, size_t n, int arity, size_t top, uint64_t executed) {
+  qsort(grams, n, sizeof(Gram), byCount);
+  printf("%s\n", title);
+  for(size_t i = 0; i < n && i < top; i++) {
+    char label[64] = "";
+    for(int k = 0; k < arity; k++) {
+      strcat(label, k ? " " : "");
+      strcat(label, name(grams[i].ops[k]));
+    }
+    printf("  %-28s %12llu %6.2f%%\n", label, (unsigned long long)grams[i].n,
+           executed ? grams[i].n * 100.0 / executed : 0.0);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  size_t top = 20;
+  int first = 1;
+  if(first + 1 < argc && !strcmp(argv[first], "-t")) {
+    top = atoi(argv[first + 1]);
+    first += 2;
+  }
+  if(first >= argc) {
+    printf("usage: clawgram [-t top] program\n");
+    return 1;
+  }
+
+  Image image;
+  if(imageOpen(&image, argv[first])) {
+    printf("Error opening input file\n");
+    return 1;
+  }
+
+  Program program;
+  if(programLoad(&program, image.bytes, image.size)) {fputs ("Memory error",stderr); exit (2);}
+  static Counts counts;
+  counts.program = &program;
+
+  static VM vm;
+  if(vmCreate(&vm, NULL)) {fputs ("Memory error",stderr); exit (2);}
+  vmInit(&vm, &program);
+  vm.mode = MODE_TRACED;
+  vm.trace = count;
+  vm.traceArg = &counts;
+  vmRun(&vm);
+  fflush(stdout);
+  if(vm.last_error != NONE)
+    fprintf(stderr, "runtime error %d at %x, counts are up to there\n", vm.last_error, vm.pc);
+
+  static Gram pairs[SLOTS], triples[SLOTS];
+  size_t pairCount = 0, tripleCount = 0;
+  for(size_t i = 0; i < SLOTS; i++) {
+    uint64_t key = counts.grams.key[i];
+    if(key >> 36)
+      triples[tripleCount++] = (Gram){ counts.grams.n[i], { key >> 24 & 0xfff, key >> 12 & 0xfff, key & 0xfff } };
+    else if(key)
+      pairs[pairCount++] = (Gram){ counts.grams.n[i], { key >> 12 & 0xfff, key & 0xfff } };
+  }
+  printf("\n%llu instructions executed\n", (unsigned long long)counts.executed);
+  if(counts.dropped)
+    printf("%llu n-grams not counted, the table is full\n", (unsigned long long)counts.dropped);
+  report("pairs", pairs, pairCount, 2, top, counts.executed);
+  report("triples", triples, tripleCount, 3, top, counts.executed);
+
+  vmDestroy(&vm);
+  programFree(&program);
+  imageClose(&image);
+  return 0;
+}
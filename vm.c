@@ -15,835 +15,656 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 This software can be relicensed on request; contact the author.
 */
 
+#define _DEFAULT_SOURCE
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "bytecode.h"
+#include "vm.h"
+#include "jit.h"
+#include "array.h"
 
-#define NUM_STACKS 4
-#define STACK_SIZE 1024 // in bytes
-uint32_t pc = 0;
-uint32_t sp[NUM_STACKS] = {0}; // stack pointers always point to the next free position
-uint8_t stacks[NUM_STACKS][STACK_SIZE];
-
-// these are actually used as a bool, their size doesn't matter as long as it's at least 1 bit wide
-unsigned int flag_zero;
-unsigned int flag_negative;
-
-void updateFlags(int32_t value) {
-  flag_zero = !value;
-  flag_negative = value < 0;
+// reading and building the lazy flags of VM.flags
+static inline int isZero(int64_t flags) {
+  return (uint32_t)flags == 0;
 }
 
-typedef enum {
-  NONE = 0,
-  ERR_ARITHMETIC,
-  ERR_STACK_OVERFLOW,
-  ERR_STACK_UNDERFLOW,
-  ERR_INSUFFICIENT_PERMISSIONS,
-  ERR_TARGET, // PC out of bounds
-} RuntimeError;
-RuntimeError last_error = NONE;
-
-
-// TODO make fetch check program bounds
-static uint32_t fetch8bitLiteral(uint8_t* p) {
-  return p[pc++];
+static inline int isNegative(int64_t flags) {
+  return flags < 0;
 }
 
-static uint32_t fetch16bitLiteral(uint8_t* p) {
-  pc += 2;
-  return p[pc - 2] | p[pc - 1] << 8;
+static inline int64_t flagsOf(int zero, int negative) {
+  return negative ? (zero ? INT64_MIN : -1) : !zero;
 }
 
-static uint32_t fetch32bitLiteral(uint8_t* p) {
-  pc += 4;
-  return p[pc - 4] | p[pc - 3]<<8 | p[pc - 2]<<16 | p[pc - 1]<<24;
-}
-
-static void stackPush8bit(unsigned int stack, uint8_t value) {
-  if(++sp[stack] >= STACK_SIZE) {
-    last_error = ERR_STACK_OVERFLOW;
+static void stackPush8bit(VM* vm, unsigned int stack, uint8_t value) {
+  if(++vm->sp[stack] >= vm->stackSize[stack]) {
+    vm->last_error = ERR_STACK_OVERFLOW;
     return;
   }
-  stacks[stack][sp[stack] - 1] = value;
+  vm->stacks[stack][vm->sp[stack] - 1] = value;
 }
 
-static void stackPush16bit(unsigned int stack, uint16_t value) {
-  if(sp[stack] + sizeof(uint16_t) >= STACK_SIZE) {
-    last_error = ERR_STACK_OVERFLOW;
+static void stackPush16bit(VM* vm, unsigned int stack, uint16_t value) {
+  if(vm->sp[stack] + sizeof(uint16_t) >= vm->stackSize[stack]) {
+    vm->last_error = ERR_STACK_OVERFLOW;
     return;
   }
-  memcpy(&stacks[stack][sp[stack]], &value, sizeof(uint16_t));
-  sp[stack] += sizeof(uint16_t);
+  memcpy(&vm->stacks[stack][vm->sp[stack]], &value, sizeof(uint16_t));
+  vm->sp[stack] += sizeof(uint16_t);
 }
 
-static void stackPush32bit(unsigned int stack, uint32_t value) {
-  if(sp[stack] + sizeof(uint32_t) >= STACK_SIZE) {
-    last_error = ERR_STACK_OVERFLOW;
+static void stackPush32bit(VM* vm, unsigned int stack, uint32_t value) {
+  if(vm->sp[stack] + sizeof(uint32_t) >= vm->stackSize[stack]) {
+    vm->last_error = ERR_STACK_OVERFLOW;
     return;
   }
-  memcpy(&stacks[stack][sp[stack]], &value, sizeof(uint32_t));
-  sp[stack] += sizeof(uint32_t);
+  memcpy(&vm->stacks[stack][vm->sp[stack]], &value, sizeof(uint32_t));
+  vm->sp[stack] += sizeof(uint32_t);
 }
 
-static uint8_t stackPeek8bit(unsigned int stack) {
-  if(!sp[stack]) {
-    last_error = ERR_STACK_UNDERFLOW;
+static uint8_t stackPeek8bit(VM* vm, unsigned int stack) {
+  if(!vm->sp[stack]) {
+    vm->last_error = ERR_STACK_UNDERFLOW;
     return 0;
   }
-  return stacks[stack][sp[stack]-1];
+  return vm->stacks[stack][vm->sp[stack]-1];
 }
 
-static uint16_t stackPeek16bit(unsigned int stack) {
-  if(sp[stack] < sizeof(uint16_t)) {
-    last_error = ERR_STACK_UNDERFLOW;
+static uint16_t stackPeek16bit(VM* vm, unsigned int stack) {
+  if(vm->sp[stack] < sizeof(uint16_t)) {
+    vm->last_error = ERR_STACK_UNDERFLOW;
     return 0;
   }
   uint16_t value;
-  memcpy(&value, &stacks[stack][sp[stack]-sizeof(uint16_t)], sizeof(uint16_t));
+  memcpy(&value, &vm->stacks[stack][vm->sp[stack]-sizeof(uint16_t)], sizeof(uint16_t));
   return value;
 }
 
-static uint32_t stackPeek32bit(unsigned int stack) {
-  if(sp[stack] < sizeof(uint32_t)) {
-    last_error = ERR_STACK_UNDERFLOW;
+static uint32_t stackPeek32bit(VM* vm, unsigned int stack) {
+  if(vm->sp[stack] < sizeof(uint32_t)) {
+    vm->last_error = ERR_STACK_UNDERFLOW;
     return 0;
   }
   uint32_t value;
-  memcpy(&value, &stacks[stack][sp[stack]-sizeof(uint32_t)], sizeof(uint32_t));
+  memcpy(&value, &vm->stacks[stack][vm->sp[stack]-sizeof(uint32_t)], sizeof(uint32_t));
   return value;
 }
 
-static uint8_t stackPop8bit(unsigned int stack) {
-  if(!sp[stack]) {
-    last_error = ERR_STACK_UNDERFLOW;
+static uint8_t stackPop8bit(VM* vm, unsigned int stack) {
+  if(!vm->sp[stack]) {
+    vm->last_error = ERR_STACK_UNDERFLOW;
     return 0;
   }
-  return stacks[stack][--sp[stack]];
+  return vm->stacks[stack][--vm->sp[stack]];
 }
 
-static uint16_t stackPop16bit(unsigned int stack) {
-  if(sp[stack] < sizeof(uint16_t)) {
-    last_error = ERR_STACK_UNDERFLOW;
+static uint16_t stackPop16bit(VM* vm, unsigned int stack) {
+  if(vm->sp[stack] < sizeof(uint16_t)) {
+    vm->last_error = ERR_STACK_UNDERFLOW;
     return 0;
   }
   uint16_t value;
-  sp[stack] -= sizeof(uint16_t);
-  memcpy(&value, &stacks[stack][sp[stack]], sizeof(uint16_t));
+  vm->sp[stack] -= sizeof(uint16_t);
+  memcpy(&value, &vm->stacks[stack][vm->sp[stack]], sizeof(uint16_t));
   return value;
 }
-static uint32_t stackPop32bit(unsigned int stack) {
-  if(sp[stack] < sizeof(uint32_t)) {
-    last_error = ERR_STACK_UNDERFLOW;
+static uint32_t stackPop32bit(VM* vm, unsigned int stack) {
+  if(vm->sp[stack] < sizeof(uint32_t)) {
+    vm->last_error = ERR_STACK_UNDERFLOW;
     return 0;
   }
   uint32_t value;
-  sp[stack] -= sizeof(uint32_t);
-  memcpy(&value, &stacks[stack][sp[stack]], sizeof(uint32_t));
+  vm->sp[stack] -= sizeof(uint32_t);
+  memcpy(&value, &vm->stacks[stack][vm->sp[stack]], sizeof(uint32_t));
   return value;
 }
 
-static void run(uint8_t* program, uint32_t buflen) {
-  pc = 0;
-  last_error = NONE;
-  updateFlags(0); // reset flags
-  while(pc < buflen) {
-    if(last_error != NONE) {
+// overwrite the top element; callers have already checked it exists
+// (GCC can't see that through the error checks, and may warn about the paths
+// where sp would have wrapped)
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#endif
+static void stackPoke8bit(VM* vm, unsigned int stack, uint8_t value) {
+  vm->stacks[stack][vm->sp[stack] - 1] = value;
+}
+
+static void stackPoke16bit(VM* vm, unsigned int stack, uint16_t value) {
+  memcpy(&vm->stacks[stack][vm->sp[stack] - sizeof(uint16_t)], &value, sizeof(uint16_t));
+}
+
+static void stackPoke32bit(VM* vm, unsigned int stack, uint32_t value) {
+  memcpy(&vm->stacks[stack][vm->sp[stack] - sizeof(uint32_t)], &value, sizeof(uint32_t));
+}
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+// Top-of-stack cache for the TOS_CACHE interpreter. The last stack pushed to
+// is "owned": its stack pointer and top element live in locals, so a chain
+// like LET32, LET32, ADD32, MUL32 hands its operands over in registers instead
+// of storing and reloading both the values and sp through memory. While a
+// stack is owned, vm->sp[stack] and the top element's bytes are stale until
+// tosSpill() writes them back. The other stacks are used in place.
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define LIKELY(x) __builtin_expect(!!(x), 1)
+#else
+#define ALWAYS_INLINE inline
+#define LIKELY(x) (x)
+#endif
+
+typedef struct {
+  int stack; // owned stack, -1 for none
+  uint32_t sp; // its stack pointer
+  uint32_t value; // its top element...
+  uint32_t size; // ...if this is non-zero
+} Tos;
+
+static ALWAYS_INLINE void tosWriteBack(VM* vm, Tos* tos) {
+  uint8_t* at = &vm->stacks[tos->stack][tos->sp - tos->size];
+  if(tos->size == sizeof(uint8_t)) {
+    *at = tos->value;
+  } else if(tos->size == sizeof(uint16_t)) {
+    uint16_t v = tos->value;
+    memcpy(at, &v, sizeof(uint16_t));
+  } else if(tos->size == sizeof(uint32_t)) {
+    memcpy(at, &tos->value, sizeof(uint32_t));
+  }
+  tos->size = 0;
+}
+
+static ALWAYS_INLINE void tosSpill(VM* vm, Tos* tos) {
+  if(tos->stack < 0)
+    return;
+  tosWriteBack(vm, tos);
+  vm->sp[tos->stack] = tos->sp;
+  tos->stack = -1;
+}
+
+static ALWAYS_INLINE void tosPush(VM* vm, Tos* tos, unsigned int stack, uint32_t size, uint32_t value) {
+  if(!LIKELY(tos->stack == (int)stack)) {
+    if(vm->sp[stack] + size >= vm->stackSize[stack]) {
+      vm->last_error = ERR_STACK_OVERFLOW;
+      return;
+    }
+    tosSpill(vm, tos);
+    tos->stack = stack;
+    tos->sp = vm->sp[stack];
+  } else {
+    if(tos->sp + size >= vm->stackSize[stack]) {
+      vm->last_error = ERR_STACK_OVERFLOW;
       return;
     }
-    uint16_t instruction = program[pc] | (program[pc + 1] << 8);
-    pc += 2;
-    uint16_t destination = instruction & 3;
-    uint16_t source = (instruction & 12) >> 2;
-    uint16_t code = instruction >> 4;
+    tosWriteBack(vm, tos);
+  }
+  tos->value = value;
+  tos->size = size;
+  tos->sp += size;
+}
+
+// reads the element below the cached one, or the top of an owned stack with nothing cached
+static ALWAYS_INLINE uint32_t tosLoad(VM* vm, Tos* tos, uint32_t at, uint32_t size) {
+  const uint8_t* p = &vm->stacks[tos->stack][at];
+  if(size == sizeof(uint8_t))
+    return *p;
+  if(size == sizeof(uint16_t)) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(uint16_t));
+    return v;
+  }
+  uint32_t v;
+  memcpy(&v, p, sizeof(uint32_t));
+  return v;
+}
+
+static ALWAYS_INLINE uint32_t tosPop(VM* vm, Tos* tos, unsigned int stack, uint32_t size) {
+  if(!LIKELY(tos->stack == (int)stack)) {
+    if(size == sizeof(uint8_t))
+      return stackPop8bit(vm, stack);
+    if(size == sizeof(uint16_t))
+      return stackPop16bit(vm, stack);
+    return stackPop32bit(vm, stack);
+  }
+  if(LIKELY(tos->size == size)) {
+    tos->size = 0;
+    tos->sp -= size;
+    return tos->value;
+  }
+  tosWriteBack(vm, tos);
+  if(tos->sp < size) {
+    vm->last_error = ERR_STACK_UNDERFLOW;
+    return 0;
+  }
+  tos->sp -= size;
+  return tosLoad(vm, tos, tos->sp, size);
+}
+
+static ALWAYS_INLINE uint32_t tosPeek(VM* vm, Tos* tos, unsigned int stack, uint32_t size) {
+  if(tos->stack != (int)stack) {
+    if(size == sizeof(uint8_t))
+      return stackPeek8bit(vm, stack);
+    if(size == sizeof(uint16_t))
+      return stackPeek16bit(vm, stack);
+    return stackPeek32bit(vm, stack);
+  }
+  if(tos->size == size)
+    return tos->value;
+  tosWriteBack(vm, tos);
+  if(tos->sp < size) {
+    vm->last_error = ERR_STACK_UNDERFLOW;
+    return 0;
+  }
+  return tosLoad(vm, tos, tos->sp - size, size);
+}
+
+// overwrites the element a successful tosPeek() of the same size just read
+static ALWAYS_INLINE void tosPoke(VM* vm, Tos* tos, unsigned int stack, uint32_t size, uint32_t value) {
+  if(tos->stack != (int)stack) {
+    if(size == sizeof(uint8_t))
+      stackPoke8bit(vm, stack, value);
+    else if(size == sizeof(uint16_t))
+      stackPoke16bit(vm, stack, value);
+    else
+      stackPoke32bit(vm, stack, value);
+    return;
+  }
+  // cache it: the element is already in place, so just mark it as the cached top
+  tos->value = value;
+  tos->size = size;
+}
+
+// Stack access without any bounds checks, for programs programVerify() has
+// shown never leave a stack's bounds.
+static ALWAYS_INLINE void rawPush(VM* vm, unsigned int stack, uint32_t size, uint32_t value) {
+  uint8_t* at = &vm->stacks[stack][vm->sp[stack]];
+  if(size == sizeof(uint8_t)) {
+    *at = value;
+  } else if(size == sizeof(uint16_t)) {
+    uint16_t v = value;
+    memcpy(at, &v, sizeof(uint16_t));
+  } else {
+    memcpy(at, &value, sizeof(uint32_t));
+  }
+  vm->sp[stack] += size;
+}
+
+static ALWAYS_INLINE uint32_t rawPeek(VM* vm, unsigned int stack, uint32_t size) {
+  const uint8_t* at = &vm->stacks[stack][vm->sp[stack] - size];
+  if(size == sizeof(uint8_t))
+    return *at;
+  if(size == sizeof(uint16_t)) {
+    uint16_t v;
+    memcpy(&v, at, sizeof(uint16_t));
+    return v;
+  }
+  uint32_t v;
+  memcpy(&v, at, sizeof(uint32_t));
+  return v;
+}
+
+static ALWAYS_INLINE uint32_t rawPop(VM* vm, unsigned int stack, uint32_t size) {
+  uint32_t v = rawPeek(vm, stack, size);
+  vm->sp[stack] -= size;
+  return v;
+}
+
+// Program output. DMPN* and DMPSSTR append to vm->out, which is written out
+// whenever the next piece wouldn't fit, before GETN* waits for input, and when
+// vmRun() returns. Numbers are formatted two digits at a time instead of going
+// through printf(). With vm->outFd at -1, both go through stdio as they used to;
+// with vm->output set, the buffer goes to it instead of to outFd.
+static const char digitPairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static void writeAll(int fd, const char* bytes, size_t length) {
+  while(length) {
+    ssize_t n = write(fd, bytes, length);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return; // nobody to tell; printf() never reported it either
+    bytes += n;
+    length -= n;
+  }
+}
+
+static void outWrite(VM* vm, const char* bytes, uint32_t length) {
+  if(vm->output)
+    vm->output(vm->outputArg, bytes, length);
+  else
+    writeAll(vm->outFd, bytes, length);
+}
+
+static void outFlush(VM* vm) {
+  outWrite(vm, vm->out, vm->outLength);
+  vm->outLength = 0;
+}
+
+// SLEEP_WAIT, with everything printed so far out first
+static void sleepFor(VM* vm, uint32_t ms) {
+  if(vm->outFd < 0)
+    fflush(stdout);
+  else if(vm->outLength)
+    outFlush(vm);
+  struct timespec left = { ms / 1000, ms % 1000 * 1000000L };
+  while(nanosleep(&left, &left) && errno == EINTR)
+    ;
+}
+
+static void outBytes(VM* vm, const uint8_t* bytes, uint32_t length) {
+  if(vm->outFd < 0) {
+    fwrite(bytes, 1, length, stdout);
+    return;
+  }
+  if(length > OUT_BUFFER_SIZE - vm->outLength) {
+    outFlush(vm);
+    if(length > OUT_BUFFER_SIZE) {
+      outWrite(vm, (const char*)bytes, length);
+      return;
+    }
+  }
+  memcpy(&vm->out[vm->outLength], bytes, length);
+  vm->outLength += length;
+}
+
+static void outNumber(VM* vm, uint32_t n) {
+  if(vm->outFd < 0) {
+    printf("%u", n);
+    return;
+  }
+  char digits[10]; // UINT32_MAX has 10
+  char* at = digits + sizeof(digits);
+  while(n >= 100) {
+    at -= 2;
+    memcpy(at, &digitPairs[n % 100 * 2], 2);
+    n /= 100;
+  }
+  if(n >= 10) {
+    at -= 2;
+    memcpy(at, &digitPairs[n * 2], 2);
+  } else {
+    *--at = '0' + n;
+  }
+  uint32_t length = digits + sizeof(digits) - at;
+  if(length > OUT_BUFFER_SIZE - vm->outLength)
+    outFlush(vm);
+  memcpy(&vm->out[vm->outLength], at, length);
+  vm->outLength += length;
+}
+
+// Reads the number a GETN* pushes. At the end of input, or if the input isn't
+// a number, sets vm->last_error and returns 0.
+static int getNumber(VM* vm, uint32_t* n) {
+  if(vm->outLength)
+    outFlush(vm); // the prompt, if any
+  Input* in = vm->input ? vm->input : inputStdin();
+  int status = in ? inputNumber(in, n) : INPUT_END;
+  if(status == INPUT_OK)
+    return 1;
+  vm->last_error = status == INPUT_MALFORMED ? ERR_MALFORMED_INPUT : ERR_END_OF_INPUT;
+  return 0;
+}
+
+// Threaded dispatch: every handler ends in its own indirect jump through
+// dispatchTable, so the branch predictor gets one jump site per opcode instead
+// of the single shared jump of a switch. It needs GCC's labels as values; build
+// with -DCLAW_SWITCH_DISPATCH (make DISPATCH=switch) to get the portable switch.
+#if defined(__GNUC__) && !defined(CLAW_SWITCH_DISPATCH)
+#define CLAW_THREADED_DISPATCH
+#endif
+
+// opcodes with a handler in run(), besides the FUSED_OPS; everything else is a nop
+#define DISPATCH_TABLE(X) \
+  X(LET8) X(LET16) X(LET32) X(LETA) \
+  X(CPY8) X(CPY16) X(CPY32) X(CPYA) \
+  X(MOV8) X(MOV16) X(MOV32) X(MOVA) \
+  X(SWP8) X(SWP16) X(SWP32) \
+  X(DEL8) X(DEL16) X(DEL32) X(DELA) X(DELALL) X(MMCP) \
+  X(ADD8) X(ADD16) X(ADD32) X(SUB8) X(SUB16) X(SUB32) \
+  X(MUL8) X(MUL16) X(MUL32) X(DIV8) X(DIV16) X(DIV32) \
+  X(MOD8) X(MOD16) X(MOD32) \
+  X(SR8) X(SR16) X(SR32) X(SSR8) X(SSR16) X(SSR32) X(SL8) X(SL16) X(SL32) \
+  X(AND8) X(AND16) X(AND32) X(OR8) X(OR16) X(OR32) \
+  X(NOR8) X(NOR16) X(NOR32) X(NAND8) X(NAND16) X(NAND32) \
+  X(XOR8) X(XOR16) X(XOR32) \
+  X(ADDA8) X(ADDA16) X(ADDA32) X(SUBA8) X(SUBA16) X(SUBA32) \
+  X(ANDA8) X(ANDA16) X(ANDA32) X(ORA8) X(ORA16) X(ORA32) \
+  X(XORA8) X(XORA16) X(XORA32) \
+  X(NOT8) X(NOT16) X(NOT32) X(NEG8) X(NEG16) X(NEG32) \
+  X(INC8) X(INC16) X(INC32) X(DEC8) X(DEC16) X(DEC32) \
+  X(EQU8) X(EQU16) X(EQU32) \
+  X(STZ) X(STN) X(CLZ) X(CLN) X(TGZ) X(TGN) \
+  X(JMP) X(JMPZ) X(JMPNZ) X(JMPN) X(JMPNN) \
+  X(BR) X(BRZ) X(BRNZ) X(BRN) X(BRNN) X(CALL) X(RET) \
+  X(PPTR) X(ENDZ) X(ENDN) X(END) X(SLEEP) \
+  X(DMPSSTR) X(DMPN8) X(DMPN16) X(DMPN32) X(GETN8) X(GETN16) X(GETN32) \
+  X(CLR) X(FILL) X(COLOR) X(GMODE) X(MIRROR) X(FONT) X(POINT) X(GETPIX) \
+  X(HLINE) X(VLINE) X(LINE) X(RECT) X(LRECT) X(CIRCL) X(LCIRCL) \
+  X(ELIPS) X(LELIPS) X(POLY) X(PRINT) X(SPRT) X(BITM) X(SWBUFF) \
+  X(OP_RESYNC) X(OP_BREAK)
 
 #ifdef DEBUG
-    printf("PC 0x%u, instruction 0x%x, source %u, dest %u\n", pc-2, code, source, destination);
+#define DEBUG_TRACE() printf("PC 0x%x, instruction 0x%x, source %u, dest %u\n", IP_PC(), ip->op, ip->source, ip->destination)
+#else
+#define DEBUG_TRACE() (void)0
+#endif
+#define TRACE() (DEBUG_TRACE(), TRACED ? vm->trace(vm->traceArg, IP_PC(), ip->op) : (void)0)
+
+#ifdef CLAW_THREADED_DISPATCH
+#define DISPATCH() goto *(YIELD() ? &&yield : dispatchTable[(TRACE(), ip->op)])
+#else
+#define DISPATCH() goto dispatch
 #endif
-    switch(code) {
-      case LET8:
-        stackPush8bit(destination, fetch8bitLiteral(program));
-        break;
-      case LET16:
-        stackPush16bit(destination, fetch16bitLiteral(program));
-        break;
-      case LET32:
-        stackPush32bit(destination, fetch32bitLiteral(program));
-        break;
-      case LETA:
-      {
-        uint16_t len = stackPop16bit(source);
-        // this can be optimized to do a more direct copy, but remember to check for stack overflows
-        for(int i = 0; i < len; i++) {
-          stackPush8bit(destination, fetch8bitLiteral(program));
-        }
-        break;
-      }
-      case CPY8:
-        stackPush8bit(destination, stackPeek8bit(source));
-        break;
-      case CPY16:
-        stackPush16bit(destination, stackPeek16bit(source));
-        break;
-      case CPY32:
-        stackPush32bit(destination, stackPeek32bit(source));
-        break;
-      case CPYA:
-      {
-        uint16_t len = stackPop16bit(source);
-        if(sp[destination] + len >= STACK_SIZE) {
-          last_error = ERR_STACK_OVERFLOW;
-          break;
-        }
-        memcpy(&stacks[source][sp[source]-len], &stacks[destination][sp[destination]], len);
-        sp[destination] += len;
-        break;
-      }
-      case MOV8:
-        stackPush8bit(destination, stackPop8bit(source));
-        break;
-      case MOV16:
-        stackPush16bit(destination, stackPop16bit(source));
-        break;
-      case MOV32:
-        stackPush32bit(destination, stackPop32bit(source));
-        break;
-      case MOVA:
-      {
-        uint16_t len = stackPop16bit(source);
-        if(sp[source] >= len)
-          sp[source] -= len;
-        else {
-          last_error = ERR_STACK_UNDERFLOW;
-          break;
-        }
-        if(sp[destination] + len >= STACK_SIZE) {
-          last_error = ERR_STACK_OVERFLOW;
-          break;
-        }
-        memcpy(&stacks[source][sp[source]], &stacks[destination][sp[destination]], len);
-        sp[destination] += len;
-        break;
-      }
-      case SWP8:
-      {
-        uint8_t a = stackPop8bit(source);
-        stackPush8bit(source, stackPop8bit(destination));
-        stackPush8bit(destination, a);
-        break;
-      }
-      case SWP16:
-      {
-        uint16_t a = stackPop16bit(source);
-        stackPush16bit(source, stackPop16bit(destination));
-        stackPush16bit(destination, a);
-        break;
-      }
-      case SWP32:
-      {
-        uint32_t a = stackPop32bit(source);
-        stackPush32bit(source, stackPop32bit(destination));
-        stackPush32bit(destination, a);
-        break;
-      }
-      case DEL8:
-        stackPop8bit(source);
-        break;
-      case DEL16:
-        stackPop16bit(source);
-        break;
-      case DEL32:
-        stackPop32bit(source);
-        break;
-      case DELA:
-      {
-        uint16_t len = stackPop16bit(source);
-        if(sp[source] >= len)
-          sp[source] -= len;
-        else
-          last_error = ERR_STACK_UNDERFLOW;
-        break;
-      }
-      case DELALL:
-        for(int i = 0; i < NUM_STACKS; i++)
-          sp[0] = 0;
-        break;
-
-      // math
-      case ADD8:
-      {
-        uint8_t r = stackPop8bit(source) + stackPop8bit(source);
-        stackPush8bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case ADD16:
-      {
-        uint16_t r = stackPop16bit(source) + stackPop16bit(source);
-        stackPush16bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case ADD32:
-      {
-        uint32_t r = stackPop32bit(source) + stackPop32bit(source);
-        stackPush32bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case SUB8:
-      {
-        uint8_t op1 = stackPop8bit(source);
-        uint8_t r = stackPop8bit(source) - op1;
-        stackPush8bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case SUB16:
-      {
-        uint16_t op1 = stackPop16bit(source);
-        uint16_t r = stackPop16bit(source) - op1;
-        stackPush16bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case SUB32:
-      {
-        uint32_t op1 = stackPop32bit(source);
-        uint32_t r = stackPop32bit(source) - op1;
-        stackPush32bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case MUL8:
-      {
-        uint8_t r = stackPop8bit(source) * stackPop8bit(source);
-        stackPush8bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case MUL16:
-      {
-        uint16_t r = stackPop16bit(source) * stackPop16bit(source);
-        stackPush16bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case MUL32:
-      {
-        uint32_t r = stackPop32bit(source) * stackPop32bit(source);
-        stackPush32bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case DIV8:
-      {
-        uint8_t op1 = stackPop8bit(source);
-        uint8_t r = stackPop8bit(source) / op1;
-        stackPush8bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case DIV16:
-      {
-        uint16_t op1 = stackPop16bit(source);
-        uint16_t r = stackPop16bit(source) / op1;
-        stackPush16bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case DIV32:
-      {
-        uint32_t op1 = stackPop32bit(source);
-        uint32_t r = stackPop32bit(source) / op1;
-        stackPush32bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case MOD8:
-      {
-        uint8_t op1 = stackPop8bit(source);
-        uint8_t r = stackPop8bit(source) % op1;
-        stackPush8bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case MOD16:
-      {
-        uint16_t op1 = stackPop16bit(source);
-        uint16_t r = stackPop16bit(source) % op1;
-        stackPush16bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-      case MOD32:
-      {
-        uint32_t op1 = stackPop32bit(source);
-        uint32_t r = stackPop32bit(source) % op1;
-        stackPush32bit(destination, r);
-        updateFlags(r);
-        break;
-      }
-
-      // bitwise shifts
-      case SR8:
-      {
-        uint8_t places = stackPop8bit(source);
-        uint8_t value = stackPop8bit(source) >> places;
-        stackPush8bit(destination, value);
-        updateFlags(value);
-        break;
-      }
-      case SR16:
-      {
-        uint16_t places = stackPop16bit(source);
-        uint16_t value = stackPop16bit(source) >> places;
-        stackPush16bit(destination, value);
-        updateFlags(value);
-        break;
-      }
-      case SR32:
-      {
-        uint32_t places = stackPop32bit(source);
-        uint32_t value = stackPop32bit(source) >> places;
-        stackPush32bit(destination, value);
-        updateFlags(value);
-        break;
-      }
-      case SSR8:
-      {
-        uint8_t places = stackPop8bit(source);
-        int8_t value = (int8_t)stackPop8bit(source) >> places;
-        stackPush8bit(destination, value);
-        updateFlags(value);
-        break;
-      }
-      case SSR16:
-      {
-        uint16_t places = stackPop16bit(source);
-        int16_t value = (int16_t)stackPop16bit(source) >> places;
-        stackPush16bit(destination, value);
-        updateFlags(value);
-        break;
-      }
-      case SSR32:
-      {
-        uint32_t places = stackPop32bit(source);
-        int32_t value = (int32_t)stackPop32bit(source) >> places;
-        stackPush32bit(destination, value);
-        updateFlags(value);
-        break;
-      }
-      case SL8:
-      {
-        uint8_t places = stackPop8bit(source);
-        int8_t value = (int8_t)stackPop8bit(source) << places;
-        stackPush8bit(destination, value);
-        updateFlags(value);
-        break;
-      }
-      case SL16:
-      {
-        uint16_t places = stackPop16bit(source);
-        int16_t value = (int16_t)stackPop16bit(source) << places;
-        stackPush16bit(destination, value);
-        updateFlags(value);
-        break;
-      }
-      case SL32:
-      {
-        uint32_t places = stackPop32bit(source);
-        int32_t value = (int32_t)stackPop32bit(source) << places;
-        stackPush32bit(destination, value);
-        updateFlags(value);
-        break;
-      }
-
-      // other bitwise operations with two operands
-      case AND8:
-      {
-        uint8_t v = stackPop8bit(source) & stackPop8bit(source);
-        stackPush8bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case AND16:
-      {
-        uint16_t v = stackPop16bit(source) & stackPop16bit(source);
-        stackPush16bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case AND32:
-      {
-        uint32_t v = stackPop32bit(source) & stackPop32bit(source);
-        stackPush32bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case OR8:
-      {
-        uint8_t v = stackPop8bit(source) | stackPop8bit(source);
-        stackPush8bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case OR16:
-      {
-        uint16_t v = stackPop16bit(source) | stackPop16bit(source);
-        stackPush16bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case OR32:
-      {
-        uint32_t v = stackPop32bit(source) | stackPop32bit(source);
-        stackPush32bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NOR8:
-      {
-        uint8_t v = ~(stackPop8bit(source) | stackPop8bit(source));
-        stackPush8bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NOR16:
-      {
-        uint16_t v = ~(stackPop16bit(source) | stackPop16bit(source));
-        stackPush16bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NOR32:
-      {
-        uint32_t v = ~(stackPop32bit(source) | stackPop32bit(source));
-        stackPush32bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NAND8:
-      {
-        uint8_t v = ~(stackPop8bit(source) & stackPop8bit(source));
-        stackPush8bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NAND16:
-      {
-        uint16_t v = ~(stackPop16bit(source) & stackPop16bit(source));
-        stackPush16bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NAND32:
-      {
-        uint32_t v = ~(stackPop32bit(source) & stackPop32bit(source));
-        stackPush32bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case XOR8:
-      {
-        uint8_t v = stackPop8bit(source) ^ stackPop8bit(source);
-        stackPush8bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case XOR16:
-      {
-        uint16_t v = stackPop16bit(source) ^ stackPop16bit(source);
-        stackPush16bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case XOR32:
-      {
-        uint32_t v = stackPop32bit(source) ^ stackPop32bit(source);
-        stackPush32bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-
-      // bitwise operations with one operand
-      case NOT8:
-      {
-        uint8_t v = ~ stackPop8bit(source);
-        stackPush8bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NOT16:
-      {
-        uint16_t v = ~ stackPop16bit(source);
-        stackPush16bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NOT32:
-      {
-        uint32_t v = ~ stackPop32bit(source);
-        stackPush32bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NEG8:
-      {
-        int8_t v = -(int8_t)stackPop8bit(source);
-        stackPush8bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NEG16:
-      {
-        int16_t v = -(int16_t)stackPop16bit(source);
-        stackPush16bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      case NEG32:
-      {
-        int32_t v = -(int32_t)stackPop32bit(source);
-        stackPush32bit(destination, v);
-        updateFlags(v);
-        break;
-      }
-      // increment / decrement
-      case INC8:
-      {
-        uint8_t* v = &stacks[source][sp[source] - 1];
-        (*v)++;
-        updateFlags(*v);
-        break;
-      }
-      case INC16:
-      {
-        void* v = &stacks[source][sp[source] - 2];
-        (*(uint16_t*)v)++;
-        updateFlags(*(uint16_t*)v);
-        break;
-      }
-      case INC32:
-      {
-        void* v = &stacks[source][sp[source] - 4];
-        (*(uint32_t*)v)++;
-        updateFlags(*(uint32_t*)v);
-        break;
-      }
-      case DEC8:
-      {
-        uint8_t* v = &stacks[source][sp[source] - 1];
-        (*v)--;
-        updateFlags(*v);
-        break;
-      }
-      case DEC16:
-      {
-        void* v = &stacks[source][sp[source] - 2];
-        (*(uint16_t*)v)--;
-        updateFlags(*(uint16_t*)v);
-        break;
-      }
-      case DEC32:
-      {
-        void* v = &stacks[source][sp[source] - 4];
-        (*(uint32_t*)v)--;
-        updateFlags(*(uint32_t*)v);
-        break;
-      }
-      // equality tests and manual flag manipulation
-      case EQU8:
-      {
-        uint8_t op1 = stackPop8bit(source);
-        updateFlags(stackPop8bit(source) - op1);
-        break;
-      }
-      case EQU16:
-      {
-        uint16_t op1 = stackPop16bit(source);
-        updateFlags(stackPop16bit(source) - op1);
-        break;
-      }
-      case EQU32:
-      {
-        uint8_t op1 = stackPop32bit(source);
-        updateFlags(stackPop32bit(source) - op1);
-        break;
-      }
-      case STZ:
-        flag_zero = 1;
-        break;
-      case STN:
-        flag_negative = 1;
-        break;
-      case CLZ:
-        flag_zero = 0;
-        break;
-      case CLN:
-        flag_negative = 0;
-        break;
-      case TGZ:
-        flag_zero = !flag_zero;
-        break;
-      case TGN:
-        flag_negative = !flag_negative;
-        break;
-
-
-      // flow control
-      case JMP:
-        pc = stackPop32bit(source);
-        break;
-      case JMPZ:
-      case JMPNZ:
-      case JMPN:
-      case JMPNN:
-      {
-        uint32_t loc = stackPop32bit(source);
-        if((code == JMPZ && flag_zero) ||
-           (code == JMPNZ && !flag_zero) ||
-           (code == JMPN && flag_negative) ||
-           (code == JMPNN && !flag_negative)) {
-          pc = loc;
-        }
-        break;
-      }
-      case BR:
-        pc += (int16_t)fetch16bitLiteral(program);
-        break;
-      case BRZ:
-      case BRNZ:
-      case BRN:
-      case BRNN:
-      {
-        int16_t offset = fetch16bitLiteral(program);
-        if((code == BRZ && flag_zero) ||
-           (code == BRNZ && !flag_zero) ||
-           (code == BRN && flag_negative) ||
-           (code == BRNN && !flag_negative)) {
-          pc += offset;
-        }
-        break;
-      }
-      case PPTR:
-        stackPush32bit(destination, pc);
-        break;
-      case ENDZ:
-        if(flag_zero)
-          return;
-        break;
-      case ENDN:
-        if(flag_negative)
-          return;
-        break;
-      case END:
-        return;
-
-      // debug instructions
-      case DMPSSTR:
-      {
-        char c;
-        while((c = fetch8bitLiteral(program))) {
-          putchar(c);
-        }
-        break;
-      }
-      case DMPN8:
-        printf("%u", stackPop8bit(source));
-        break;
-      case DMPN16:
-        printf("%u", stackPop16bit(source));
-        break;
-      case DMPN32:
-        printf("%u", stackPop32bit(source));
-        break;
-      case GETN8:
-      {
-        uint32_t n;
-        scanf("%u", &n);
-        stackPush8bit(destination, n);
-        break;
-      }
-      case GETN16:
-      {
-        uint32_t n;
-        scanf("%u", &n);
-        stackPush16bit(destination, n);
-        break;
-      }
-      case GETN32:
-      {
-        uint32_t n;
-        scanf("%u", &n);
-        stackPush32bit(destination, n);
-        break;
-      }
-      // default: nop
+
+// byte pc of the current record; all three scratch records stand for scratchPc
+#define IP_PC() ((uintptr_t)ip - (uintptr_t)scratch < sizeof(scratch) ? scratchPc : prog->pcOf[ip - prog->code])
+// byte pc to carry on from at the current record, which a resync record holds
+#define RESUME_PC() (ip->op == OP_RESYNC ? ip->imm : IP_PC())
+
+int vmCreate(VM* vm, const uint32_t* sizes) {
+  memset(&vm->sprites, 0, sizeof(vm->sprites));
+  // a whole number of cache lines
+  size_t total = OUT_BUFFER_SIZE + CALL_DEPTH * sizeof(uint32_t) + 2 * SCREEN_BYTES;
+  for(int i = 0; i < NUM_STACKS; i++) {
+    uint32_t size = sizes ? sizes[i] : STACK_SIZE;
+    if(size == 0 || size > MAX_STACK_SIZE) {
+      errno = EINVAL;
+      return -1;
     }
+    vm->stackSize[i] = size;
+    total += (size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
   }
-  last_error = ERR_TARGET;
-}
-
-int main(int argc, char *argv[]) {
-  /* PASTEBIN SAMPLE
-  LET8 A
-  .db8u(101)
-  LET8 A  
-  .db8u(99)
-  ADD8 A
-  LET8 A  
-  .db8u(200)
-  SUB8 A
-  BRZ A
-  .db16(2)     
-  END       
-  MOV8 A B
-  END
-  */
-  if(argc < 2) {
-    printf("Give me an input file!\n");
-    return 1;
+  // Anonymous memory is only backed by pages as they are first touched, so a
+  // program that never gets deep into its stacks, or never prints, never pays
+  // for them, or never draws.
+  // MAP_NORESERVE keeps big, mostly idle stacks from counting against overcommit.
+  uint8_t* arena = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(arena == MAP_FAILED)
+    return -1;
+  vm->arena = arena;
+  vm->arenaSize = total;
+  vm->out = (char*)arena;
+  arena += OUT_BUFFER_SIZE;
+  vm->calls = (uint32_t*)arena;
+  arena += CALL_DEPTH * sizeof(uint32_t);
+  vm->screen.back = arena;
+  vm->screen.front = arena + SCREEN_BYTES;
+  vm->screen.drawn = 0;
+  arena += 2 * SCREEN_BYTES;
+  for(int i = 0; i < NUM_STACKS; i++) {
+    vm->stacks[i] = arena;
+    vm->stackEnd[i] = arena + vm->stackSize[i];
+    arena += (vm->stackSize[i] + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
   }
-  FILE* f = fopen(argv[1], "r");
-  if(f == NULL) {
-    printf("Error opening input file\n");
-    return 1;
+  return 0;
+}
+
+void vmDestroy(VM* vm) {
+  if(vm->arena)
+    munmap(vm->arena, vm->arenaSize);
+  vm->arena = NULL;
+  vm->out = NULL;
+  vm->calls = NULL;
+  vm->screen.back = vm->screen.front = NULL;
+  spriteFree(&vm->sprites);
+  memset(vm->stacks, 0, sizeof(vm->stacks));
+  memset(vm->stackEnd, 0, sizeof(vm->stackEnd));
+}
+
+void vmInit(VM* vm, const Program* program) {
+  vm->program = program;
+  vm->mode = MODE_PLAIN;
+  vm->trace = NULL;
+  vm->traceArg = NULL;
+  vm->outFd = STDOUT_FILENO;
+  vm->output = NULL;
+  vm->outputArg = NULL;
+  vm->outLength = 0;
+  vm->input = NULL;
+  vm->frame = NULL;
+  vm->frameArg = NULL;
+  vm->sleepMode = SLEEP_WAIT;
+  spriteFlush(&vm->sprites);
+  vmReset(vm);
+}
+
+void vmReset(VM* vm) {
+  vm->pc = 0;
+  memset(vm->sp, 0, sizeof(vm->sp));
+  vm->callDepth = 0;
+  vm->resumeVerified = 0;
+  screenReset(&vm->screen);
+  vm->last_error = NONE;
+  vm->flags = flagsOf(1, 0); // reset flags
+}
+
+#define RUN_NATIVE -1 // what a JITTED RUN returns to hand over to native code
+
+#define RUN runPlain
+#define TOS_CACHE 0
+#define TRACED 0
+#define JITTED 0
+#define CHECKED 1
+#include "interp.h"
+#undef RUN
+#undef TOS_CACHE
+#undef TRACED
+#undef JITTED
+#undef CHECKED
+
+#define RUN runTosCached
+#define TOS_CACHE 1
+#define TRACED 0
+#define JITTED 0
+#define CHECKED 1
+#include "interp.h"
+#undef RUN
+#undef TOS_CACHE
+#undef TRACED
+#undef JITTED
+#undef CHECKED
+
+#define RUN runTraced
+#define TOS_CACHE 0
+#define TRACED 1
+#define JITTED 0
+#define CHECKED 1
+#include "interp.h"
+#undef RUN
+#undef TOS_CACHE
+#undef TRACED
+#undef JITTED
+#undef CHECKED
+
+#define RUN runBetweenNative
+#define TOS_CACHE 0
+#define TRACED 0
+#define JITTED 1
+#define CHECKED 1
+#include "interp.h"
+#undef RUN
+#undef TOS_CACHE
+#undef TRACED
+#undef JITTED
+#undef CHECKED
+
+#define RUN runVerified
+#define TOS_CACHE 0
+#define TRACED 0
+#define JITTED 0
+#define CHECKED 0
+#include "interp.h"
+#undef RUN
+#undef TOS_CACHE
+#undef TRACED
+#undef JITTED
+#undef CHECKED
+
+// programVerify() assumed the run starts at pc 0 with every stack empty, and
+// found how deep the stacks need to be
+static int startsVerified(const VM* vm) {
+  if(!vm->program->verified || vm->pc != 0)
+    return 0;
+  for(int i = 0; i < NUM_STACKS; i++) {
+    if(vm->sp[i] || vm->program->depth[i] >= vm->stackSize[i])
+      return 0;
   }
+  return 1;
+}
 
-  // obtain file size:
-  fseek(f , 0 , SEEK_END);
-  size_t size = ftell (f);
-  rewind(f);
-
-  uint8_t* program = (uint8_t*)malloc(sizeof(uint8_t)*size);
-  if (program == NULL) {fputs ("Memory error",stderr); exit (2);}
-
-  size_t result = fread (program, 1, size, f);
-  if (result != size) {fputs ("Reading error",stderr); exit (3);}
-
-  fclose(f);
-  run(program, size);
-  switch(last_error) {
-    case ERR_ARITHMETIC:
-      printf("Runtime error: arithmetic exception at PC %x\n", pc);
-      break;
-    case ERR_STACK_UNDERFLOW:
-      printf("Runtime error: stack underflow at PC %x\n", pc);
-      break;
-    case ERR_STACK_OVERFLOW:
-      printf("Runtime error: stack overflow at PC %x\n", pc);
-      break;
-    case ERR_INSUFFICIENT_PERMISSIONS:
-      printf("Runtime error: insufficient permissions at PC %x\n", pc);
-      break;
-    case ERR_TARGET:
-      printf("Runtime error: target %x out of bounds\n", pc);
-      break;
-    default:
-      break;
+// Alternates between native code and the interpreter, which gives control
+// back at the next record native code starts at.
+static RunStatus runJit(VM* vm) {
+  for(;;) {
+    int status = jitEnter(vm);
+    if(status == JIT_END)
+      return RUN_ENDED;
+    if(status == JIT_EXIT)
+      continue;
+    if(status == JIT_YIELD)
+      return RUN_YIELD;
+    status = runBetweenNative(vm);
+    if(status != RUN_NATIVE)
+      return status;
   }
-  return 0;
-}
\ No newline at end of file
+}
+
+static RunStatus run(VM* vm) {
+  RunStatus status;
+  if(vm->mode == MODE_TOS_CACHE)
+    status = runTosCached(vm);
+  else if(vm->mode == MODE_TRACED)
+    status = runTraced(vm);
+  else if(vm->mode == MODE_JIT)
+    status = runJit(vm);
+  else if(vm->resumeVerified || startsVerified(vm)) {
+    status = runVerified(vm);
+    vm->resumeVerified = status == RUN_SLEEP || status == RUN_YIELD;
+  } else
+    status = runPlain(vm);
+  if(vm->outLength)
+    outFlush(vm);
+  return status;
+}
+
+RunStatus vmRun(VM* vm) {
+  vm->budget = INT64_MAX;
+  return run(vm);
+}
+
+RunStatus vmRunFor(VM* vm, uint64_t instructions) {
+  if(instructions == 0)
+    return RUN_YIELD;
+  vm->budget = instructions < INT64_MAX ? (int64_t)instructions : INT64_MAX;
+  return run(vm);
+}
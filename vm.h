@@ -0,0 +1,129 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "program.h"
+#include "input.h"
+#include "screen.h"
+#include "sprite.h"
+#include "font.h"
+
+#define STACK_SIZE 1024 // in bytes, unless vmCreate() is given other sizes
+#define MAX_STACK_SIZE (1u << 30)
+#define CALL_DEPTH 256 // CALLs that can be waiting for their RET at once
+// What DMPN*/DMPSSTR print collects here and goes out in one write() at a time.
+// No bigger than PIPE_BUF, so the output of runs on different threads only
+// interleaves between whole flushes when stdout is a pipe.
+#define OUT_BUFFER_SIZE 4096
+// what stack arenas, and data that threads share, are aligned and padded to
+#define CACHE_LINE 64
+
+typedef enum {
+  NONE = 0,
+  ERR_ARITHMETIC,
+  ERR_STACK_OVERFLOW,
+  ERR_STACK_UNDERFLOW,
+  ERR_INSUFFICIENT_PERMISSIONS,
+  ERR_TARGET, // PC out of bounds, or a BITM/SPRT image past the end of the program
+  ERR_END_OF_INPUT, // GETN* found no number left
+  ERR_MALFORMED_INPUT, // GETN* found something other than a 32-bit unsigned number
+  ERR_CALL_OVERFLOW, // CALL with CALL_DEPTH calls already waiting
+  ERR_CALL_UNDERFLOW, // RET with no CALL to return from
+} RuntimeError;
+
+typedef enum {
+  MODE_PLAIN = 0,
+  MODE_TOS_CACHE, // keep the top stack element in a register, see Tos in vm.c
+  MODE_TRACED, // like MODE_PLAIN, but calls vm->trace before every instruction
+  MODE_JIT, // native code where jitCompile() made some, MODE_PLAIN elsewhere
+} ExecMode;
+
+// What SLEEP does with the milliseconds it pops.
+typedef enum {
+  SLEEP_WAIT = 0, // the calling thread sleeps that long, output flushed first
+  SLEEP_SKIP, // nothing: virtual time, for runs that don't need the clock
+  SLEEP_PARK, // vmRun() returns RUN_SLEEP, for a scheduler to resume it later
+} SleepMode;
+
+// Called with the byte pc and opcode (or internal handler, see program.h) of
+// every instruction a MODE_TRACED run is about to execute.
+typedef void (*TraceHook)(void* arg, uint32_t pc, unsigned int op);
+
+// Gets the program's buffered output, in order, in place of VM.outFd.
+typedef void (*OutputHook)(void* arg, const char* bytes, uint32_t length);
+
+// Called after every SWBUFF, with the new frame in screen->front and what
+// changed from the one before in screen->rects.
+typedef void (*FrameHook)(void* arg, const Screen* screen);
+
+// Everything one running CLAW program owns. Instances share nothing but the
+// (read-only) Program, so any number of them can run at once on different threads.
+typedef struct {
+  const Program* program;
+  ExecMode mode;
+  uint32_t pc; // where vmRun() starts; after an error, where it happened
+  uint32_t sp[NUM_STACKS]; // stack pointers always point to the next free position
+  uint8_t* stacks[NUM_STACKS]; // stackSize[i] bytes each, all in one arena
+  uint32_t stackSize[NUM_STACKS];
+  uint8_t* stackEnd[NUM_STACKS]; // stacks[i] + stackSize[i], for native code's bounds checks
+  uint32_t* calls; // CALL_DEPTH return byte pcs, in the arena; a stack of its own
+  uint32_t callDepth; // how many of them are waiting
+  // The zero and negative flags, evaluated lazily: the last result, sign-extended
+  // to 64 bits. Z is set if its low 32 bits are zero and N if it is negative,
+  // so INT64_MIN is the one value with both set (STZ after STN and the like).
+  int64_t flags;
+  RuntimeError last_error;
+  TraceHook trace;
+  void* traceArg;
+  int outFd; // where the program prints: STDOUT_FILENO after vmInit(), or -1 for stdout through stdio
+  OutputHook output; // NULL after vmInit()
+  void* outputArg;
+  uint32_t outLength; // bytes waiting in out
+  char* out; // OUT_BUFFER_SIZE bytes, at the start of the arena
+  Input* input; // where GETN* reads; NULL (after vmInit()) for stdin
+  Screen screen; // what the graphics opcodes draw on; its buffers are in the arena
+  SpriteCache sprites; // BITM and SPRT images, decoded as first drawn
+  FrameHook frame; // NULL after vmInit()
+  void* frameArg;
+  SleepMode sleepMode; // SLEEP_WAIT after vmInit()
+  uint32_t sleep; // ms the SLEEP that returned RUN_SLEEP asked for
+  int resumeVerified; // that SLEEP or slice was in a verified run, which it resumes as
+  int64_t budget; // instructions left of the slice vmRunFor() was given
+  void* arena;
+  size_t arenaSize;
+} VM;
+
+// Gives vm its stacks, sizes[i] bytes each (STACK_SIZE if sizes is NULL), its
+// return stack, its output buffer and its screen buffers, in one mapping that
+// the system only backs with memory as they are first touched. Each stack
+// starts on a cache line of its own. Every VM needs this once before vmInit();
+// vmDestroy() gives the memory back. Returns 0, or -1 with errno set if a size
+// is 0 or over MAX_STACK_SIZE or memory ran out.
+int vmCreate(VM* vm, const uint32_t* sizes);
+void vmDestroy(VM* vm);
+
+// Binds vm to program and resets it to the program's start, in MODE_PLAIN.
+void vmInit(VM* vm, const Program* program);
+void vmReset(VM* vm);
+
+// how vmRun() returned
+typedef enum {
+  RUN_ENDED, // END, an error (see last_error), or the end of the program
+  RUN_BREAK, // at the breakpoint (see programBreak()), which vm->pc is left at
+  RUN_SLEEP, // at a SLEEP in SLEEP_PARK, with vm->pc after it
+  RUN_YIELD, // out of vmRunFor()'s budget, with vm->pc where to carry on
+} RunStatus;
+
+// Runs from vm->pc until END, an error, or the end of the program. Everything
+// the program printed has been written out by the time it returns.
+RunStatus vmRun(VM* vm);
+// Like vmRun(), but returns RUN_YIELD once the run has taken about instructions
+// instructions, for a host to share a thread between runs or stop one that
+// doesn't end. Calling either again carries on exactly where it stopped. The
+// count is only checked on branches and jumps back, and counts each loop
+// iteration as long as the loop's body (see interp.h), so a slice can end a
+// little early, or run on by less than the program's length.
+RunStatus vmRunFor(VM* vm, uint64_t instructions);
+
+#endif